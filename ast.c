@@ -0,0 +1,787 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "ast.h"
+
+
+// ===== Arena =====
+
+void *arena_alloc(Arena *arena, size_t size) {
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+    ArenaBlock *block = arena->head;
+    if (block == NULL || block->used + size > block->cap) {
+        size_t cap = size > ARENA_BLOCK ? size : ARENA_BLOCK;
+        block = malloc(sizeof(ArenaBlock) + cap);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->used = 0;
+        block->cap = cap;
+        block->next = arena->head;
+        arena->head = block;
+    }
+    void *ptr = (char *)block->data + block->used;
+    block->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+}
+
+
+void arena_reset(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    if (block == NULL) {
+        return;
+    }
+    arena->head = block->next;
+    arena_free(arena);
+    block->next = NULL;
+    block->used = 0;
+    arena->head = block;
+}
+
+
+// ===== Lexer =====
+
+typedef enum {
+    TOK_END,
+    TOK_WORD,
+    TOK_IO_NUMBER,      // the n of n> or n<
+    TOK_NEWLINE,
+    TOK_SEMI,           // ;
+    TOK_AMP,            // &
+    TOK_AND,            // &&
+    TOK_PIPE,           // |
+    TOK_OR,             // ||
+    TOK_LESS,           // <
+    TOK_GREAT,          // >
+    TOK_DGREAT,         // >>
+    TOK_LESSAND,        // <&
+    TOK_GREATAND,       // >&
+    TOK_LPAREN,
+    TOK_RPAREN
+} TokenKind;
+
+/* Lexer and parser state. The parser looks at one token at a time; words
+ * are split into parts as they are lexed, so text is read exactly once.
+ */
+typedef struct {
+    Arena *arena;
+    const char *text;
+    size_t len;
+    size_t pos;             // next byte to lex
+    TokenKind kind;         // current token
+    size_t start, end;      // its span in text
+    size_t prev_end;        // end of the token before it
+    Word *word;             // TOK_WORD
+    int io_number;          // TOK_IO_NUMBER
+    int error;              // first PARSE_* error, 0 if none
+    size_t error_at;
+} Parser;
+
+
+// character classes, one table lookup per byte of input
+#define CH_BLANK 1          // space, tab
+#define CH_META 2           // ends an unquoted word
+#define CH_SPECIAL 4        // starts something other than plain text in a word
+#define CH_NAME 8           // may appear in a $name
+#define CH_DIGIT 16
+
+static const unsigned char char_class[256] = {
+    [' '] = CH_BLANK | CH_META, ['\t'] = CH_BLANK | CH_META, ['\n'] = CH_META,
+    ['|'] = CH_META, ['&'] = CH_META, [';'] = CH_META, ['<'] = CH_META,
+    ['>'] = CH_META, ['('] = CH_META, [')'] = CH_META,
+    ['\\'] = CH_SPECIAL, ['\''] = CH_SPECIAL, ['"'] = CH_SPECIAL, ['$'] = CH_SPECIAL,
+    ['_'] = CH_NAME,
+    ['0' ... '9'] = CH_NAME | CH_DIGIT, ['a' ... 'z'] = CH_NAME, ['A' ... 'Z'] = CH_NAME,
+};
+
+static int char_is(char c, int class) {
+    return char_class[(unsigned char)c] & class;
+}
+
+
+static int is_blank(char c) {
+    return char_is(c, CH_BLANK);
+}
+
+
+static int is_meta(char c) {
+    return char_is(c, CH_META);
+}
+
+
+static void parse_fail(Parser *p, int error, size_t at) {
+    if (p->error == 0) {
+        p->error = error;
+        p->error_at = at;
+    }
+    p->kind = TOK_END;      // unwinds every loop
+}
+
+
+/* The current token cannot go here: a syntax error, or, at the end of
+ * the input, a command still being typed
+ */
+static void unexpected(Parser *p) {
+    parse_fail(p, p->kind == TOK_END ? PARSE_INCOMPLETE : PARSE_SYNTAX, p->start);
+}
+
+
+static void *node(Parser *p, size_t size) {
+    void *ptr = arena_alloc(p->arena, size);
+    if (ptr == NULL) {
+        parse_fail(p, PARSE_NO_MEMORY, p->start);
+    }
+    return ptr;
+}
+
+
+/* Appends a part to the word being lexed
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int add_part(Parser *p, WordPart ***tail, PartKind kind, size_t at, size_t len) {
+    WordPart *part = node(p, sizeof(WordPart));
+    if (part == NULL) {
+        return -1;
+    }
+    part->kind = kind;
+    part->text = p->text + at;
+    part->len = len;
+    **tail = part;
+    *tail = &part->next;
+    return 0;
+}
+
+
+/* Lexes $name, ${name} or a lone '$' at p->pos
+ * Return: 0 on success, -1 on error
+ */
+static int lex_dollar(Parser *p, WordPart ***tail) {
+    const char *text = p->text;
+    size_t at = p->pos + 1;
+    if (at < p->len && text[at] == '{') {
+        const char *close = memchr(text + at, '}', p->len - at);
+        if (close == NULL) {
+            parse_fail(p, PARSE_INCOMPLETE, p->pos);
+            return -1;
+        }
+        size_t name_len = close - text - at - 1;
+        if (name_len == 0) {
+            parse_fail(p, PARSE_SYNTAX, p->pos);
+            return -1;
+        }
+        p->pos = close - text + 1;
+        return add_part(p, tail, PART_VAR, at + 1, name_len);
+    }
+
+    // sh's names: $# or $@, digits ($1..), or letters, digits and '_'
+    size_t end = at;
+    if (end < p->len && (text[end] == '#' || text[end] == '@')) {
+        end++;
+    } else if (end < p->len && char_is(text[end], CH_DIGIT)) {
+        while (end < p->len && char_is(text[end], CH_DIGIT)) end++;
+    } else {
+        while (end < p->len && char_is(text[end], CH_NAME)) end++;
+    }
+    if (end == at) {
+        p->pos = at;
+        return add_part(p, tail, PART_TEXT, at - 1, 1);     // names nothing: literal
+    }
+    p->pos = end;
+    return add_part(p, tail, PART_VAR, at, end - at);
+}
+
+
+/* Lexes the word at p->pos into p->word
+ */
+static void lex_word(Parser *p) {
+    const char *text = p->text;
+    Word *word = node(p, sizeof(Word));
+    if (word == NULL) return;
+    WordPart **tail = &word->parts;
+    int quoted = 0;
+
+    while (p->pos < p->len && !is_meta(text[p->pos])) {
+        size_t at = p->pos;
+        int err = 0;
+        if (text[at] == '\\') {
+            if (at + 1 == p->len) {
+                parse_fail(p, PARSE_INCOMPLETE, at);
+                return;
+            }
+            p->pos = at + 2;
+            if (text[at + 1] != '\n') {     // backslash-newline joins lines
+                err = add_part(p, &tail, PART_TEXT, at + 1, 1);
+            }
+        } else if (text[at] == '\'') {
+            const char *close = memchr(text + at + 1, '\'', p->len - at - 1);
+            if (close == NULL) {
+                parse_fail(p, PARSE_INCOMPLETE, at);
+                return;
+            }
+            p->pos = close - text + 1;
+            err = add_part(p, &tail, PART_TEXT, at + 1, p->pos - at - 2);
+            quoted = 1;
+        } else if (text[at] == '"') {
+            quoted = 1;
+            p->pos++;
+            while (!err) {
+                at = p->pos;
+                if (at == p->len) {
+                    parse_fail(p, PARSE_INCOMPLETE, at);
+                    return;
+                }
+                if (text[at] == '"') {
+                    p->pos++;
+                    break;
+                }
+                if (text[at] == '\\' && at + 1 < p->len && strchr("$\"\\\n", text[at + 1]) != NULL) {
+                    p->pos = at + 2;
+                    if (text[at + 1] != '\n') {
+                        err = add_part(p, &tail, PART_TEXT, at + 1, 1);
+                    }
+                } else if (text[at] == '$') {
+                    err = lex_dollar(p, &tail);
+                } else {
+                    size_t end = at + 1;
+                    while (end < p->len && text[end] != '"' && text[end] != '\\' && text[end] != '$') end++;
+                    p->pos = end;
+                    err = add_part(p, &tail, PART_TEXT, at, end - at);
+                }
+            }
+        } else if (text[at] == '$') {
+            err = lex_dollar(p, &tail);
+        } else {
+            size_t end = at + 1;
+            while (end < p->len && !char_is(text[end], CH_META | CH_SPECIAL)) end++;
+            p->pos = end;
+            err = add_part(p, &tail, PART_TEXT, at, end - at);
+        }
+        if (err) return;
+    }
+
+    if (word->parts == NULL) {
+        // only quotes ("") or joined lines: an empty word, or none at all
+        if (!quoted) {
+            p->word = NULL;
+            return;
+        }
+        if (add_part(p, &tail, PART_TEXT, p->pos, 0) < 0) return;
+    } else if (word->parts->next == NULL && word->parts->kind == PART_VAR &&
+               word->parts->len == 1 && word->parts->text[0] == '@') {
+        word->parts->kind = PART_ARGS;
+    }
+    p->word = word;
+}
+
+
+/* Moves to the next token
+ */
+static void next_token(Parser *p) {
+    const char *text = p->text;
+    p->prev_end = p->end;
+    p->word = NULL;
+    while (p->word == NULL) {
+        // blanks, joined lines and comments
+        while (p->pos < p->len) {
+            if (is_blank(text[p->pos])) {
+                p->pos++;
+            } else if (text[p->pos] == '\\' && p->pos + 1 < p->len && text[p->pos + 1] == '\n') {
+                p->pos += 2;
+            } else if (text[p->pos] == '#') {
+                while (p->pos < p->len && text[p->pos] != '\n') p->pos++;
+            } else {
+                break;
+            }
+        }
+        p->start = p->pos;
+        if (p->pos == p->len) {
+            p->kind = TOK_END;
+            p->end = p->pos;
+            return;
+        }
+
+        char c = text[p->pos];
+        char c2 = p->pos + 1 < p->len ? text[p->pos + 1] : '\0';
+        size_t op_len = 1;
+        switch (c) {
+            case '\n': p->kind = TOK_NEWLINE; break;
+            case ';': p->kind = TOK_SEMI; break;
+            case '(': p->kind = TOK_LPAREN; break;
+            case ')': p->kind = TOK_RPAREN; break;
+            case '&':
+                p->kind = c2 == '&' ? TOK_AND : TOK_AMP;
+                op_len += c2 == '&';
+                break;
+            case '|':
+                p->kind = c2 == '|' ? TOK_OR : TOK_PIPE;
+                op_len += c2 == '|';
+                break;
+            case '<':
+                p->kind = c2 == '&' ? TOK_LESSAND : TOK_LESS;
+                op_len += c2 == '&';
+                break;
+            case '>':
+                p->kind = c2 == '>' ? TOK_DGREAT : c2 == '&' ? TOK_GREATAND : TOK_GREAT;
+                op_len += c2 == '>' || c2 == '&';
+                break;
+            default:
+                if (char_is(c, CH_DIGIT) && (c2 == '<' || c2 == '>')) {
+                    p->kind = TOK_IO_NUMBER;
+                    p->io_number = c - '0';
+                    break;
+                }
+                p->kind = TOK_WORD;
+                op_len = 0;
+                lex_word(p);
+                if (p->error) return;
+                if (p->word == NULL) continue;      // nothing but a joined line
+                p->end = p->pos;
+                return;
+        }
+        p->pos += op_len;
+        p->end = p->pos;
+        return;
+    }
+}
+
+
+// ===== Parser =====
+
+/* Return: 1 if the current token is the unquoted one-letter word c ({ or })
+ */
+static int is_reserved(const Parser *p, char c) {
+    return p->kind == TOK_WORD && p->end - p->start == 1 && p->text[p->start] == c;
+}
+
+
+static int is_redirect(TokenKind kind) {
+    return kind == TOK_IO_NUMBER || (kind >= TOK_LESS && kind <= TOK_GREATAND);
+}
+
+
+static void skip_newlines(Parser *p) {
+    while (p->kind == TOK_NEWLINE) next_token(p);
+}
+
+
+static AndOr *parse_list(Parser *p, int in_braces);
+
+
+/* [n]op word, at the current token
+ */
+static Redirect *parse_redirect(Parser *p) {
+    Redirect *redirect = node(p, sizeof(Redirect));
+    if (redirect == NULL) return NULL;
+    redirect->fd = -1;
+    if (p->kind == TOK_IO_NUMBER) {
+        redirect->fd = p->io_number;
+        next_token(p);
+    }
+    int default_fd = 1;
+    switch (p->kind) {
+        case TOK_LESS: redirect->kind = REDIR_IN; default_fd = 0; break;
+        case TOK_GREAT: redirect->kind = REDIR_OUT; break;
+        case TOK_DGREAT: redirect->kind = REDIR_APPEND; break;
+        case TOK_LESSAND: redirect->kind = REDIR_DUP; default_fd = 0; break;
+        case TOK_GREATAND: redirect->kind = REDIR_DUP; break;
+        default: unexpected(p); return NULL;
+    }
+    if (redirect->fd < 0) {
+        redirect->fd = default_fd;
+    }
+    next_token(p);
+    if (p->kind != TOK_WORD) {
+        parse_fail(p, PARSE_SYNTAX, p->start);     // sh does not wait for the file name
+        return NULL;
+    }
+    redirect->target = p->word;
+    next_token(p);
+    return redirect;
+}
+
+
+/* NAME() { list }, with the current token just past NAME
+ */
+static SimpleCommand *parse_function(Parser *p, SimpleCommand *cmd, Word *name, size_t name_at) {
+    FunctionDef *def = node(p, sizeof(FunctionDef));
+    if (def == NULL) return NULL;
+    WordPart *part = name->parts;
+    if (part->next != NULL || part->kind != PART_TEXT || part->text != p->text + name_at) {
+        parse_fail(p, PARSE_SYNTAX, name_at);      // quoted or expanded names
+        return NULL;
+    }
+    def->name = part->text;
+    def->name_len = part->len;
+
+    next_token(p);
+    if (p->kind != TOK_RPAREN) {
+        unexpected(p);
+        return NULL;
+    }
+    next_token(p);
+    skip_newlines(p);
+    if (!is_reserved(p, '{')) {
+        unexpected(p);
+        return NULL;
+    }
+    size_t body_start = p->end;
+    next_token(p);
+    def->list = parse_list(p, 1);
+    if (p->error) return NULL;
+    if (!is_reserved(p, '}')) {
+        unexpected(p);
+        return NULL;
+    }
+    def->body = p->text + body_start;
+    def->body_len = p->start - body_start;
+    next_token(p);
+
+    cmd->function = def;
+    return cmd;
+}
+
+
+/* Words and redirections, or a function definition
+ */
+static SimpleCommand *parse_command(Parser *p) {
+    if (p->kind != TOK_WORD && !is_redirect(p->kind)) {
+        unexpected(p);
+        return NULL;
+    }
+    SimpleCommand *cmd = node(p, sizeof(SimpleCommand));
+    if (cmd == NULL) return NULL;
+    Word **word_tail = &cmd->words;
+    Redirect **redirect_tail = &cmd->redirects;
+
+    if (p->kind == TOK_WORD) {
+        Word *first = p->word;
+        size_t first_at = p->start;
+        next_token(p);
+        if (p->kind == TOK_LPAREN) {
+            return parse_function(p, cmd, first, first_at);
+        }
+        *word_tail = first;
+        word_tail = &first->next;
+        cmd->word_count++;
+    }
+
+    while (!p->error) {
+        if (p->kind == TOK_WORD) {
+            *word_tail = p->word;
+            word_tail = &p->word->next;
+            cmd->word_count++;
+            next_token(p);
+        } else if (is_redirect(p->kind)) {
+            Redirect *redirect = parse_redirect(p);
+            if (redirect == NULL) return NULL;
+            *redirect_tail = redirect;
+            redirect_tail = &redirect->next;
+            cmd->redirect_count++;
+        } else {
+            break;
+        }
+    }
+    return p->error ? NULL : cmd;
+}
+
+
+/* Return: 1 if the current token is the unquoted word time
+ */
+static int is_time_keyword(const Parser *p) {
+    return p->kind == TOK_WORD && p->end - p->start == 4 && strncmp(p->text + p->start, "time", 4) == 0;
+}
+
+
+/* ['time'] command ('|' command)*
+ */
+static Pipeline *parse_pipeline(Parser *p) {
+    Pipeline *pipeline = node(p, sizeof(Pipeline));
+    if (pipeline == NULL) return NULL;
+    if (is_time_keyword(p)) {
+        // only a keyword when a command follows; otherwise time is the command
+        Parser saved = *p;
+        next_token(p);
+        if (p->kind == TOK_WORD || is_redirect(p->kind)) {
+            pipeline->timed = 1;
+        } else {
+            *p = saved;
+        }
+    }
+    SimpleCommand **tail = &pipeline->stages;
+    while (1) {
+        size_t stage_at = p->start;
+        SimpleCommand *cmd = parse_command(p);
+        if (cmd == NULL) return NULL;
+        if (cmd->function != NULL && (pipeline->stage_count > 0 || p->kind == TOK_PIPE)) {
+            parse_fail(p, PARSE_SYNTAX, stage_at);     // a definition is a pipeline of its own
+            return NULL;
+        }
+        *tail = cmd;
+        tail = &cmd->next;
+        pipeline->stage_count++;
+        if (p->kind != TOK_PIPE) break;
+        next_token(p);
+        skip_newlines(p);
+    }
+    return pipeline;
+}
+
+
+/* pipeline (('&&' | '||') pipeline)*
+ */
+static AndOr *parse_and_or(Parser *p) {
+    AndOr *item = node(p, sizeof(AndOr));
+    if (item == NULL) return NULL;
+    item->text = p->text + p->start;
+    Pipeline **tail = &item->pipelines;
+    Join join = JOIN_FIRST;
+    while (1) {
+        Pipeline *pipeline = parse_pipeline(p);
+        if (pipeline == NULL) return NULL;
+        pipeline->join = join;
+        *tail = pipeline;
+        tail = &pipeline->next;
+        if (p->kind == TOK_AND) {
+            join = JOIN_AND;
+        } else if (p->kind == TOK_OR) {
+            join = JOIN_OR;
+        } else {
+            break;
+        }
+        next_token(p);
+        skip_newlines(p);
+    }
+    item->len = p->text + p->prev_end - item->text;
+    return item;
+}
+
+
+/* and_or (('&' | ';' | newline) and_or)*, up to the end of the input or,
+ * in braces, a closing '}'
+ */
+static AndOr *parse_list(Parser *p, int in_braces) {
+    AndOr *head = NULL, **tail = &head;
+    skip_newlines(p);
+    while (p->kind != TOK_END && !(in_braces && is_reserved(p, '}'))) {
+        AndOr *item = parse_and_or(p);
+        if (item == NULL) return NULL;
+        if (p->kind == TOK_AMP) {
+            item->background = 1;
+            next_token(p);
+        } else if (p->kind == TOK_SEMI || p->kind == TOK_NEWLINE) {
+            next_token(p);
+        } else if (p->kind != TOK_END && !(in_braces && is_reserved(p, '}'))) {
+            unexpected(p);
+            return NULL;
+        }
+        *tail = item;
+        tail = &item->next;
+        skip_newlines(p);
+    }
+    return head;
+}
+
+
+int ast_parse(Arena *arena, const char *text, size_t len, AndOr **out, size_t *error_at) {
+    Parser p = {.arena = arena, .text = text, .len = len};
+    next_token(&p);
+    *out = parse_list(&p, 0);
+    if (p.error != 0) {
+        *out = NULL;
+        if (error_at != NULL) {
+            *error_at = p.error_at;
+        }
+    }
+    return p.error;
+}
+
+
+int ast_parse_command(Arena *arena, const char *text, size_t len, SimpleCommand **out) {
+    AndOr *list;
+    int err = ast_parse(arena, text, len, &list, NULL);
+    if (err != 0) {
+        return err;
+    }
+    if (list == NULL) {
+        *out = arena_alloc(arena, sizeof(SimpleCommand));
+        return *out == NULL ? PARSE_NO_MEMORY : 0;
+    }
+    Pipeline *pipeline = list->pipelines;
+    if (list->next != NULL || list->background || pipeline->next != NULL || pipeline->stage_count != 1 ||
+        pipeline->stages->function != NULL || pipeline->stages->redirect_count != 0) {
+        return PARSE_SYNTAX;
+    }
+    *out = pipeline->stages;
+    return 0;
+}
+
+
+// ===== Expansion =====
+
+/* Return: the value of a $name part; numeric names and # come from args
+ */
+static const char *part_value(const WordPart *part, VarTable *vars, char **args, size_t arg_count, char *num_buf, size_t num_size) {
+    if (part->len == 1 && part->text[0] == '#') {
+        snprintf(num_buf, num_size, "%zu", arg_count > 0 ? arg_count - 1 : 0);
+        return num_buf;
+    }
+    size_t n = 0, i = 0;
+    for (; i < part->len && part->text[i] >= '0' && part->text[i] <= '9'; i++) {
+        n = n * 10 + (part->text[i] - '0');
+        if (n > arg_count) n = arg_count;   // out of range either way
+    }
+    if (i > 0 && i == part->len) {
+        return n < arg_count ? args[n] : "";
+    }
+    return find_var(part->text, part->len, vars);
+}
+
+
+/* Return: 1 if part is a $@ inside a longer word
+ */
+static int is_joined_args(const WordPart *part) {
+    return part->kind == PART_VAR && part->len == 1 && part->text[0] == '@';
+}
+
+
+/* Writes the arguments joined by spaces at dst (only measures when dst is
+ * NULL). Inside a longer word $@ can't split it, so it joins like $*.
+ * Return: bytes written, without a NUL
+ */
+static size_t args_fill(char *dst, char **args, size_t arg_count) {
+    size_t bytes = 0;
+    for (size_t a = 1; a < arg_count; a++) {
+        size_t len = strlen(args[a]);
+        if (dst != NULL) {
+            if (a > 1) dst[bytes] = ' ';
+            memcpy(dst + bytes + (a > 1), args[a], len);
+        }
+        bytes += len + (a > 1);
+    }
+    return bytes;
+}
+
+
+/* Return: bytes word expands to, without its NUL (not for PART_ARGS words)
+ */
+static size_t word_size(const Word *word, VarTable *vars, char **args, size_t arg_count, char *num_buf, size_t num_size) {
+    size_t bytes = 0;
+    for (const WordPart *part = word->parts; part != NULL; part = part->next) {
+        if (part->kind == PART_TEXT) {
+            bytes += part->len;
+        } else if (is_joined_args(part)) {
+            bytes += args_fill(NULL, args, arg_count);
+        } else {
+            bytes += strlen(part_value(part, vars, args, arg_count, num_buf, num_size));
+        }
+    }
+    return bytes;
+}
+
+
+/* Writes word, NUL terminated, at dst
+ * Return: the byte after it
+ */
+static char *word_fill(char *dst, const Word *word, VarTable *vars, char **args, size_t arg_count, char *num_buf, size_t num_size) {
+    for (const WordPart *part = word->parts; part != NULL; part = part->next) {
+        if (is_joined_args(part)) {
+            dst += args_fill(dst, args, arg_count);
+            continue;
+        }
+        const char *value = part->text;
+        size_t len = part->len;
+        if (part->kind != PART_TEXT) {
+            value = part_value(part, vars, args, arg_count, num_buf, num_size);
+            len = strlen(value);
+        }
+        memcpy(dst, value, len);
+        dst += len;
+    }
+    *dst++ = '\0';
+    return dst;
+}
+
+
+int ast_expand(const SimpleCommand *cmd, VarTable *vars, char **args, size_t arg_count, char **extra, Command *out) {
+    char num_buf[24];
+    if (args == NULL) arg_count = 0;
+
+    // size everything first so each command takes two allocations
+    size_t count = 0, bytes = 0;
+    for (const Word *word = cmd->words; word != NULL; word = word->next) {
+        if (word->parts->kind == PART_ARGS) {
+            for (size_t a = 1; a < arg_count; a++) {
+                bytes += strlen(args[a]) + 1;
+            }
+            count += arg_count > 0 ? arg_count - 1 : 0;
+            continue;
+        }
+        bytes += word_size(word, vars, args, arg_count, num_buf, sizeof(num_buf)) + 1;
+        count++;
+    }
+    for (size_t e = 0; extra != NULL && extra[e] != NULL; e++) {
+        count++;
+    }
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next) {
+        bytes += word_size(r->target, vars, args, arg_count, num_buf, sizeof(num_buf)) + 1;
+    }
+
+    // targets follow the tokens' NULL
+    out->tokens = malloc((count + 1 + cmd->redirect_count) * sizeof(char *));
+    out->arena = malloc(bytes > 0 ? bytes : 1);
+    if (out->tokens == NULL || out->arena == NULL) {
+        command_free(out);
+        return -1;
+    }
+
+    char *dst = out->arena;
+    size_t t = 0;
+    for (const Word *word = cmd->words; word != NULL; word = word->next) {
+        if (word->parts->kind == PART_ARGS) {
+            for (size_t a = 1; a < arg_count; a++) {
+                size_t len = strlen(args[a]) + 1;
+                memcpy(dst, args[a], len);
+                out->tokens[t++] = dst;
+                dst += len;
+            }
+            continue;
+        }
+        out->tokens[t++] = dst;
+        dst = word_fill(dst, word, vars, args, arg_count, num_buf, sizeof(num_buf));
+    }
+    for (size_t e = 0; extra != NULL && extra[e] != NULL; e++) {
+        out->tokens[t++] = extra[e];
+    }
+    out->tokens[t] = NULL;
+    out->token_count = t;
+
+    out->redirects = cmd->redirects;
+    out->redirect_count = cmd->redirect_count;
+    out->targets = out->tokens + t + 1;
+    size_t r_index = 0;
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next) {
+        out->targets[r_index++] = dst;
+        dst = word_fill(dst, r->target, vars, args, arg_count, num_buf, sizeof(num_buf));
+    }
+    return 0;
+}
+
+
+void command_free(Command *cmd) {
+    free(cmd->tokens);
+    free(cmd->arena);
+    memset(cmd, 0, sizeof(Command));
+}
@@ -0,0 +1,171 @@
+#ifndef __AST_H__
+#define __AST_H__
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "variables.h"
+
+
+#define ARENA_BLOCK (16 * 1024)
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    max_align_t data[];
+} ArenaBlock;
+
+/* Bump allocator: nodes are never freed one by one, only the whole arena at
+ * once. Zero-initialised is empty.
+ */
+typedef struct {
+    ArenaBlock *head;
+} Arena;
+
+
+/* Return: size zeroed bytes, aligned for any type, or NULL if memory ran out
+ */
+void *arena_alloc(Arena *arena, size_t size);
+void arena_free(Arena *arena);
+
+
+/* Empties arena for reuse, keeping its newest block
+ */
+void arena_reset(Arena *arena);
+
+
+typedef enum {
+    PART_TEXT,          // literal bytes
+    PART_VAR,           // $name: a shell variable, or $1.. $# $@ of the running function
+    PART_ARGS           // a word that is exactly $@: one word per argument
+} PartKind;
+
+/* A piece of a word. text points into the parsed source, which must
+ * outlive the tree. Quotes and backslashes are already gone.
+ */
+typedef struct word_part {
+    PartKind kind;
+    const char *text;
+    size_t len;
+    struct word_part *next;
+} WordPart;
+
+typedef struct word {
+    WordPart *parts;            // never NULL; "" is one empty PART_TEXT
+    struct word *next;
+} Word;
+
+typedef enum {
+    REDIR_IN,           // [n]<file
+    REDIR_OUT,          // [n]>file
+    REDIR_APPEND,       // [n]>>file
+    REDIR_DUP           // [n]>&m, [n]<&m: n becomes a copy of m
+} RedirectKind;
+
+typedef struct redirect {
+    RedirectKind kind;
+    int fd;
+    Word *target;
+    struct redirect *next;
+} Redirect;
+
+typedef struct and_or AndOr;
+
+/* NAME() { list }
+ */
+typedef struct {
+    const char *name;
+    size_t name_len;
+    const char *body;           // source between the braces
+    size_t body_len;
+    AndOr *list;
+} FunctionDef;
+
+/* One stage of a pipeline: words and redirections in source order, or a
+ * function definition (function set, no words)
+ */
+typedef struct simple_command {
+    Word *words;
+    size_t word_count;
+    Redirect *redirects;
+    size_t redirect_count;
+    FunctionDef *function;
+    struct simple_command *next;
+} SimpleCommand;
+
+typedef enum {
+    JOIN_FIRST,         // first of its list
+    JOIN_AND,           // && : runs if the previous pipeline succeeded
+    JOIN_OR             // || : runs if it failed
+} Join;
+
+/* Stages joined by '|', optionally led by the time keyword
+ */
+typedef struct pipeline {
+    SimpleCommand *stages;
+    size_t stage_count;
+    int timed;          // report its real, user and sys time when it ends
+    Join join;
+    struct pipeline *next;
+} Pipeline;
+
+/* Pipelines joined by && and ||, ended by ';', '&' or a newline. A
+ * background list runs as one job.
+ */
+struct and_or {
+    Pipeline *pipelines;
+    int background;
+    const char *text;           // source, for job listings
+    size_t len;
+    struct and_or *next;
+};
+
+
+#define PARSE_NO_MEMORY -1
+#define PARSE_SYNTAX -2
+#define PARSE_INCOMPLETE -3     // input ended inside a quote, {...} or after an operator
+
+/* Parses text (len bytes) into a tree in arena, in one pass and without
+ * copying it: words point into text, so it must outlive the tree. Quoting
+ * is sh's ('...', "...", backslash); $name, ${name} and $1.. are resolved
+ * only when a command is expanded, so a tree can be run any number of times.
+ * Return: 0 and the first list in *out (NULL if text holds no command), or a
+ * PARSE_* error with the offset of the offending token in *error_at
+ */
+int ast_parse(Arena *arena, const char *text, size_t len, AndOr **out, size_t *error_at);
+
+
+/* Parses a single command with no operators or redirections
+ * Return: as ast_parse; PARSE_SYNTAX also if text is anything else
+ */
+int ast_parse_command(Arena *arena, const char *text, size_t len, SimpleCommand **out);
+
+
+/* A command's words after expansion, ready to run. tokens is NULL
+ * terminated; arena backs any token that is not borrowed from elsewhere.
+ * targets[i] is the expanded target of the i-th redirection.
+ */
+typedef struct {
+    char **tokens;
+    size_t token_count;
+    const Redirect *redirects;
+    char **targets;
+    size_t redirect_count;
+    char *arena;
+} Command;
+
+
+/* Expands cmd into out: $name from vars; $1.., $# and $@ from args
+ * (arg_count of them, none when args is NULL). An unset name expands to
+ * nothing, yet a word made only of unset names still yields an empty word.
+ * The NULL terminated extra tokens (may be NULL) are appended after cmd's
+ * words; they are borrowed, not copied.
+ * Return: 0 on success, -1 if memory ran out
+ */
+int ast_expand(const SimpleCommand *cmd, VarTable *vars, char **args, size_t arg_count, char **extra, Command *out);
+
+void command_free(Command *cmd);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+
+/* Every benchmark prints rows of
+ *   benchmark,param,ops,ns_per_op,mb_per_s,extra
+ * param and extra are ';' separated key=value lists (either may be empty);
+ * mb_per_s is empty where bytes mean nothing.
+ */
+#define BENCH_CSV_HEADER "benchmark,param,ops,ns_per_op,mb_per_s,extra\n"
+
+
+static inline uint64_t bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* Return: n scaled by $BENCH_SCALE (default 1), at least 1
+ */
+static inline uint64_t bench_scaled(uint64_t n) {
+    const char *scale = getenv("BENCH_SCALE");
+    double s = scale != NULL ? atof(scale) : 1.0;
+    uint64_t scaled = s > 0 ? (uint64_t)(n * s) : n;
+    return scaled > 0 ? scaled : 1;
+}
+
+
+/* Prints one result: ops operations over ns nanoseconds, moving bytes
+ * (0 if not a throughput benchmark)
+ */
+static inline void bench_row(const char *name, const char *param, uint64_t ops, uint64_t ns, uint64_t bytes, const char *extra) {
+    if (ops == 0) ops = 1;
+    if (ns == 0) ns = 1;
+    printf("%s,%s,%llu,%.2f,", name, param ? param : "", (unsigned long long)ops, (double)ns / ops);
+    if (bytes > 0) {
+        printf("%.1f", (double)bytes / 1e6 / ((double)ns / 1e9));
+    }
+    printf(",%s\n", extra ? extra : "");
+    fflush(stdout);
+}
+
+#endif
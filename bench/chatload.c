@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "bench/bench.h"
+#include "protocol.h"
+
+
+/* Chat fan-out load generator. One sender and CLIENTS receivers connect to a
+ * running server; the sender sends MSGS numbered messages in windows of
+ * CHAT_WINDOW, and each window must reach every receiver before the next is
+ * sent. Receivers check the numbers: a gap is loss, a number out of order or
+ * a payload that does not parse is a torn message.
+ *
+ *   chatload PORT HOST CLIENTS MSGS [KEY=VALUE]...
+ *
+ * Prints one CSV row (see bench.h); each KEY=VALUE is added to its param field.
+ */
+
+#define CHAT_WINDOW 64
+#define CHAT_CONNECT_MS 5000    // the server may still be starting
+#define CHAT_STALL_MS 2000      // no delivery for this long ends the run
+
+typedef struct {
+    int fd;
+    FrameReader in;
+    long next;              // number expected next
+    uint64_t received;
+    uint64_t lost;
+    uint64_t torn;
+} Receiver;
+
+
+static int chat_connect(const char *host, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(host);
+
+    uint64_t deadline = bench_now() + CHAT_CONNECT_MS * 1000000ull;
+    while (1) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        if (errno != ECONNREFUSED || bench_now() > deadline) {
+            return -1;
+        }
+        usleep(10000);
+    }
+}
+
+
+/* Reads frames until one arrives; used for the welcome line
+ * Return: 0 and the payload in buf, -1 on error
+ */
+static int chat_read_frame(int fd, FrameReader *in, char *buf, size_t size) {
+    Frame frame;
+    int ret;
+    while ((ret = frame_next(in, &frame)) == 0) {
+        if (frame_read(in, fd) <= 0) {
+            return -1;
+        }
+    }
+    if (ret < 0) {
+        return -1;
+    }
+    size_t len = frame.len < size - 1 ? frame.len : size - 1;
+    memcpy(buf, frame.payload, len);
+    buf[len] = '\0';
+    return 0;
+}
+
+
+/* Checks one delivered message against the sequence receiver expects.
+ * Messages from other clients (e.g. disconnect notices) are ignored.
+ */
+static void chat_check(Receiver *r, const Frame *frame, const char *prefix, size_t prefix_len) {
+    if (frame->type != FRAME_MSG || frame->len < prefix_len || memcmp(frame->payload, prefix, prefix_len) != 0) {
+        return;
+    }
+    char body[64];
+    size_t len = frame->len - prefix_len;
+    long seq = -1;
+    if (len < sizeof(body)) {
+        memcpy(body, frame->payload + prefix_len, len);
+        body[len] = '\0';
+        char *end;
+        if (strncmp(body, "bench ", 6) == 0) {
+            seq = strtol(body + 6, &end, 10);
+            if (*end != '\n') seq = -1;
+        }
+    }
+
+    r->received++;
+    if (seq < r->next) {
+        r->torn++;
+        return;
+    }
+    r->lost += seq - r->next;
+    r->next = seq + 1;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: chatload PORT HOST CLIENTS MSGS [KEY=VALUE]...\n");
+        return 2;
+    }
+    int port = atoi(argv[1]);
+    const char *host = argv[2];
+    size_t clients = atol(argv[3]);
+    long msgs = atol(argv[4]);
+
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur < clients + 64) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+    // the sender learns its own name from its welcome line
+    int sender = chat_connect(host, port);
+    FrameReader sender_in = {0};
+    char welcome[128];
+    if (sender < 0 || chat_read_frame(sender, &sender_in, welcome, sizeof(welcome)) < 0) {
+        fprintf(stderr, "chatload: cannot connect to %s:%d\n", host, port);
+        return 1;
+    }
+    char prefix[64];
+    size_t prefix_len = strcspn(welcome, ":") + 2;
+    snprintf(prefix, sizeof(prefix), "%.*s", (int)prefix_len, welcome);
+
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    Receiver *receivers = calloc(clients, sizeof(Receiver));
+    for (size_t i = 0; i < clients; i++) {
+        Receiver *r = &receivers[i];
+        r->fd = chat_connect(host, port);
+        if (r->fd < 0 || chat_read_frame(r->fd, &r->in, welcome, sizeof(welcome)) < 0) {
+            fprintf(stderr, "chatload: receiver %zu could not connect\n", i);
+            return 1;
+        }
+        fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL) | O_NONBLOCK);
+        struct epoll_event ev = {.events = EPOLLIN, .data.ptr = r};
+        epoll_ctl(ep, EPOLL_CTL_ADD, r->fd, &ev);
+    }
+
+    FrameWriter out = {0};
+    struct epoll_event events[256];
+    uint64_t delivered = 0, bytes = 0;
+    int stalled = 0;
+    long sent = 0;
+    uint64_t start = bench_now();
+
+    while (sent < msgs && !stalled) {
+        long window = msgs - sent < CHAT_WINDOW ? msgs - sent : CHAT_WINDOW;
+        for (long i = 0; i < window; i++) {
+            char body[32];
+            int len = snprintf(body, sizeof(body), "bench %ld\n", sent + i);
+            frame_append(&out, FRAME_MSG, body, len);
+        }
+        if (frame_flush(&out, sender) < 0) {
+            fprintf(stderr, "chatload: send failed\n");
+            break;
+        }
+        sent += window;
+
+        // wait until every receiver is caught up with this window
+        uint64_t target = delivered + window * clients;
+        uint64_t last_progress = bench_now();
+        while (delivered < target) {
+            int n = epoll_wait(ep, events, 256, 100);
+            if (n < 0 && errno != EINTR) break;
+            for (int e = 0; e < n; e++) {
+                Receiver *r = events[e].data.ptr;
+                ssize_t got;
+                while ((got = frame_read(&r->in, r->fd)) > 0) {
+                    bytes += got;
+                }
+                Frame frame;
+                uint64_t before = r->received;
+                while (frame_next(&r->in, &frame) == 1) {
+                    chat_check(r, &frame, prefix, prefix_len);
+                }
+                delivered += r->received - before;
+                if (got == 0) {
+                    epoll_ctl(ep, EPOLL_CTL_DEL, r->fd, NULL);   // dropped by the server
+                }
+            }
+            if (n > 0) {
+                last_progress = bench_now();
+            } else if (bench_now() - last_progress > CHAT_STALL_MS * 1000000ull) {
+                stalled = 1;
+                break;
+            }
+        }
+    }
+    uint64_t ns = bench_now() - start;
+
+    uint64_t lost = 0, torn = 0;
+    for (size_t i = 0; i < clients; i++) {
+        Receiver *r = &receivers[i];
+        lost += r->lost + (sent - r->next);     // trailing messages that never came
+        torn += r->torn;
+        frame_reader_free(&r->in);
+        close(r->fd);
+    }
+    frame_reader_free(&sender_in);
+    frame_writer_free(&out);
+    close(sender);
+    close(ep);
+    free(receivers);
+
+    char param[256], extra[96];
+    size_t pos = snprintf(param, sizeof(param), "clients=%zu;msgs=%ld", clients, msgs);
+    for (int i = 5; i < argc && pos < sizeof(param); i++) {
+        pos += snprintf(param + pos, sizeof(param) - pos, ";%s", argv[i]);
+    }
+    snprintf(extra, sizeof(extra), "lost=%llu;torn=%llu;stalled=%d", (unsigned long long)lost, (unsigned long long)torn, stalled);
+    bench_row("chat_fanout", param, delivered, ns, bytes, extra);
+    return lost > 0 || torn > 0;
+}
@@ -0,0 +1,746 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "bench/bench.h"
+#include "builtins.h"
+#include "variables.h"
+#include "io_helpers.h"
+#include "pathcache.h"
+#include "wordcount.h"
+#include "match.h"
+#include "ast.h"
+
+
+/* Micro-benchmarks: the shell's hot paths called in-process, one CSV row each
+ * (see bench.h). Iteration counts scale with $BENCH_SCALE; corpora are
+ * written to $TMPDIR (default /tmp) and removed afterwards.
+ */
+
+static volatile uintptr_t sink;     // keeps results observable so loops are not elided
+static int saved_stdout = -1;
+
+
+// ===== Helpers =====
+
+/* Points fd 1 at path so builtins under test print nowhere
+ */
+static void stdout_to(const char *path) {
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    dup2(fd, STDOUT_FILENO);
+    close(fd);
+}
+
+
+static void stdout_restore() {
+    display_flush();
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+}
+
+
+static char *tmp_path(const char *name) {
+    const char *dir = getenv("TMPDIR");
+    char *path;
+    if (asprintf(&path, "%s/mysh-bench-%d-%s", dir ? dir : "/tmp", getpid(), name) == -1) {
+        perror("asprintf");
+        exit(1);
+    }
+    return path;
+}
+
+
+/* Writes size bytes of kind ("text", "binary", "spaces", "oneword") to path
+ */
+static void make_corpus(const char *path, const char *kind, size_t size) {
+    static const char *words[] = {"the", "shell", "reads", "a", "line", "and", "forks", "children", "wc", "counts", "every", "byte"};
+    size_t chunk = 1 << 20;
+    char *buf = malloc(chunk);
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    size_t pos = 0, col = 0;
+    for (size_t i = 0; i < chunk; ) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        if (strcmp(kind, "binary") == 0) {
+            buf[i++] = rng;
+        } else if (strcmp(kind, "spaces") == 0) {
+            buf[i++] = " \t\n"[rng % 3];
+        } else if (strcmp(kind, "oneword") == 0) {
+            buf[i++] = 'a' + rng % 26;
+        } else {
+            const char *w = words[rng % (sizeof(words) / sizeof(*words))];
+            for (; *w != '\0' && i < chunk; w++, col++) buf[i++] = *w;
+            if (i < chunk) buf[i++] = col > 70 ? '\n' : ' ';
+            if (col > 70) col = 0;
+        }
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    while (pos < size) {
+        size_t n = size - pos < chunk ? size - pos : chunk;
+        if (write(fd, buf, n) != (ssize_t)n) {
+            perror("write corpus");
+            exit(1);
+        }
+        pos += n;
+    }
+    close(fd);
+    free(buf);
+}
+
+
+// ===== Baseline =====
+
+/* The tokenizer and variable list of the baseline shell, frozen here as the
+ * reference point for the tokenizer and parser rows. Unchanged except for
+ * names and static linkage, a ret_buf the original strcat'ed into without
+ * initializing, and a token it leaked when a line was cut at exactly
+ * MAX_STR_LEN.
+ */
+
+typedef struct baseline_var {
+    char *name;
+    char *data;
+    struct baseline_var *next;
+} BaselineVar;
+
+
+static BaselineVar *baseline_add_var(BaselineVar *vars, const char *name, const char *data) {
+    BaselineVar *var = malloc(sizeof(BaselineVar));
+    var->name = strdup(name);
+    var->data = strdup(data);
+    var->next = vars;
+    return var;
+}
+
+
+static void baseline_free_vars(BaselineVar *front) {
+    BaselineVar *next;
+    while (front != NULL) {
+        next = front->next;
+        free(front->name);
+        free(front->data);
+        free(front);
+        front = next;
+    }
+}
+
+
+static char *baseline_find_var(char *var_name, BaselineVar *vars) {
+    BaselineVar *curr = vars;
+    while (curr != NULL) {
+        if (strcmp(curr->name, var_name) == 0) {
+            return curr->data;
+        }
+        curr = curr->next;
+    }
+    return "";
+}
+
+
+static char *baseline_expand_vars(char *input_buf, BaselineVar *vars) {
+    if (!input_buf) {
+        return NULL;
+    }
+
+    char ret_buf[MAX_STR_LEN+1];
+    ret_buf[0] = '\0';
+    ret_buf[128] = '\0';
+    size_t remaining = MAX_STR_LEN;
+
+    char *curr = input_buf;
+    while (*curr && remaining > 0) {
+        if (*curr == '$') {
+            char *end = curr + 1;
+
+            // check for treating $ as a character
+            if ((*end == ' ') || (*end == '\n') || (*end == '\0')) {
+                strcat(ret_buf, "$");
+                curr++;
+                continue;
+            }
+
+            // find end of var name to expand
+            while ((*end != '\n') && (*end != ' ') && (*end != '$') && (*end != '\0')) {
+                end++;
+            }
+
+            int var_len = end - curr - 1;
+            char var_name[var_len + 1];
+            strncpy(var_name, curr + 1, var_len);
+            var_name[var_len] = '\0';
+
+            char *expanded = baseline_find_var(var_name, vars);
+
+            // check for max length expansion
+            if (remaining < strlen(expanded)) {
+                strncat(ret_buf, expanded, remaining);
+                break;
+            } else {
+                strcat(ret_buf, expanded);
+                remaining -= strlen(expanded);
+            }
+
+            curr = end;
+
+        } else {
+            strncat(ret_buf, curr, 1);
+            curr++;
+            remaining--;
+        }
+    }
+    char *ptr = strdup(ret_buf);
+    return ptr;
+}
+
+
+/* Splits in_ptr in place with strtok. Every token is a fresh strdup the
+ * caller frees.
+ */
+static size_t baseline_tokenize_input(char *in_ptr, char **tokens, BaselineVar *vars) {
+    char *curr_ptr = strtok(in_ptr, DELIMITERS);
+    size_t token_count = 0;
+    size_t total_len = 0;
+
+    while (curr_ptr != NULL) {
+        char *copy = strdup(curr_ptr);
+        char *expanded = baseline_expand_vars(curr_ptr, vars);
+        size_t exp_len = strlen(expanded);
+
+        // truncate last token before MAX_STR_LEN is hit
+        if (total_len + exp_len > MAX_STR_LEN) {
+            size_t rem = MAX_STR_LEN - total_len;
+            if (rem > 0) {
+                expanded[rem] = '\0';
+                tokens[token_count] = expanded;
+                total_len += rem;
+                token_count++;
+            } else {
+                free(expanded);
+            }
+            free(copy);
+            break;
+        }
+
+        tokens[token_count] = expanded;
+        total_len += exp_len;
+        token_count++;
+        curr_ptr = strtok(NULL, DELIMITERS);
+        free(copy);
+    }
+    tokens[token_count] = NULL;
+    return token_count;
+}
+
+
+static void baseline_free_tokens(char **tokens, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(tokens[i]);
+    }
+}
+
+
+// ===== Tokenizer =====
+
+static void bench_tokenize() {
+    VarTable vars = {0};
+    set_var(&vars, "a", 1, "alpha", 5);
+    set_var(&vars, "bb", 2, "a much longer value for bb", 26);
+    set_var(&vars, "ccc", 3, "", 0);
+    BaselineVar *list = NULL;
+    list = baseline_add_var(list, "a", "alpha");
+    list = baseline_add_var(list, "bb", "a much longer value for bb");
+    list = baseline_add_var(list, "ccc", "");
+
+    char longline[4096];
+    size_t pos = 0;
+    while (pos + 8 < sizeof(longline)) {
+        pos += snprintf(longline + pos, sizeof(longline) - pos, "w%04zu ", pos);
+    }
+    const char *lines[][2] = {
+        {"plain", "ls --rec --d 3 /usr/share/doc --f txt"},
+        {"vars", "echo $a $bb $ccc x$a$bb $missing tail"},
+        {"long", longline},
+    };
+
+    for (size_t l = 0; l < sizeof(lines) / sizeof(*lines); l++) {
+        char *line = strdup(lines[l][1]);
+        size_t len = strlen(line);
+        char **tokens = malloc((len + 1) * sizeof(char *));
+        char *scratch = malloc(len + 1);     // strtok cuts the line up
+        uint64_t iters = bench_scaled(len > 1000 ? 20000 : 1000000);
+        size_t count = 0;
+
+        uint64_t start = bench_now();
+        for (uint64_t i = 0; i < iters; i++) {
+            memcpy(scratch, line, len + 1);
+            size_t n = baseline_tokenize_input(scratch, tokens, list);
+            baseline_free_tokens(tokens, n);
+            count += n;
+        }
+        uint64_t ns = bench_now() - start;
+        sink = count;
+
+        char param[64], extra[64];
+        snprintf(param, sizeof(param), "line=%s;bytes=%zu", lines[l][0], len);
+        snprintf(extra, sizeof(extra), "tokens=%zu", count / iters);
+        bench_row("tokenize_input", param, iters, ns, iters * len, extra);
+
+        // the same line parsed once, as a function body is, then expanded
+        Arena ast = {0};
+        AndOr *body;
+        ast_parse(&ast, line, len, &body, NULL);
+        count = 0;
+        start = bench_now();
+        for (uint64_t i = 0; i < iters; i++) {
+            Command cmd;
+            ast_expand(body->pipelines->stages, &vars, NULL, 0, NULL, &cmd);
+            count += cmd.token_count;
+            command_free(&cmd);
+        }
+        ns = bench_now() - start;
+        sink = count;
+        snprintf(extra, sizeof(extra), "tokens=%zu", count / iters);
+        bench_row("ast_expand", param, iters, ns, iters * len, extra);
+
+        arena_free(&ast);
+        free(tokens);
+        free(scratch);
+        free(line);
+    }
+    free_vars(&vars);
+    baseline_free_vars(list);
+}
+
+
+// ===== Parser =====
+
+/* Return: a generated script of at least size bytes (*len exactly), NUL
+ * terminated. "simple" has one plain command per line, as scripts had before
+ * the parser; "mixed" adds quoting, && and ||, pipelines, redirections,
+ * background lists and functions.
+ */
+static char *make_script(const char *kind, size_t size, size_t *len) {
+    static const char *simple[] = {
+        "echo line $x 42",
+        "x1=value",
+        "ls --rec --d 3 /usr/share/doc --f txt",
+        "cat notes.txt",
+    };
+    static const char *mixed[] = {
+        "echo \"quoted $x text\" 'single $y' plain\\ word",
+        "ls --rec --d 3 /usr/share/doc --f txt | wc > /tmp/out.txt 2>&1",
+        "test -f /etc/passwd && echo yes || echo no; x=${y}z",
+        "f() { echo $1 \"$@\"; cat < in.txt | wc >> out.txt; }",
+        "/bin/true & sleep 1 &",
+        "# a comment line",
+    };
+    const char **lines = strcmp(kind, "simple") == 0 ? simple : mixed;
+    size_t count = strcmp(kind, "simple") == 0 ? sizeof(simple) / sizeof(*simple) : sizeof(mixed) / sizeof(*mixed);
+
+    size_t cap = size + 256, pos = 0;
+    char *script = malloc(cap);
+    for (size_t i = 0; pos < size; i++) {
+        pos += snprintf(script + pos, cap - pos, "%s\n", lines[i % count]);
+    }
+    *len = pos;
+    return script;
+}
+
+
+static void bench_parse() {
+    const char *kinds[] = {"simple", "mixed"};
+    size_t sizes[] = {64 * 1024, 16 << 20};
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(*kinds); k++) {
+        for (size_t z = 0; z < sizeof(sizes) / sizeof(*sizes); z++) {
+            size_t len;
+            char *script = make_script(kinds[k], sizes[z], &len);
+            uint64_t iters = bench_scaled(sizes[z] > (1 << 20) ? 10 : 2000);
+            Arena arena = {0};
+            size_t lists = 0;
+
+            uint64_t start = bench_now();
+            for (uint64_t i = 0; i < iters; i++) {
+                arena_reset(&arena);
+                AndOr *list;
+                if (ast_parse(&arena, script, len, &list, NULL) != 0) {
+                    fprintf(stderr, "parse: %s script does not parse\n", kinds[k]);
+                    exit(1);
+                }
+                lists = 0;
+                for (; list != NULL; list = list->next) lists++;
+            }
+            uint64_t ns = bench_now() - start;
+            sink = lists;
+
+            char param[64], extra[64];
+            snprintf(param, sizeof(param), "script=%s;bytes=%zu", kinds[k], len);
+            snprintf(extra, sizeof(extra), "lists=%zu", lists);
+            bench_row("ast_parse", param, iters, ns, iters * len, extra);
+            arena_free(&arena);
+
+            // the old path on the same bytes: each line tokenized on its own
+            if (strcmp(kinds[k], "simple") == 0) {
+                char *tokens[MAX_STR_LEN + 1];
+                char line[MAX_STR_LEN + 1];     // the read buffer each line was copied into
+                for (size_t i = 0; i < len; i++) {
+                    if (script[i] == '\n') script[i] = '\0';
+                }
+                size_t count = 0;
+                start = bench_now();
+                for (uint64_t i = 0; i < iters; i++) {
+                    for (size_t pos = 0; pos < len; ) {
+                        size_t line_len = strlen(script + pos);
+                        memcpy(line, script + pos, line_len + 1);
+                        size_t n = baseline_tokenize_input(line, tokens, NULL);
+                        baseline_free_tokens(tokens, n);
+                        count += n;
+                        pos += line_len + 1;
+                    }
+                }
+                ns = bench_now() - start;
+                sink = count;
+                snprintf(extra, sizeof(extra), "tokens=%zu", count / iters);
+                bench_row("tokenize_lines", param, iters, ns, iters * len, extra);
+            }
+            free(script);
+        }
+    }
+}
+
+
+// ===== Variables =====
+
+static void bench_find_var() {
+    static const size_t sizes[] = {16, 1024, 1 << 20};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        size_t n = sizes[s];
+        VarTable vars = {0};
+        char name[32], value[32];
+        for (size_t i = 0; i < n; i++) {
+            int name_len = snprintf(name, sizeof(name), "var%zu", i);
+            int value_len = snprintf(value, sizeof(value), "value%zu", i);
+            set_var(&vars, name, name_len, value, value_len);
+        }
+
+        // names prepared up front so only the lookup is timed
+        size_t probes = 4096;
+        char (*names)[32] = malloc(probes * sizeof(*names));
+        size_t *lens = malloc(probes * sizeof(size_t));
+        for (size_t i = 0; i < probes; i++) {
+            lens[i] = snprintf(names[i], 32, "var%zu", (i * 2654435761u) % n);
+        }
+
+        for (int miss = 0; miss < 2; miss++) {
+            if (miss) {
+                for (size_t i = 0; i < probes; i++) names[i][0] = 'x';
+            }
+            uint64_t iters = bench_scaled(2000000);
+            uintptr_t acc = 0;
+            uint64_t start = bench_now();
+            for (uint64_t i = 0; i < iters; i++) {
+                size_t p = i & (probes - 1);
+                acc += (uintptr_t)find_var(names[p], lens[p], &vars);
+            }
+            uint64_t ns = bench_now() - start;
+            sink = acc;
+
+            char param[64];
+            snprintf(param, sizeof(param), "vars=%zu;lookup=%s", n, miss ? "miss" : "hit");
+            bench_row("find_var", param, iters, ns, 0, NULL);
+        }
+        free(names);
+        free(lens);
+        free_vars(&vars);
+    }
+}
+
+
+/* Reassigns a working set of names with values of changing length, the
+ * pattern of a loop counter or accumulator in a script
+ */
+static void bench_assign_var() {
+    static const size_t sizes[] = {16, 1024};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        size_t n = sizes[s];
+        VarTable vars = {0};
+        uint64_t iters = bench_scaled(1000000);
+        char **stmts = malloc(4096 * sizeof(char *));
+        for (size_t i = 0; i < 4096; i++) {
+            if (asprintf(&stmts[i], "v%zu=%.*s", i % n, (int)(1 + i % 40), "0123456789012345678901234567890123456789") == -1) {
+                exit(1);
+            }
+        }
+
+        uint64_t start = bench_now();
+        for (uint64_t i = 0; i < iters; i++) {
+            assign_var(&vars, stmts[i & 4095], 1);
+        }
+        uint64_t ns = bench_now() - start;
+
+        char param[64], extra[96];
+        snprintf(param, sizeof(param), "names=%zu", n);
+        snprintf(extra, sizeof(extra), "arena_bytes=%zu;arena_dead=%zu", vars.arena_cap, vars.arena_dead);
+        bench_row("assign_var", param, iters, ns, 0, extra);
+        for (size_t i = 0; i < 4096; i++) free(stmts[i]);
+        free(stmts);
+        free_vars(&vars);
+    }
+}
+
+
+// ===== Builtin dispatch =====
+
+static const char *builtin_names[] = {
+#define BUILTIN(name, fn, flags) name,
+#include "builtins.def"
+#undef BUILTIN
+};
+#define BUILTIN_NAME_COUNT (sizeof(builtin_names) / sizeof(*builtin_names))
+
+
+/* The strncmp scan dispatch used to be, as a baseline
+ */
+static const char *linear_builtin(const char *cmd) {
+    for (size_t i = 0; i < BUILTIN_NAME_COUNT; i++) {
+        if (strncmp(builtin_names[i], cmd, MAX_STR_LEN) == 0) {
+            return builtin_names[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void bench_check_builtin() {
+    static const char *misses[] = {"grep", "git", "make", "sed", "awk", "python3", "/usr/bin/env", "./configure"};
+    struct {
+        const char *name;
+        const char **names;
+        size_t count;
+    } cases[] = {
+        {"hit", builtin_names, BUILTIN_NAME_COUNT},
+        {"miss", misses, sizeof(misses) / sizeof(*misses)},
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(*cases); c++) {
+        for (int linear = 0; linear < 2; linear++) {
+            const char **volatile names = cases[c].names;
+            size_t count = cases[c].count;
+            uint64_t iters = bench_scaled(5000000);
+            uintptr_t acc = 0;
+            uint64_t start = bench_now();
+            for (uint64_t i = 0, n = 0; i < iters; i++) {
+                acc += linear ? (uintptr_t)linear_builtin(names[n]) : (uintptr_t)check_builtin(names[n]);
+                if (++n == count) n = 0;
+            }
+            uint64_t ns = bench_now() - start;
+            sink = acc;
+
+            char param[64];
+            snprintf(param, sizeof(param), "names=%s;impl=%s", cases[c].name, linear ? "linear" : "perfect_hash");
+            bench_row("check_builtin", param, iters, ns, 0, NULL);
+        }
+    }
+}
+
+
+// ===== wc and cat =====
+
+static void bench_wc_cat() {
+    static const char *kinds[] = {"text", "binary", "spaces", "oneword"};
+    const char *mb_env = getenv("BENCH_WC_MB");
+    size_t big = (size_t)(mb_env ? atol(mb_env) : 128) << 20;
+    size_t sizes[] = {4 << 20, big};    // streamed, then mapped and threaded
+    char *out_path = tmp_path("out");
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(*kinds); k++) {
+        for (size_t s = 0; s < 2; s++) {
+            char *path = tmp_path(kinds[k]);
+            make_corpus(path, kinds[k], sizes[s]);
+            int reps = sizes[s] < (64u << 20) ? 20 : 3;
+            char param[96];
+            snprintf(param, sizeof(param), "corpus=%s;mb=%zu", kinds[k], sizes[s] >> 20);
+
+            // the counting core alone
+            WcCounts counts = {0};
+            uint64_t start = bench_now();
+            for (int r = 0; r < reps; r++) {
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                wc_count_fd(fd, &counts);
+                close(fd);
+            }
+            uint64_t ns = bench_now() - start;
+            char extra[96];
+            snprintf(extra, sizeof(extra), "words=%llu;lines=%llu", (unsigned long long)counts.words, (unsigned long long)counts.newlines);
+            bench_row("wc_count_fd", param, reps, ns, (uint64_t)reps * sizes[s], extra);
+
+            // the builtins, as the shell runs them
+            char *wc_argv[] = {"wc", path, NULL};
+            stdout_to("/dev/null");
+            start = bench_now();
+            for (int r = 0; r < reps; r++) bn_wc(wc_argv);
+            ns = bench_now() - start;
+            stdout_restore();
+            bench_row("bn_wc", param, reps, ns, (uint64_t)reps * sizes[s], NULL);
+
+            if (strcmp(kinds[k], "text") == 0) {
+                const char *targets[][2] = {{"devnull", "/dev/null"}, {"file", out_path}};
+                for (int t = 0; t < 2; t++) {
+                    char *cat_argv[] = {"cat", path, NULL};
+                    stdout_to(targets[t][1]);
+                    start = bench_now();
+                    for (int r = 0; r < reps; r++) {
+                        lseek(STDOUT_FILENO, 0, SEEK_SET);
+                        bn_cat(cat_argv);
+                    }
+                    ns = bench_now() - start;
+                    stdout_restore();
+                    char cat_param[128];
+                    snprintf(cat_param, sizeof(cat_param), "%s;to=%s", param, targets[t][0]);
+                    bench_row("bn_cat", cat_param, reps, ns, (uint64_t)reps * sizes[s], NULL);
+                }
+                unlink(out_path);
+            }
+            unlink(path);
+            free(path);
+        }
+    }
+    free(out_path);
+}
+
+
+// ===== Other hot paths =====
+
+static void bench_matcher() {
+    size_t count = 1 << 16;
+    char (*names)[32] = malloc(count * sizeof(*names));
+    size_t *lens = malloc(count * sizeof(size_t));
+    for (size_t i = 0; i < count; i++) {
+        lens[i] = snprintf(names[i], 32, i % 3 ? "file_%06zu.txt" : "directory_%05zu", i * 7919 % 1000000);
+    }
+
+    const char *cases[][2] = {{"substr", "_0123"}, {"glob", "*[0-9]7.t?t"}, {"glob", "dir*"}};
+    for (size_t c = 0; c < sizeof(cases) / sizeof(*cases); c++) {
+        Matcher m;
+        if (strcmp(cases[c][0], "substr") == 0) {
+            matcher_init_substr(&m, cases[c][1]);
+        } else {
+            matcher_init_glob(&m, cases[c][1]);
+        }
+        uint64_t iters = bench_scaled(5000000);
+        size_t hits = 0;
+        uint64_t start = bench_now();
+        for (uint64_t i = 0; i < iters; i++) {
+            size_t n = i & (count - 1);
+            hits += matcher_match(&m, names[n], lens[n]);
+        }
+        uint64_t ns = bench_now() - start;
+        sink = hits;
+        matcher_free(&m);
+
+        char param[64], extra[32];
+        snprintf(param, sizeof(param), "kind=%s;pattern=%s", cases[c][0], cases[c][1]);
+        snprintf(extra, sizeof(extra), "hits=%zu", hits);
+        bench_row("matcher_match", param, iters, ns, 0, extra);
+    }
+    free(names);
+    free(lens);
+}
+
+
+static void bench_read_line() {
+    size_t lines = bench_scaled(1000000);
+    char *script = malloc(lines * 24 + 1);
+    size_t len = 0;
+    for (size_t i = 0; i < lines; i++) {
+        len += sprintf(script + len, "echo line %zu\n", i);
+    }
+
+    LineReader reader = {0};
+    line_reader_set_string(&reader, script);
+    char *line;
+    size_t count = 0;
+    uint64_t start = bench_now();
+    while (read_line(&reader, &line) > 0) {
+        count++;
+    }
+    uint64_t ns = bench_now() - start;
+    line_reader_free(&reader);
+    free(script);
+    bench_row("read_line", "source=string", count, ns, len, NULL);
+}
+
+
+static void bench_path_lookup() {
+    char *saved = strdup(getenv("PATH") ? getenv("PATH") : "/usr/bin:/bin");
+    char out[4096];
+
+    for (int long_path = 0; long_path < 2; long_path++) {
+        if (long_path) {
+            // 64 directories that do not exist ahead of the real ones
+            size_t size = strlen(saved) + 64 * 32;
+            char *path = malloc(size);
+            size_t pos = 0;
+            for (int i = 0; i < 64; i++) {
+                pos += snprintf(path + pos, size - pos, "/nonexistent/bench%02d:", i);
+            }
+            snprintf(path + pos, size - pos, "%s", saved);
+            setenv("PATH", path, 1);
+            free(path);
+        }
+        for (int cold = 0; cold < 2; cold++) {
+            uint64_t iters = bench_scaled(cold ? 20000 : 1000000);
+            int found = 0;
+            path_cache_clear();
+            uint64_t start = bench_now();
+            for (uint64_t i = 0; i < iters; i++) {
+                if (cold) path_cache_clear();
+                found += path_lookup("sh", out, sizeof(out)) == 0;
+            }
+            uint64_t ns = bench_now() - start;
+
+            char param[64], extra[32];
+            snprintf(param, sizeof(param), "path=%s;cache=%s", long_path ? "long" : "env", cold ? "cold" : "warm");
+            snprintf(extra, sizeof(extra), "found=%d", found);
+            bench_row("path_lookup", param, iters, ns, 0, extra);
+        }
+    }
+    setenv("PATH", saved, 1);
+    free(saved);
+    path_cache_free();
+}
+
+
+int main(int argc, char *argv[]) {
+    // optional filter: only benchmarks whose group name contains argv[1]
+    const char *only = argc > 1 ? argv[1] : "";
+    struct {
+        const char *name;
+        void (*run)();
+    } groups[] = {
+        {"tokenize", bench_tokenize},
+        {"parse", bench_parse},
+        {"find_var", bench_find_var},
+        {"assign_var", bench_assign_var},
+        {"check_builtin", bench_check_builtin},
+        {"matcher", bench_matcher},
+        {"read_line", bench_read_line},
+        {"path_lookup", bench_path_lookup},
+        {"wc_cat", bench_wc_cat},
+    };
+
+    if (getenv("BENCH_NO_HEADER") == NULL) {
+        printf(BENCH_CSV_HEADER);
+    }
+    for (size_t g = 0; g < sizeof(groups) / sizeof(*groups); g++) {
+        if (strstr(groups[g].name, only) != NULL) {
+            groups[g].run();
+        }
+    }
+    display_flush();
+    return 0;
+}
@@ -0,0 +1,186 @@
+#!/bin/sh
+# Runs every benchmark against the release build and writes one CSV (columns
+# in bench/bench.h) to stdout and to $BENCH_OUT (default bench/results.csv).
+#
+#   micro  hot paths called in-process (bench/micro)
+#   macro  whole commands through build/release/mysh: fork/exec, PATH
+#          lookups, pipelines, scripts, background jobs, cat/wc against
+#          coreutils, ls over a generated tree, send
+#   chat   server fan-out (bench/chatload) over clients, workers and engines
+#
+# BENCH_ONLY picks groups (default "micro macro chat"); sizes are overridden
+# with the BENCH_* variables below. Comparisons need the same machine and sizes.
+
+set -u
+cd "$(dirname "$0")/.."
+
+MYSH=${MYSH:-build/release/mysh}
+OUT=${BENCH_OUT:-bench/results.csv}
+ONLY=${BENCH_ONLY:-micro macro chat}
+N_SPAWN=${BENCH_SPAWN:-2000}            # commands per fork/exec and pipeline run
+N_LINES=${BENCH_LINES:-200000}          # lines per script run
+N_JOBS=${BENCH_JOBS:-2000}              # background jobs
+N_FILES=${BENCH_FILES:-100000}          # files in the ls tree
+FILE_MB=${BENCH_FILE_MB:-256}           # cat/wc input
+CLIENTS=${BENCH_CLIENTS:-1 10 100 1000}
+CHAT_MSGS=${BENCH_CHAT_MSGS:-2000}
+PORT=${BENCH_PORT:-21000}             # below the ephemeral range, so clients never hold it
+
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/mysh-bench.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+ulimit -n "$(ulimit -Hn)" 2>/dev/null
+
+now() {
+    date +%s%N
+}
+
+# row NAME PARAM OPS NS BYTES [EXTRA]
+row() {
+    awk -v n="$1" -v p="$2" -v ops="$3" -v ns="$4" -v b="$5" -v x="${6:-}" 'BEGIN {
+        if (ops < 1) ops = 1
+        if (ns < 1) ns = 1
+        mb = b > 0 ? sprintf("%.1f", b / 1e6 / (ns / 1e9)) : ""
+        printf "%s,%s,%d,%.2f,%s,%s\n", n, p, ops, ns / ops, mb, x
+    }'
+}
+
+# lines N TEXT: TEXT N times, with %d replaced by the line number
+lines() {
+    awk -v n="$1" -v t="$2" 'BEGIN {
+        for (i = 0; i < n; i++) {
+            s = t; out = ""
+            while ((k = index(s, "%d")) > 0) { out = out substr(s, 1, k - 1) i; s = substr(s, k + 2) }
+            print out s
+        }
+    }'
+}
+
+# timed NAME PARAM OPS BYTES CMD...: runs CMD once, output discarded
+timed() {
+    name=$1 param=$2 ops=$3 bytes=$4
+    shift 4
+    start=$(now)
+    "$@" > /dev/null 2>&1
+    end=$(now)
+    row "$name" "$param" "$ops" $((end - start)) "$bytes"
+}
+
+# script NAME PARAM OPS FILE: runs FILE through the shell
+script() {
+    timed "$1" "$2" "$3" 0 "$MYSH" "$4"
+}
+
+
+run_micro() {
+    BENCH_NO_HEADER=1 bench/micro
+}
+
+
+run_macro() {
+    # fork/exec, by absolute path and through the PATH cache
+    lines "$N_SPAWN" "/bin/true" > "$TMP/abs.sh"
+    lines "$N_SPAWN" "true" > "$TMP/path.sh"
+    long_path=$(awk 'BEGIN { for (i = 0; i < 64; i++) printf "/nonexistent/bench%02d:", i }')$PATH
+    script spawn "cmd=/bin/true" "$N_SPAWN" "$TMP/abs.sh"
+    script spawn "cmd=true;path=env" "$N_SPAWN" "$TMP/path.sh"
+    timed spawn "cmd=true;path=long" "$N_SPAWN" 0 env PATH="$long_path" "$MYSH" "$TMP/path.sh"
+
+    # pipelines: in-process builtins, mixed, all external
+    lines "$N_SPAWN" "echo x | wc" > "$TMP/pipe1.sh"
+    lines "$N_SPAWN" "echo x | /bin/cat | wc" > "$TMP/pipe2.sh"
+    lines "$N_SPAWN" "/bin/echo x | /bin/cat" > "$TMP/pipe3.sh"
+    script pipeline "cmd=echo|wc" "$N_SPAWN" "$TMP/pipe1.sh"
+    script pipeline "cmd=echo|/bin/cat|wc" "$N_SPAWN" "$TMP/pipe2.sh"
+    script pipeline "cmd=/bin/echo|/bin/cat" "$N_SPAWN" "$TMP/pipe3.sh"
+
+    # scripts that never fork
+    lines "$N_LINES" "x%d=%d" > "$TMP/assign.sh"
+    lines "$N_LINES" "echo line \$x %d" > "$TMP/echo.sh"
+    script script "line=assign" "$N_LINES" "$TMP/assign.sh"
+    script script "line=echo" "$N_LINES" "$TMP/echo.sh"
+
+    # the same body run through a function (compiled once) and inlined
+    { echo 'f() { x=$1; echo line $x $2; }'; lines "$N_LINES" "f %d y"; } > "$TMP/func.sh"
+    lines "$N_LINES" "x=%d;echo line \$x y" | tr ';' '\n' > "$TMP/inline.sh"
+    script function "call=function" "$N_LINES" "$TMP/func.sh"
+    script function "call=inline" "$N_LINES" "$TMP/inline.sh"
+
+    # the parser's whole grammar: quotes, && ||, redirections
+    lines "$N_LINES" "x=%d && y=\"\$x q\" || z='w'; echo \"\$y\" 'lit' > /dev/null" > "$TMP/mixed.sh"
+    script script "line=mixed" "$N_LINES" "$TMP/mixed.sh"
+
+    lines "$N_JOBS" "/bin/true &" > "$TMP/jobs.sh"
+    script background "cmd=/bin/true &" "$N_JOBS" "$TMP/jobs.sh"
+
+    # cat and wc against coreutils on the same file
+    bytes=$((FILE_MB * 1024 * 1024))
+    yes "the shell reads a line and forks children, wc counts every byte" | head -c "$bytes" > "$TMP/big.txt"
+    cat "$TMP/big.txt" > /dev/null
+    timed cat "impl=mysh;to=devnull" 1 "$bytes" "$MYSH" -c "cat $TMP/big.txt"
+    timed cat "impl=coreutils;to=devnull" 1 "$bytes" cat "$TMP/big.txt"
+    timed cat "impl=mysh;to=pipe" 1 "$bytes" sh -c "'$MYSH' -c 'cat $TMP/big.txt' | cat > /dev/null"
+    timed cat "impl=coreutils;to=pipe" 1 "$bytes" sh -c "cat '$TMP/big.txt' | cat > /dev/null"
+    timed wc "impl=mysh;input=file" 1 "$bytes" "$MYSH" -c "wc $TMP/big.txt"
+    timed wc "impl=coreutils;input=file" 1 "$bytes" wc "$TMP/big.txt"
+    timed wc "impl=mysh;input=pipe" 1 "$bytes" sh -c "cat '$TMP/big.txt' | '$MYSH' -c wc"
+    timed wc "impl=coreutils;input=pipe" 1 "$bytes" sh -c "cat '$TMP/big.txt' | wc"
+    rm -f "$TMP/big.txt"
+
+    # ls over a tree of N_FILES files, 100 per directory
+    mkdir -p "$TMP/tree"
+    dirs=$(( (N_FILES + 99) / 100 ))
+    i=0
+    while [ "$i" -lt "$dirs" ]; do
+        mkdir -p "$TMP/tree/d$((i % 32))/s$i"
+        (cd "$TMP/tree/d$((i % 32))/s$i" && lines 100 "file%d.txt" | xargs touch)
+        i=$((i + 1))
+    done
+    timed ls "impl=mysh;filter=none" "$N_FILES" 0 "$MYSH" -c "ls --rec $TMP/tree"
+    timed ls "impl=mysh;filter=substr" "$N_FILES" 0 "$MYSH" -c "ls --rec $TMP/tree --f 7"
+    timed ls "impl=mysh;filter=glob" "$N_FILES" 0 "$MYSH" -c "ls --rec $TMP/tree --g *7.txt"
+    timed ls "impl=coreutils;filter=none" "$N_FILES" 0 ls -R -U "$TMP/tree"
+    timed ls "impl=find;filter=none" "$N_FILES" 0 find "$TMP/tree"
+    rm -rf "$TMP/tree"
+
+    # send: one connection per line vs one batch; the server's start and
+    # stop are timed alone and taken off
+    port=$PORT
+    PORT=$((PORT + 1))
+    lines "$N_SPAWN" "hello %d" > "$TMP/msgs.txt"
+    ready="bench/chatload $port 127.0.0.1 1 1"
+    printf 'start-server %s\n%s\nclose-server\n' "$port" "$ready" > "$TMP/base.sh"
+    { printf 'start-server %s\n%s\n' "$port" "$ready"; lines "$N_SPAWN" "send $port 127.0.0.1 hello%d"; echo close-server; } > "$TMP/send.sh"
+    printf 'start-server %s\n%s\n/bin/cat %s | send --batch %s 127.0.0.1\nclose-server\n' \
+        "$port" "$ready" "$TMP/msgs.txt" "$port" > "$TMP/batch.sh"
+    for mode in send batch; do
+        start=$(now); "$MYSH" "$TMP/base.sh" > /dev/null 2>&1; base=$(( $(now) - start ))
+        start=$(now); "$MYSH" "$TMP/$mode.sh" > /dev/null 2>&1; total=$(( $(now) - start ))
+        row send "mode=$mode" "$N_SPAWN" $((total > base ? total - base : 1)) 0
+    done
+}
+
+
+run_chat() {
+    cpus=$(nproc 2>/dev/null || echo 1)
+    workers=1
+    [ "$cpus" -gt 1 ] && workers="1 $cpus"
+    for engine in epoll uring; do
+        for w in $workers; do
+            for clients in $CLIENTS; do
+                port=$PORT
+                PORT=$((PORT + 1))
+                printf 'start-server %s --workers %s --engine %s\nbench/chatload %s 127.0.0.1 %s %s engine=%s workers=%s\nclose-server\n' \
+                    "$port" "$w" "$engine" "$port" "$clients" "$CHAT_MSGS" "$engine" "$w" > "$TMP/chat.sh"
+                "$MYSH" "$TMP/chat.sh" | grep -o 'chat_fanout,.*'
+            done
+        done
+    done
+}
+
+
+{
+    printf 'benchmark,param,ops,ns_per_op,mb_per_s,extra\n'
+    for group in $ONLY; do
+        "run_$group"
+    done
+} | tee "$OUT"
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -7,66 +8,226 @@
 #include <signal.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <inttypes.h>
+#include <poll.h>
 
 #include "builtins.h"
 #include "io_helpers.h"
+#include "protocol.h"
+#include "pathcache.h"
+#include "wordcount.h"
+#include "dirwalk.h"
+#include "stats.h"
+#include "cmdhash.h"
+#include "functions.h"
+#include "builtins_table.h"     // generated from builtins.def
 
 
 // ====== Command execution =====
 
-/* Return: index of builtin or -1 if cmd doesn't match a builtin
- */
-bn_ptr check_builtin(const char *cmd) {
-    ssize_t cmd_num = 0;
-    while (cmd_num < BUILTINS_COUNT &&
-           strncmp(BUILTINS[cmd_num], cmd, MAX_STR_LEN) != 0) {
-        cmd_num += 1;
+const Builtin *find_builtin(const char *cmd) {
+    uint32_t hash = CMD_HASH_BASIS ^ BUILTIN_SEED;
+    size_t len = 0;
+    for (; cmd[len] != '\0'; len++) {
+        if (len == BUILTIN_MAX_LEN) {
+            return NULL;    // longer than any builtin name
+        }
+        hash = cmd_hash_step(hash, cmd[len]);
     }
-    return BUILTINS_FN[cmd_num];
+    const Builtin *entry = &BUILTIN_TABLE[cmd_hash_final(hash) & (BUILTIN_SLOTS - 1)];
+    if (entry->fn == NULL || entry->len != len || memcmp(entry->name, cmd, len) != 0) {
+        return NULL;
+    }
+    return entry;
 }
 
-// ===== Builtin Helpers =====
 
-ssize_t list_dir(char *path, char *substr, int recursive, int depth, int curr_depth){
-    if (depth == 0){
-        display_message(".\n");
+bn_ptr check_builtin(const char *cmd) {
+    const Builtin *entry = find_builtin(cmd);
+    return entry != NULL ? entry->fn : NULL;
+}
+
+
+int builtin_in_process(char **tokens, int has_input) {
+    const Builtin *entry = find_builtin(tokens[0]);
+    if (entry == NULL) {
         return 0;
     }
-    
-    if(depth != -1 && curr_depth >= depth){
-        return 0;
+    if (entry->flags & BN_IN_PROCESS) {
+        return 1;
+    }
+    if (entry->flags & BN_IN_PROCESS_WITH_INPUT) {
+        return has_input || tokens[1] != NULL;
     }
+    return 0;   // cd, kill, hash and the network builtins touch shell state or block
+}
 
-    DIR *dir = opendir(path);
-    if(dir == NULL){
-        display_error("ERROR: Invalid path: ", path);
+
+// ===== Send connection pool =====
+
+static PooledConn send_pool[SEND_POOL_MAX];
+static int send_pool_count = 0;
+static unsigned long send_pool_clock = 0;
+static pid_t send_pool_owner = 0;
+
+
+/* A forked child (pipeline stage, background job) starts with its own empty
+ * pool: shutting down an inherited socket would hang up the parent's too
+ */
+static void send_pool_claim() {
+    if (send_pool_owner == getpid()) return;
+    for (int i = 0; i < send_pool_count; i++) {
+        close(send_pool[i].fd);
+    }
+    send_pool_count = 0;
+    send_pool_owner = getpid();
+}
+
+
+/* Return: connected socket, or -1 on error
+ */
+static int send_connect(const char *host, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        display_error("ERROR: Socket creation failed", "");
+        return -1;
+    }
+
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    serv_addr.sin_addr.s_addr = inet_addr(host);
+
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+        display_error("ERROR: Connection failed", "");
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+
+/* Discards whatever the server has sent us (greetings, other clients'
+ * broadcasts) so it never backs up behind an idle pooled connection.
+ * Return: 0 if the connection is still open, -1 if the server hung up
+ */
+static int send_discard_input(int sock) {
+    char junk[BUFFER_SIZE];
+    while (1) {
+        ssize_t n = recv(sock, junk, sizeof(junk), MSG_DONTWAIT);
+        if (n > 0) continue;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
         return -1;
     }
+}
+
+
+/* Half-closes and waits for the server to hang up, so unread replies can't
+ * turn our close into a reset that discards messages still in flight. A
+ * server that keeps the connection open is given up on after SEND_HANGUP_MS.
+ */
+static void send_hangup(int sock) {
+    shutdown(sock, SHUT_WR);
+    char junk[BUFFER_SIZE];
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    uint64_t deadline = stats_now() + SEND_HANGUP_MS * 1000000ull;
+    while (1) {
+        uint64_t now = stats_now();
+        if (now >= deadline) break;
+        int ready = poll(&pfd, 1, (deadline - now + 999999) / 1000000);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0 || read(sock, junk, sizeof(junk)) <= 0) break;
+    }
+    close(sock);
+}
 
-    struct dirent *item;
-    while ((item = readdir(dir)) != NULL){
 
-        if(substr == NULL || strstr(item->d_name, substr) != NULL){
-            display_message(item->d_name);
-            display_message("\n");
+/* Return: pooled connection to host:port, opening one (and evicting the least
+ * recently used) if needed, or NULL on error. *reused is set if it was
+ * already open.
+ */
+static PooledConn *send_pool_get(const char *host, int port, int *reused) {
+    PooledConn *conn = NULL;
+    *reused = 0;
+    send_pool_claim();
+    for (int i = 0; i < send_pool_count; i++) {
+        if (send_pool[i].port == port && strncmp(send_pool[i].host, host, SEND_HOST_LEN) == 0) {
+            conn = &send_pool[i];
+            break;
         }
-        
-        if(strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0){
-            continue;
+    }
+
+    if (conn != NULL && send_discard_input(conn->fd) == 0) {
+        *reused = 1;
+        conn->last_used = ++send_pool_clock;
+        return conn;
+    }
+    if (conn != NULL) {
+        close(conn->fd);    // server went away, reconnect in place
+    } else if (send_pool_count < SEND_POOL_MAX) {
+        conn = &send_pool[send_pool_count++];
+    } else {
+        conn = &send_pool[0];
+        for (int i = 1; i < send_pool_count; i++) {
+            if (send_pool[i].last_used < conn->last_used) conn = &send_pool[i];
         }
+        send_hangup(conn->fd);
+    }
+
+    int sock = send_connect(host, port);
+    if (sock < 0) {
+        *conn = send_pool[--send_pool_count];
+        return NULL;
+    }
+    snprintf(conn->host, SEND_HOST_LEN, "%s", host);
+    conn->port = port;
+    conn->fd = sock;
+    conn->last_used = ++send_pool_clock;
+    return conn;
+}
 
-        if (recursive && (depth == -1 || curr_depth + 1 < depth)){
-            struct stat statbuf;
-            char full_path[1024];
-            snprintf(full_path, sizeof(full_path), "%s/%s", path, item->d_name);
 
-            if (stat(full_path, &statbuf) == 0 && S_ISDIR(statbuf.st_mode)){
-                list_dir(full_path, substr, recursive, depth, curr_depth + 1);
-            }
-        }
+static void send_pool_drop(PooledConn *conn) {
+    close(conn->fd);
+    *conn = send_pool[--send_pool_count];
+}
+
+
+/* Writes out's frames to conn, the pooled connection to host:port. A pooled
+ * connection can die between the liveness check and the write, so a failed
+ * write on a reused one is retried once on a fresh connection.
+ * Return: the connection written to, or NULL if the write failed (the
+ * connection is dropped)
+ */
+static PooledConn *send_flush(PooledConn *conn, int reused, const char *host, int port, FrameWriter *out) {
+    size_t len = out->len;
+    if (frame_flush(out, conn->fd) == 0) {
+        return conn;
     }
-    closedir(dir);
-    return 0;
+    send_pool_drop(conn);
+    if (!reused || (conn = send_pool_get(host, port, &reused)) == NULL) {
+        return NULL;
+    }
+    out->len = len;
+    if (frame_flush(out, conn->fd) == 0) {
+        return conn;
+    }
+    send_pool_drop(conn);
+    return NULL;
+}
+
+
+void send_pool_close() {
+    send_pool_claim();
+    for (int i = 0; i < send_pool_count; i++) {
+        send_hangup(send_pool[i].fd);
+    }
+    send_pool_count = 0;
 }
 
 
@@ -97,6 +258,7 @@ ssize_t bn_ls(char **tokens){
 
     char *path = "./"; //default is curr dir
     char *substr = NULL;
+    char *glob = NULL;
     int rec = 0; //bool
     int depth = -1; //inf
 
@@ -105,6 +267,9 @@ ssize_t bn_ls(char **tokens){
         if (strcmp(tokens[i], "--f") == 0 && tokens[i+1] != NULL){
             i++;
             substr = tokens[i];
+        } else if (strcmp(tokens[i], "--g") == 0 && tokens[i+1] != NULL){
+            i++;
+            glob = tokens[i];
         } else if (strcmp(tokens[i], "--rec") == 0){
             rec = 1;
         } else if (strcmp(tokens[i], "--d") == 0 && tokens[i+1] != NULL){
@@ -132,7 +297,27 @@ ssize_t bn_ls(char **tokens){
         return -1;
     }
 
-    return list_dir(path, substr, rec, depth, 0);
+    if (substr != NULL && glob != NULL){
+        display_error("ERROR: --f and --g cannot be combined", "");
+        return -1;
+    }
+
+    // compiled once for the whole listing
+    Matcher match;
+    if (glob != NULL) {
+        if (matcher_init_glob(&match, glob) == -1) {
+            display_error("ERROR: Pattern too complex: ", glob);
+            return -1;
+        }
+    } else if (substr != NULL) {
+        matcher_init_substr(&match, substr);
+    } else {
+        matcher_init_all(&match);
+    }
+
+    ssize_t result = dir_walk(path, &match, rec, depth);
+    matcher_free(&match);
+    return result;
 }
 
 
@@ -160,9 +345,85 @@ ssize_t bn_cd(char **tokens){
 }
 
 
+/* Moves everything from in_fd to out_fd with the kernel doing the copy:
+ * copy_file_range between regular files, sendfile from a regular file,
+ * splice when either side is a pipe.
+ * Return: 0 once in_fd hits EOF, -1 on error, 1 if no zero-copy path applies
+ * (nothing has been moved then)
+ */
+static int cat_zero_copy(int in_fd, int out_fd) {
+    struct stat in_st, out_st;
+    if (fstat(in_fd, &in_st) == -1 || fstat(out_fd, &out_st) == -1) {
+        return 1;
+    }
+    int in_file = S_ISREG(in_st.st_mode), out_file = S_ISREG(out_st.st_mode);
+    int in_pipe = S_ISFIFO(in_st.st_mode), out_pipe = S_ISFIFO(out_st.st_mode);
+    if (out_file && (fcntl(out_fd, F_GETFL) & O_APPEND)) {
+        out_file = 0;   // copy_file_range refuses append mode; sendfile handles it
+    }
+
+    int moved = 0;
+    while (1) {
+        ssize_t n;
+        if (in_file && out_file) {
+            n = copy_file_range(in_fd, NULL, out_fd, NULL, CAT_CHUNK, 0);
+        } else if (in_pipe || out_pipe) {
+            n = splice(in_fd, NULL, out_fd, NULL, CAT_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } else if (in_file) {
+            n = sendfile(out_fd, in_fd, NULL, CAT_CHUNK);
+        } else {
+            return 1;
+        }
+
+        if (n > 0) {
+            moved = 1;
+        } else if (n == 0) {
+            return 0;
+        } else if (errno == EINTR) {
+            continue;
+        } else if (!moved && (errno == EINVAL || errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP)) {
+            return 1;   // e.g. filesystems without copy_file_range
+        } else {
+            return -1;
+        }
+    }
+}
+
+
+/* Return: 0 once in_fd hits EOF, -1 on error
+ */
+static int cat_copy(int in_fd, int out_fd) {
+    char *buf = malloc(CAT_BUF_SIZE);
+    if (buf == NULL) {
+        return -1;
+    }
+    int result = 0;
+    while (1) {
+        ssize_t n = read(in_fd, buf, CAT_BUF_SIZE);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        for (ssize_t off = 0; off < n; ) {
+            ssize_t w = write(out_fd, buf + off, n - off);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) {
+                result = -1;
+                break;
+            }
+            off += w;
+        }
+        if (result == -1) break;
+    }
+    free(buf);
+    return result;
+}
+
+
 ssize_t bn_cat(char **tokens){
-    FILE *input = stdin;
-    int close = 0;
+    int in_fd = STDIN_FILENO;
 
     if(tokens[1] != NULL && tokens[2] != NULL){
         display_error("ERROR: Too many arguments: cat takes a single file", "");
@@ -170,32 +431,35 @@ ssize_t bn_cat(char **tokens){
     }
     
     if(tokens[1] != NULL){
-        input = fopen(tokens[1], "r");
-        if (input == NULL){
+        in_fd = open(tokens[1], O_RDONLY | O_CLOEXEC);
+        if (in_fd == -1){
             display_error("ERROR: Cannot open file", "");
             return -1;
         }
-        close = 1;
     } else if (isatty(STDIN_FILENO)){
         display_error("ERROR: No input source provided", "");
         return -1;
     }
-    
-    char buf[MAX_STR_LEN];
-    while(fgets(buf, MAX_STR_LEN, input) != NULL){
-        display_message(buf);
+
+    display_flush();    // earlier buffered output goes first
+    int result = cat_zero_copy(in_fd, STDOUT_FILENO);
+    if (result == 1) {
+        result = cat_copy(in_fd, STDOUT_FILENO);
     }
 
-    if (close){
-        fclose(input);
+    if (in_fd != STDIN_FILENO){
+        close(in_fd);
+    }
+    if (result == -1 && errno != EPIPE) {
+        display_error("ERROR: Cannot read file", "");
+        return -1;
     }
     return 0;
 }
 
 
 ssize_t bn_wc(char **tokens){
-    FILE *input = stdin;
-    int close = 0;
+    int in_fd = STDIN_FILENO;
 
     if(tokens[1] != NULL && tokens[2] != NULL){
         display_error("ERROR: Too many arguments: wc takes a single file", "");
@@ -203,50 +467,35 @@ ssize_t bn_wc(char **tokens){
     }
     
     if(tokens[1] != NULL){
-        input = fopen(tokens[1], "r");
-        if (input == NULL){
+        in_fd = open(tokens[1], O_RDONLY | O_CLOEXEC);
+        if (in_fd == -1){
             display_error("ERROR: Cannot open file", "");
             return -1;
         }
-        close = 1;
     } else if (isatty(STDIN_FILENO)){
         display_error("ERROR: No input source provided", "");
         return -1;
     }
 
-    int word_count = 0;
-    int char_count = 0;
-    int newline_count = 0;
-    int during_word = 0;
-
-    char c;
-    while((c=fgetc(input)) != EOF){
-        char_count++;
-
-        if(c==' ' || c=='\n'){
-            if(c=='\n'){
-                newline_count++;
-            }
-            during_word = 0;
-        } else if(during_word == 0){
-            during_word = 1;
-            word_count++;
-        }
+    WcCounts counts;
+    int result = wc_count_fd(in_fd, &counts);
+    if (in_fd != STDIN_FILENO){
+        close(in_fd);
+    }
+    if (result == -1) {
+        display_error("ERROR: Cannot read file", "");
+        return -1;
     }
 
     char buf[MAX_STR_LEN];
-    snprintf(buf, sizeof(buf), "word count %d\n", word_count);
+    snprintf(buf, sizeof(buf), "word count %" PRIu64 "\n", counts.words);
     display_message(buf);
 
-    snprintf(buf, sizeof(buf), "character count %d\n", char_count);
+    snprintf(buf, sizeof(buf), "character count %" PRIu64 "\n", counts.bytes);
     display_message(buf);
 
-    snprintf(buf, sizeof(buf), "newline count %d\n", newline_count);
+    snprintf(buf, sizeof(buf), "newline count %" PRIu64 "\n", counts.newlines);
     display_message(buf);
-
-    if (close){
-        fclose(input);
-    }
     return 0;
 }
 
@@ -289,139 +538,139 @@ ssize_t bn_kill(char **tokens){
 
 ssize_t bn_ps(__attribute__((unused)) char **tokens){
     char message[MAX_STR_LEN];
-    for (int i = 0; i < job_count; i++){
-        char *space_ptr = strchr(background_jobs[i].command, ' ');
-        int length = space_ptr - background_jobs[i].command;
+    for (size_t i = 0; i < job_table.cap; i++){
+        Job *job = &job_table.jobs[i];
+        if (job->pid == 0) continue;
+        int length = strcspn(job->command, " ");
 
-        snprintf(message, MAX_STR_LEN, "%.*s %d\n", length, background_jobs[i].command, background_jobs[i].pid);
+        snprintf(message, MAX_STR_LEN, "%.*s %d\n", length, job->command, job->pid);
         display_message(message);
     }
     return 0;
 }
 
 
-ServerState server_state = {0}; //set all fields to 0
+/* hash          lists the cached command paths
+ * hash -r       forgets them all
+ * hash NAME...  looks NAMEs up and caches them; functions and builtins,
+ *               which never run from PATH, are skipped
+ */
+ssize_t bn_hash(char **tokens){
+    if (tokens[1] == NULL) {
+        if (path_cache_print() == 0) {
+            display_message("hash: hash table empty\n");
+        }
+        return 0;
+    }
+    if (strcmp(tokens[1], "-r") == 0) {
+        path_cache_clear();
+        return 0;
+    }
 
+    ssize_t result = 0;
+    char path[PATH_MAX];
+    for (int i = 1; tokens[i] != NULL; i++) {
+        if (strchr(tokens[i], '/') != NULL) continue;
+        if (function_find(tokens[i]) != NULL || find_builtin(tokens[i]) != NULL) continue;
+        if (path_lookup(tokens[i], path, sizeof(path)) == -1) {
+            display_error("ERROR: Not found: ", tokens[i]);
+            result = -1;
+        }
+    }
+    return result;
+}
 
-void handle_server_activity(fd_set *readfds) {
-    char buffer[BUFFER_SIZE];
-    Client *prev = NULL;
-    Client *curr = server_state.clients;
-    
-    while (curr != NULL) {
-        Client *next = curr->next; // need next in case of removal
-        
-        if (FD_ISSET(curr->socket, readfds)) {
-            int valread = read(curr->socket, buffer, BUFFER_SIZE - 1);
-            
-            if (valread <= 0) { // disconnected
-                close(curr->socket);
-                char msg[128];
-                snprintf(msg, sizeof(msg), "client%d disconnected\n", curr->id);
-                display_message(msg);
-                
-                if (prev) {
-                    prev->next = next;
-                } else {
-                    server_state.clients = next;
-                }
-                free(curr);
-                server_state.client_count--;
 
-            } else {
-                buffer[valread] = '\0';
-                
-                if (strcmp(buffer, "\\connected") == 0) {
-                    char msg[MAX_STR_LEN];
-                    snprintf(msg, sizeof(msg), "client%d: %d clients connected\n", curr->id, server_state.client_count);
-                    write(curr->socket, msg, strlen(msg));
-                } else {
-                    // write to all clients
-                    char msg[BUFFER_SIZE + 128];
-                    snprintf(msg, sizeof(msg), "client%d: %s", curr->id, buffer);
-                    
-                    Client *receiver = server_state.clients;
-                    while (receiver) {
-                        if (receiver != curr) { // except sender
-                            write(receiver->socket, msg, strlen(msg));
-                        }
-                        receiver = receiver->next;
-                    }
-                    display_message(msg);
-                }
-            }
-        } else {
-            prev = curr; // advance prev if no deletion
-        }
-        curr = next;
+/* stats          prints the shell's counters
+ * stats --json   prints them as one JSON object
+ * stats -r       zeroes them
+ */
+ssize_t bn_stats(char **tokens){
+    if (tokens[1] == NULL) {
+        stats_print(0);
+    } else if (strcmp(tokens[1], "--json") == 0) {
+        stats_print(1);
+    } else if (strcmp(tokens[1], "-r") == 0) {
+        stats_reset();
+    } else {
+        display_error("ERROR: Invalid argument: ", tokens[1]);
+        return -1;
     }
+    return 0;
 }
 
 
-void server_loop() {
-    fd_set readfds;
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    
-    server_state.server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(server_state.port);
-    
-    bind(server_state.server_fd, (struct sockaddr *)&address, sizeof(address));
-    listen(server_state.server_fd, 10);
-    
-    while (server_state.running) {
-        FD_ZERO(&readfds);
-        FD_SET(server_state.server_fd, &readfds);
-        int max_sd = server_state.server_fd;
-        
-        // fdset all clients
-        Client *curr = server_state.clients;
-        while (curr) {
-            FD_SET(curr->socket, &readfds);
-            if (curr->socket > max_sd) max_sd = curr->socket;
-            curr = curr->next;
-        }
-        
-        int activity = select(max_sd + 1, &readfds, NULL, NULL, NULL);
-        if (activity < 0 && errno != EINTR) {
-            display_error("ERROR: select failed", "");
-            continue;
-        }
-        
-        // connection
-        if (FD_ISSET(server_state.server_fd, &readfds)) {
-            int new_socket = accept(server_state.server_fd, (struct sockaddr *)&address, (socklen_t*)&addrlen);
-            if (new_socket < 0) {
-                display_error("ERROR: accept failed", "");
-                continue;
+/* alias                  prints every alias
+ * alias NAME...          prints those aliases
+ * alias NAME=WORDS...    makes NAME stand for WORDS at the start of a command
+ */
+ssize_t bn_alias(char **tokens){
+    if (tokens[1] == NULL) {
+        alias_print(NULL);
+        return 0;
+    }
+
+    char *eq = strchr(tokens[1], '=');
+    if (eq == NULL) {
+        ssize_t result = 0;
+        for (int i = 1; tokens[i] != NULL; i++) {
+            if (alias_print(tokens[i]) == 0) {
+                display_error("ERROR: Not an alias: ", tokens[i]);
+                result = -1;
             }
-            
-            Client *new_client = malloc(sizeof(Client));
-            new_client->socket = new_socket;
-            new_client->id = ++server_state.client_count;
-            new_client->next = server_state.clients;
-            server_state.clients = new_client;
-            
-            char welcome[MAX_STR_LEN];
-            snprintf(welcome, sizeof(welcome), "client%d: connected\n", new_client->id);
-            write(new_socket, welcome, strlen(welcome));
-            display_message(welcome);
         }
+        return result;
+    }
 
-        handle_server_activity(&readfds);
+    *eq = '\0';
+    if (!user_valid_name(tokens[1], eq - tokens[1])) {
+        display_error("ERROR: Invalid alias name: ", tokens[1]);
+        return -1;
     }
-    
-    // server cleanup after close
-    Client *curr = server_state.clients;
-    while (curr) {
-        Client *next = curr->next;
-        close(curr->socket);
-        free(curr);
-        curr = next;
-    }
-    close(server_state.server_fd);
+    // the value is every word after the '=', joined back with spaces
+    size_t len = strlen(eq + 1);
+    for (int i = 2; tokens[i] != NULL; i++) {
+        len += 1 + strlen(tokens[i]);
+    }
+    char *value = malloc(len + 1);
+    if (value == NULL) {
+        display_error("ERROR: Out of memory for alias: ", tokens[1]);
+        return -1;
+    }
+    size_t pos = strlen(eq + 1);
+    memcpy(value, eq + 1, pos);
+    for (int i = 2; tokens[i] != NULL; i++) {
+        value[pos++] = ' ';
+        memcpy(value + pos, tokens[i], strlen(tokens[i]));
+        pos += strlen(tokens[i]);
+    }
+
+    int err = alias_define(tokens[1], value, len);
+    free(value);
+    if (err == PARSE_NO_MEMORY) {
+        display_error("ERROR: Out of memory for alias: ", tokens[1]);
+    } else if (err != 0) {
+        display_error("ERROR: Alias must be a single command: ", tokens[1]);
+    }
+    return err == 0 ? 0 : -1;
+}
+
+
+/* unalias NAME...    forgets those aliases
+ */
+ssize_t bn_unalias(char **tokens){
+    if (tokens[1] == NULL) {
+        display_error("ERROR: Usage: unalias NAME...", "");
+        return -1;
+    }
+    ssize_t result = 0;
+    for (int i = 1; tokens[i] != NULL; i++) {
+        if (alias_remove(tokens[i]) == -1) {
+            display_error("ERROR: Not an alias: ", tokens[i]);
+            result = -1;
+        }
+    }
+    return result;
 }
 
 
@@ -432,12 +681,69 @@ ssize_t bn_start_server(char **tokens){
     }
     
     server_state.port = atoi(tokens[1]);
+    server_state.high_water = SERVER_DEFAULT_HWM;
+    server_state.lag_policy = LAG_DROP;
+    server_state.workers = 1;
+    server_state.engine = ENGINE_EPOLL;
+
+    //check flags
+    for (int i = 2; tokens[i] != NULL; i++){
+        if (strcmp(tokens[i], "--hwm") == 0 && tokens[i+1] != NULL){
+            i++;
+            long hwm = atol(tokens[i]);
+            if (hwm <= 0){
+                display_error("ERROR: Invalid high-water mark: ", tokens[i]);
+                return -1;
+            }
+            server_state.high_water = hwm;
+        } else if (strcmp(tokens[i], "--workers") == 0 && tokens[i+1] != NULL){
+            i++;
+            int workers = atoi(tokens[i]);
+#ifndef __linux__
+            if (workers != 1){
+                display_error("ERROR: --workers needs epoll (Linux)", "");
+                return -1;
+            }
+#endif
+            if (workers < 1 || workers > SERVER_MAX_WORKERS){
+                display_error("ERROR: Invalid worker count: ", tokens[i]);
+                return -1;
+            }
+            server_state.workers = workers;
+        } else if (strcmp(tokens[i], "--engine") == 0 && tokens[i+1] != NULL){
+            i++;
+            if (strcmp(tokens[i], "epoll") == 0){
+                server_state.engine = ENGINE_EPOLL;
+            } else if (strcmp(tokens[i], "uring") == 0){
+                server_state.engine = ENGINE_URING;
+            } else {
+                display_error("ERROR: Invalid engine: ", tokens[i]);
+                return -1;
+            }
+        } else if (strcmp(tokens[i], "--lag") == 0 && tokens[i+1] != NULL){
+            i++;
+            if (strcmp(tokens[i], "drop") == 0){
+                server_state.lag_policy = LAG_DROP;
+            } else if (strcmp(tokens[i], "disconnect") == 0){
+                server_state.lag_policy = LAG_DISCONNECT;
+            } else {
+                display_error("ERROR: Invalid lag policy: ", tokens[i]);
+                return -1;
+            }
+        } else {
+            display_error("ERROR: Invalid argument: ", tokens[i]);
+            return -1;
+        }
+    }
+
     server_state.running = 1;
     server_state.client_count = 0;
-    server_state.clients = NULL;
+    server_state.next_id = 0;
     
-    pid_t pid = fork();
+    display_flush();
+    pid_t pid = stats_fork();
     if (pid == 0) {
+        display_set_buffered(0);    // chat traffic shows up as it happens
         server_loop();
         exit(0);
     } 
@@ -466,41 +772,156 @@ ssize_t bn_close_server(char **tokens) {
     kill(server_state.server_pid, SIGTERM);
     
     int status;
-    waitpid(server_state.server_pid, &status, 0);
+    while (waitpid(server_state.server_pid, &status, 0) == -1 && errno == EINTR) {
+    }
     
     display_message("Server stopped\n");
     return 0;
 }
 
 
+/* Streams stdin to the server, one message per line, over one pooled
+ * connection. Frames are written SEND_BATCH_FLUSH bytes at a time without
+ * waiting on the server between them.
+ */
+static ssize_t send_batch(char **tokens) {
+    if (!tokens[2] || !tokens[3] || tokens[4]) {
+        display_error("ERROR: Usage: send --batch port host", "");
+        return -1;
+    }
+    const char *host = tokens[3];
+    int port = atoi(tokens[2]);
+    int reused;
+    PooledConn *conn = send_pool_get(host, port, &reused);
+    if (conn == NULL) {
+        return -1;
+    }
+
+    FrameWriter out = {0};
+    char *line = malloc(FRAME_MAX_PAYLOAD + BUFFER_SIZE);
+    size_t len = 0;
+    int err = line == NULL ? -1 : 0;
+    int eof = 0;
+
+    while (err == 0 && !eof) {
+        ssize_t n = read(STDIN_FILENO, line + len, BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            eof = 1;
+            n = 0;
+            if (len > 0) line[len++] = '\n';   // frame a trailing partial line
+        }
+        len += n;
+
+        size_t start = 0;
+        for (size_t i = 0; i < len && err == 0; i++) {
+            if (line[i] != '\n') continue;
+            if (i > start && frame_append(&out, FRAME_MSG, line + start, i - start) < 0) {
+                err = -1;
+            }
+            start = i + 1;
+        }
+        memmove(line, line + start, len - start);
+        len -= start;
+        if (len > FRAME_MAX_PAYLOAD) {
+            err = -1;
+        }
+
+        if (err == 0 && (out.len >= SEND_BATCH_FLUSH || eof)) {
+            // only the first write can find a stale pooled connection
+            conn = send_flush(conn, reused, host, port, &out);
+            reused = 0;
+            if (conn == NULL) {
+                err = -1;
+            } else {
+                send_discard_input(conn->fd);
+            }
+        }
+    }
+    free(line);
+    frame_writer_free(&out);
+
+    if (err < 0) {
+        display_error("ERROR: Send failed", "");
+        if (conn != NULL) send_pool_drop(conn);
+        return -1;
+    }
+    return 0;
+}
+
+
 ssize_t bn_send(char **tokens) {
+    if (tokens[1] && strcmp(tokens[1], "--batch") == 0) {
+        return send_batch(tokens);
+    }
     if (!tokens[1] || !tokens[2] || !tokens[3]) {
         display_error("ERROR: Need port, host and message", "");
         return -1;
     }
 
-    int sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        display_error("ERROR: Socket creation failed", "");
+    // the words are one message, joined by spaces as echo would print them
+    size_t msg_len = 0;
+    for (int i = 3; tokens[i] != NULL; i++) {
+        msg_len += strlen(tokens[i]) + 1;
+    }
+    char *msg = malloc(msg_len);
+    if (msg == NULL) {
+        display_error("ERROR: Out of memory for message", "");
         return -1;
     }
+    char *end = msg;
+    for (int i = 3; tokens[i] != NULL; i++) {
+        if (i > 3) *end++ = ' ';
+        size_t len = strlen(tokens[i]);
+        memcpy(end, tokens[i], len);
+        end += len;
+    }
 
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(atoi(tokens[1]));
-    serv_addr.sin_addr.s_addr = inet_addr(tokens[2]);
-
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        display_error("ERROR: Connection failed", "");
-        close(sock);
+    FrameWriter out = {0};
+    int appended = frame_append(&out, FRAME_MSG, msg, end - msg);
+    free(msg);
+    if (appended < 0) {
+        display_error("ERROR: Message too long", "");
+        frame_writer_free(&out);
         return -1;
     }
 
-    char *message = tokens[3];
-    write(sock, message, strlen(message));
-    close(sock);
-    return 0;
+    int reused;
+    int port = atoi(tokens[1]);
+    PooledConn *conn = send_pool_get(tokens[2], port, &reused);
+    if (conn != NULL && send_flush(conn, reused, tokens[2], port, &out) == NULL) {
+        display_error("ERROR: Send failed", "");
+        conn = NULL;
+    }
+    frame_writer_free(&out);
+    return conn == NULL ? -1 : 0;
+}
+
+
+/* Frames each complete line in line[0..*len) into out and keeps the leftover
+ * partial line at the front. With flush_partial, the leftover is framed too.
+ */
+static void frame_lines(FrameWriter *out, char *line, size_t *len, int flush_partial) {
+    size_t start = 0;
+    for (size_t i = 0; i < *len; i++) {
+        if (line[i] != '\n' && !(flush_partial && i == *len - 1)) {
+            continue;
+        }
+
+        char *msg = line + start;
+        size_t msg_len = i + 1 - start;
+        if (msg_len == strlen("\\connected\n") && strncmp(msg, "\\connected\n", msg_len) == 0) {
+            frame_append(out, FRAME_CONNECTED, NULL, 0);
+        } else if (msg_len == strlen("\\stats\n") && strncmp(msg, "\\stats\n", msg_len) == 0) {
+            frame_append(out, FRAME_STATS, NULL, 0);
+        } else {
+            frame_append(out, FRAME_MSG, msg, msg_len);
+        }
+        start = i + 1;
+    }
+
+    memmove(line, line + start, *len - start);
+    *len -= start;
 }
 
 
@@ -531,49 +952,60 @@ ssize_t bn_start_client(char **tokens) {
         return -1;
     }
 
-    char welcome[128];
-    if (read(sock, welcome, sizeof(welcome)) <= 0) {
-        display_error("ERROR: Server disconnected", "");
-        close(sock);
-        return -1;
-    }
-    display_message(welcome);
+    FrameReader in = {0};
+    FrameWriter out = {0};
+    char line[BUFFER_SIZE];
+    size_t line_len = 0;
 
     fd_set readfds;
-    char buffer[BUFFER_SIZE];
     while (1) {
         FD_ZERO(&readfds);
         FD_SET(STDIN_FILENO, &readfds);  // stdin
         FD_SET(sock, &readfds);          // server socket
 
         if (select(sock + 1, &readfds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) continue;
             display_error("ERROR: select failed", "");
             break;
         }
 
-        // check stdin
+        // check stdin: every line already typed or piped in goes out in one write
         if (FD_ISSET(STDIN_FILENO, &readfds)) {
-            if (!fgets(buffer, BUFFER_SIZE, stdin)) break;  // EOF (Ctrl+D)
-            
-            if (strcmp(buffer, "\\connected\n") == 0) {
-                write(sock, "\\connected", 10);
-            } else {
-                write(sock, buffer, strlen(buffer));
+            ssize_t bytes = read(STDIN_FILENO, line + line_len, sizeof(line) - line_len);
+            if (bytes > 0) {
+                line_len += bytes;
+            }
+            // a line that fills the buffer is sent as it is
+            frame_lines(&out, line, &line_len, bytes <= 0 || line_len == sizeof(line));
+            if (frame_flush(&out, sock) < 0) {
+                display_error("ERROR: Server disconnected", "");
+                break;
             }
+            if (bytes <= 0) break;  // EOF (Ctrl+D)
         }
 
         // check server messages
         if (FD_ISSET(sock, &readfds)) {
-            int bytes = read(sock, buffer, BUFFER_SIZE - 1);
-            if (bytes <= 0) {
+            if (frame_read(&in, sock) <= 0) {
                 display_error("ERROR: Server disconnected", "");
                 break;
             }
-            buffer[bytes] = '\0';
-            display_message(buffer);
+
+            Frame frame;
+            int ret;
+            while ((ret = frame_next(&in, &frame)) == 1) {
+                display_buffer(frame.payload, frame.len);
+            }
+            display_flush();    // a live session, even when stdout is buffered
+            if (ret < 0) {
+                display_error("ERROR: Malformed message from server", "");
+                break;
+            }
         }
     }
 
+    frame_reader_free(&in);
+    frame_writer_free(&out);
     close(sock);
     return 0;
 }
\ No newline at end of file
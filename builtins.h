@@ -7,63 +7,73 @@
 #include <arpa/inet.h>
 #include <sys/select.h>
 
+#include "server.h"
+#include "jobs.h"
 
-#define MAX_JOBS 200
-#define MAX_CMD_LEN 100
-#define BUFFER_SIZE 1024
 
-typedef struct client_node {
-    int socket;
-    int id;
-    struct client_node *next;
-} Client;
+#define CAT_CHUNK (1 << 20)             // bytes per splice/sendfile/copy_file_range call
+#define CAT_BUF_SIZE (128 * 1024)       // read/write fallback buffer
 
-typedef struct {
-    int server_fd;
-    int port;
-    Client *clients;
-    int client_count;
-    int running;
-    pid_t server_pid;
-} ServerState;
+#define SEND_POOL_MAX 16
+#define SEND_HOST_LEN 64
+#define SEND_BATCH_FLUSH (64 * 1024)    // bytes of frames buffered per write in send --batch
+#define SEND_HANGUP_MS 200              // longest wait for the server to close after our shutdown
 
+/* A connection kept open by send for reuse, keyed by host:port
+ */
 typedef struct {
-    int pid;
-    char command[MAX_CMD_LEN];
-    int job_id;
-} BackgroundJob;
-
-extern BackgroundJob background_jobs[MAX_JOBS];
-extern int job_count;
-extern ServerState server_state;
+    char host[SEND_HOST_LEN];
+    int port;
+    int fd;
+    unsigned long last_used;
+} PooledConn;
 
 /* Type for builtin handling functions
  * Input: Array of tokens
  * Return: >=0 on success and -1 on error
  */
 typedef ssize_t (*bn_ptr)(char **);
-ssize_t bn_echo(char **tokens);
-ssize_t bn_ls(char **tokens);
-ssize_t bn_cd(char **tokens);
-ssize_t bn_cat(char **tokens);
-ssize_t bn_wc(char **tokens);
-ssize_t bn_kill(char **tokens);
-ssize_t bn_ps(__attribute__((unused)) char **tokens);
-ssize_t bn_start_server(char **tokens);
-ssize_t bn_close_server(char **tokens);
-ssize_t bn_send(char **tokens);
-ssize_t bn_start_client(char **tokens);
-
-
-/* Return: index of builtin or -1 if cmd doesn't match a builtin
+
+#define BUILTIN(name, fn, flags) ssize_t fn(char **tokens);
+#include "builtins.def"
+#undef BUILTIN
+
+#define BN_IN_PROCESS 1                 // may run inside the shell as a pipeline stage
+#define BN_IN_PROCESS_WITH_INPUT 2      // only with a file argument or piped input
+
+/* One slot of the generated builtin table (builtins_table.h); len is 0 and
+ * fn NULL in unused slots
+ */
+typedef struct {
+    const char *name;
+    size_t len;
+    bn_ptr fn;
+    int flags;
+} Builtin;
+
+
+/* Looks cmd up in the builtin table, a perfect hash generated from
+ * builtins.def at build time
+ * Return: cmd's entry, or NULL if cmd is not a builtin
+ */
+const Builtin *find_builtin(const char *cmd);
+
+
+/* Return: cmd's builtin function, or NULL if cmd is not a builtin
  */
 bn_ptr check_builtin(const char *cmd);
 
 
-/* BUILTINS and BUILTINS_FN are parallel arrays of length BUILTINS_COUNT
+/* Return: 1 if tokens may run inside the shell process as a pipeline stage:
+ * a builtin that leaves shell state alone and, unless has_input, does not
+ * read the shell's own stdin
+ */
+int builtin_in_process(char **tokens, int has_input);
+
+
+/* Hangs up every connection send has pooled in this process. Called before
+ * the shell or a forked builtin exits.
  */
-static const char * const BUILTINS[] = {"echo", "ls", "cd", "cat", "wc", "kill", "ps", "start-server", "close-server", "send", "start-client"};
-static const bn_ptr BUILTINS_FN[] = {bn_echo, bn_ls, bn_cd, bn_cat, bn_wc, bn_kill, bn_ps, bn_start_server, bn_close_server, bn_send, bn_start_client, NULL};    // Extra null element for 'non-builtin'
-static const ssize_t BUILTINS_COUNT = sizeof(BUILTINS) / sizeof(char *);
+void send_pool_close();
 
 #endif
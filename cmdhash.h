@@ -0,0 +1,34 @@
+#ifndef __CMDHASH_H__
+#define __CMDHASH_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+
+/* Seeded FNV-1a over a name, one byte per step. Shared by the builtin table
+ * generator and every name-keyed table in the shell (functions and aliases,
+ * the PATH cache, variables), so a name is hashed the same way everywhere.
+ */
+#define CMD_HASH_BASIS 2166136261u
+
+static inline uint32_t cmd_hash_step(uint32_t hash, char c) {
+    return (hash ^ (unsigned char)c) * 16777619u;
+}
+
+
+/* Mixes the high bits down so masking to a small table size keeps them
+ */
+static inline uint32_t cmd_hash_final(uint32_t hash) {
+    return hash ^ (hash >> 15);
+}
+
+
+static inline uint32_t cmd_hash(uint32_t seed, const char *name, size_t len) {
+    uint32_t hash = CMD_HASH_BASIS ^ seed;
+    for (size_t i = 0; i < len; i++) {
+        hash = cmd_hash_step(hash, name[i]);
+    }
+    return cmd_hash_final(hash);
+}
+
+#endif
@@ -0,0 +1,419 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "dirwalk.h"
+#include "io_helpers.h"
+
+/* Shared by the printing thread (deque 0) and the workers (1..threads-1)
+ */
+typedef struct {
+    const Matcher *match;
+    int recursive;
+    int depth;
+
+    size_t threads;
+    WalkDeque deques[WALK_MAX_THREADS];
+    atomic_size_t queued;
+    _Atomic(WalkNode *) all;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;       // workers: something was queued, or stop
+    pthread_cond_t done_cond;       // printer: a node it waits on is done
+    int stop;
+    int printer_waiting;
+
+    char out[WALK_OUT_BUF];
+    size_t out_len;
+} Walker;
+
+typedef struct {
+    Walker *walker;
+    size_t index;
+} WalkWorker;
+
+
+// ===== Nodes =====
+
+static WalkNode *walk_node_new(Walker *w, const char *parent, const char *name, int depth) {
+    WalkNode *node = calloc(1, sizeof(WalkNode));
+    if (node == NULL) {
+        return NULL;
+    }
+    if (name == NULL) {
+        node->path = strdup(parent);
+    } else if (asprintf(&node->path, "%s/%s", parent, name) == -1) {
+        node->path = NULL;
+    }
+    if (node->path == NULL) {
+        free(node);
+        return NULL;
+    }
+    node->depth = depth;
+    atomic_init(&node->state, WALK_PENDING);
+
+    node->all_next = atomic_load(&w->all);
+    while (!atomic_compare_exchange_weak(&w->all, &node->all_next, node)) {
+    }
+    return node;
+}
+
+
+/* Return: 0 on success, -1 if memory ran out
+ */
+static int walk_add_entry(WalkNode *node, const char *name, size_t len, WalkNode *child) {
+    if (node->names_len + len + 1 > node->names_cap) {
+        size_t cap = node->names_cap ? node->names_cap : 1024;
+        while (cap < node->names_len + len + 1) {
+            cap *= 2;
+        }
+        char *names = realloc(node->names, cap);
+        if (names == NULL) {
+            return -1;
+        }
+        node->names = names;
+        node->names_cap = cap;
+    }
+    if (node->entry_count == node->entry_cap) {
+        size_t cap = node->entry_cap ? node->entry_cap * 2 : 64;
+        WalkEntry *entries = realloc(node->entries, cap * sizeof(WalkEntry));
+        if (entries == NULL) {
+            return -1;
+        }
+        node->entries = entries;
+        node->entry_cap = cap;
+    }
+    node->entries[node->entry_count].name_off = node->names_len;
+    node->entries[node->entry_count].child = child;
+    node->entry_count++;
+    memcpy(node->names + node->names_len, name, len + 1);
+    node->names_len += len + 1;
+    return 0;
+}
+
+
+static void walk_node_release(WalkNode *node) {
+    free(node->names);
+    free(node->entries);
+    node->names = NULL;
+    node->entries = NULL;
+}
+
+
+// ===== Work deques =====
+
+/* Queues children so the owner pops them first to last
+ */
+static void walk_push(Walker *w, size_t self, WalkNode **children, size_t count) {
+    if (w->threads == 1 || count == 0) {
+        return;     // the printer reaches every node itself
+    }
+    WalkDeque *dq = &w->deques[self];
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count + count > dq->cap) {
+        size_t cap = dq->cap ? dq->cap : 64;
+        while (cap < dq->count + count) {
+            cap *= 2;
+        }
+        WalkNode **items = malloc(cap * sizeof(WalkNode *));
+        if (items == NULL) {
+            pthread_mutex_unlock(&dq->lock);
+            return;
+        }
+        for (size_t i = 0; i < dq->count; i++) {
+            items[i] = dq->items[(dq->head + i) % dq->cap];
+        }
+        free(dq->items);
+        dq->items = items;
+        dq->head = 0;
+        dq->cap = cap;
+    }
+    for (size_t i = count; i-- > 0; ) {
+        dq->items[(dq->head + dq->count) % dq->cap] = children[i];
+        dq->count++;
+    }
+    pthread_mutex_unlock(&dq->lock);
+
+    atomic_fetch_add(&w->queued, count);
+    pthread_mutex_lock(&w->lock);
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+static WalkNode *walk_pop(WalkDeque *dq, int back) {
+    WalkNode *node = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        if (back) {
+            node = dq->items[(dq->head + dq->count - 1) % dq->cap];
+        } else {
+            node = dq->items[dq->head];
+            dq->head = (dq->head + 1) % dq->cap;
+        }
+        dq->count--;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return node;
+}
+
+
+/* Return: the next queued directory for worker self, its own newest first,
+ * else the oldest of another's; NULL once the walk stops
+ */
+static WalkNode *walk_take(Walker *w, size_t self) {
+    while (1) {
+        WalkNode *node = walk_pop(&w->deques[self], 1);
+        for (size_t i = 1; node == NULL && i < w->threads; i++) {
+            node = walk_pop(&w->deques[(self + i) % w->threads], 0);
+        }
+        if (node != NULL) {
+            atomic_fetch_sub(&w->queued, 1);
+            return node;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        while (atomic_load(&w->queued) == 0 && !w->stop) {
+            pthread_cond_wait(&w->work_cond, &w->lock);
+        }
+        int stop = w->stop;
+        pthread_mutex_unlock(&w->lock);
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+
+// ===== Reading =====
+
+/* Return: 1 if node is the same directory as one of its ancestors, which
+ * only a symlink can lead to
+ * Prereq: node and its ancestors were opened
+ */
+static int walk_is_loop(const WalkNode *node) {
+    for (const WalkNode *up = node->parent; up != NULL; up = up->parent) {
+        if (up->dev == node->dev && up->ino == node->ino) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/* Reads node's entries with getdents64, trusting d_type and only calling
+ * fstatat for symlinks, which are followed, and when the filesystem leaves
+ * the type unknown. Subdirectories to descend into become child nodes. A
+ * directory that loops back to an ancestor is left empty.
+ * Prereq: the caller claimed node
+ */
+static void walk_read(Walker *w, WalkNode *node, size_t self) {
+    int descend = w->recursive && (w->depth == -1 || node->depth + 1 < w->depth);
+    WalkNode *children[WALK_DENTS_BUF / 24];    // a dirent64 takes at least 24 bytes
+    size_t child_count = 0;
+
+    int fd = openat(AT_FDCWD, node->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    int loop = 0;
+    if (fd != -1 && descend && fstat(fd, &st) == 0) {
+        node->dev = st.st_dev;
+        node->ino = st.st_ino;
+        loop = walk_is_loop(node);
+    }
+    if (fd == -1) {
+        node->error = 1;
+    } else if (loop) {
+        close(fd);      // being listed higher up already
+    } else {
+        char *buf = malloc(WALK_DENTS_BUF);
+        ssize_t n;
+        while (buf != NULL && (n = getdents64(fd, buf, WALK_DENTS_BUF)) > 0) {
+            for (ssize_t off = 0; off < n; ) {
+                struct dirent64 *d = (struct dirent64 *)(buf + off);
+                off += d->d_reclen;
+
+                const char *name = d->d_name;
+                WalkNode *child = NULL;
+                if (descend && strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+                    int is_dir = d->d_type == DT_DIR ||
+                        ((d->d_type == DT_UNKNOWN || d->d_type == DT_LNK) &&
+                         fstatat(fd, name, &st, 0) == 0 && S_ISDIR(st.st_mode));
+                    if (is_dir) {
+                        child = walk_node_new(w, node->path, name, node->depth + 1);
+                    }
+                    if (child != NULL) {
+                        child->parent = node;
+                    }
+                }
+                walk_add_entry(node, name, strlen(name), child);
+                if (child != NULL) {
+                    children[child_count++] = child;
+                }
+            }
+            // queue as we go so idle workers start on this directory's children early
+            walk_push(w, self, children, child_count);
+            child_count = 0;
+        }
+        free(buf);
+        close(fd);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    atomic_store(&node->state, WALK_DONE);
+    if (w->printer_waiting) {
+        pthread_cond_broadcast(&w->done_cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+static void *walk_worker(void *arg) {
+    WalkWorker *worker = arg;
+    Walker *w = worker->walker;
+    WalkNode *node;
+    while ((node = walk_take(w, worker->index)) != NULL) {
+        int expected = WALK_PENDING;
+        if (atomic_compare_exchange_strong(&node->state, &expected, WALK_CLAIMED)) {
+            walk_read(w, node, worker->index);
+        }
+    }
+    return NULL;
+}
+
+
+// ===== Printing =====
+
+static void walk_flush(Walker *w) {
+    display_buffer(w->out, w->out_len);
+    w->out_len = 0;
+}
+
+
+static void walk_print(Walker *w, const char *name, size_t len) {
+    if (w->out_len + len + 1 > WALK_OUT_BUF) {
+        walk_flush(w);
+        if (len + 1 > WALK_OUT_BUF) {
+            display_buffer(name, len);
+            display_buffer("\n", 1);
+            return;
+        }
+    }
+    memcpy(w->out + w->out_len, name, len);
+    w->out[w->out_len + len] = '\n';
+    w->out_len += len + 1;
+}
+
+
+/* Prints node and, depth first, its subdirectories, reading any directory no
+ * worker has claimed yet and waiting on the ones in progress
+ * Return: 0 on success, -1 if node could not be opened
+ */
+static int walk_emit(Walker *w, WalkNode *node) {
+    int expected = WALK_PENDING;
+    if (atomic_compare_exchange_strong(&node->state, &expected, WALK_CLAIMED)) {
+        walk_read(w, node, 0);
+    } else if (atomic_load(&node->state) != WALK_DONE) {
+        pthread_mutex_lock(&w->lock);
+        w->printer_waiting = 1;
+        while (atomic_load(&node->state) != WALK_DONE) {
+            pthread_cond_wait(&w->done_cond, &w->lock);
+        }
+        w->printer_waiting = 0;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    if (node->error) {
+        walk_flush(w);
+        display_error("ERROR: Invalid path: ", node->path);
+        return -1;
+    }
+    for (size_t i = 0; i < node->entry_count; i++) {
+        const char *name = node->names + node->entries[i].name_off;
+        size_t len = strlen(name);
+        if (matcher_match(w->match, name, len)) {
+            walk_print(w, name, len);
+        }
+        if (node->entries[i].child != NULL) {
+            walk_emit(w, node->entries[i].child);
+        }
+    }
+    walk_node_release(node);
+    return 0;
+}
+
+
+ssize_t dir_walk(const char *path, const Matcher *match, int recursive, int depth) {
+    if (depth == 0) {
+        display_message(".\n");
+        return 0;
+    }
+
+    Walker *w = calloc(1, sizeof(Walker));
+    if (w == NULL) {
+        return -1;
+    }
+    w->match = match;
+    w->recursive = recursive;
+    w->depth = depth;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work_cond, NULL);
+    pthread_cond_init(&w->done_cond, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    w->threads = 1;
+    if (recursive && cpus > 1) {
+        w->threads = cpus < WALK_MAX_THREADS ? (size_t)cpus : WALK_MAX_THREADS;
+    }
+    for (size_t i = 0; i < w->threads; i++) {
+        pthread_mutex_init(&w->deques[i].lock, NULL);
+    }
+
+    WalkWorker workers[WALK_MAX_THREADS];
+    pthread_t tids[WALK_MAX_THREADS];
+    size_t started = 1;
+    for (; started < w->threads; started++) {
+        workers[started].walker = w;
+        workers[started].index = started;
+        if (pthread_create(&tids[started], NULL, walk_worker, &workers[started]) != 0) {
+            break;
+        }
+    }
+
+    ssize_t result = -1;
+    WalkNode *root = walk_node_new(w, path, NULL, 0);
+    if (root != NULL) {
+        result = walk_emit(w, root);
+        walk_flush(w);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->work_cond);
+    pthread_mutex_unlock(&w->lock);
+    for (size_t i = 1; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+
+    WalkNode *node = atomic_load(&w->all);
+    while (node != NULL) {
+        WalkNode *next = node->all_next;
+        walk_node_release(node);
+        free(node->path);
+        free(node);
+        node = next;
+    }
+    for (size_t i = 0; i < w->threads; i++) {
+        free(w->deques[i].items);
+        pthread_mutex_destroy(&w->deques[i].lock);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->work_cond);
+    pthread_cond_destroy(&w->done_cond);
+    free(w);
+    return result;
+}
@@ -0,0 +1,74 @@
+#ifndef __DIRWALK_H__
+#define __DIRWALK_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "match.h"
+
+
+#define WALK_MAX_THREADS 8
+#define WALK_DENTS_BUF (64 * 1024)      // getdents64 buffer per directory read
+#define WALK_OUT_BUF (64 * 1024)        // names batched per write
+
+typedef enum {
+    WALK_PENDING,
+    WALK_CLAIMED,       // being read by a worker or the printer
+    WALK_DONE
+} WalkState;
+
+struct walk_node;
+
+/* One directory entry: name is names + name_off; child is set for
+ * subdirectories that will be listed too
+ */
+typedef struct {
+    uint32_t name_off;
+    struct walk_node *child;
+} WalkEntry;
+
+/* A directory to read. Any thread may read it (whoever claims it first);
+ * only the printing thread consumes it, in depth-first order.
+ */
+typedef struct walk_node {
+    char *path;
+    int depth;
+    struct walk_node *parent;   // NULL for the root
+    dev_t dev;                  // identify the directory once it is opened
+    ino_t ino;
+    atomic_int state;
+    int error;                  // could not be opened
+    char *names;                // entry names, NUL terminated, back to back
+    size_t names_len;
+    size_t names_cap;
+    WalkEntry *entries;         // in directory order
+    size_t entry_count;
+    size_t entry_cap;
+    struct walk_node *all_next; // every node, for teardown
+} WalkNode;
+
+/* Directories waiting to be read. The owning worker pushes and pops at the
+ * back (depth first); idle workers steal from the front.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    WalkNode **items;
+    size_t head;
+    size_t count;
+    size_t cap;
+} WalkDeque;
+
+
+/* Lists path like ls: entries in directory order, each subdirectory's listing
+ * right after its name when recursive, down to depth levels (-1: no limit).
+ * Symlinks to directories are followed, but a directory that is already
+ * being listed higher up is not listed again. Only names passing match are
+ * printed. Large trees are read by several threads; output order does not
+ * change.
+ * Return: 0 on success, -1 if path cannot be listed
+ */
+ssize_t dir_walk(const char *path, const Matcher *match, int recursive, int depth);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "functions.h"
+#include "cmdhash.h"
+#include "io_helpers.h"
+
+static UserTable function_table;
+static UserTable alias_table;
+
+
+// ===== Hash table =====
+
+/* Prereq: table->slot_cap > 0
+ * Return: the slot holding name, or the empty slot where it belongs
+ */
+static UserCommand **user_slot(UserTable *table, const char *name, size_t len, uint32_t hash) {
+    size_t mask = table->slot_cap - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        UserCommand *entry = table->slots[i];
+        if (entry == NULL || (entry->hash == hash && strncmp(entry->name, name, len) == 0 && entry->name[len] == '\0')) {
+            return &table->slots[i];
+        }
+    }
+}
+
+
+/* Doubles the slot array and rehashes every entry
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int user_grow(UserTable *table) {
+    size_t cap = table->slot_cap ? table->slot_cap * 2 : USER_MIN_SLOTS;
+    UserCommand **slots = calloc(cap, sizeof(UserCommand *));
+    if (slots == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table->slot_cap; i++) {
+        UserCommand *entry = table->slots[i];
+        if (entry == NULL) continue;
+        size_t j = entry->hash & (cap - 1);
+        while (slots[j] != NULL) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = entry;
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slot_cap = cap;
+    return 0;
+}
+
+
+static UserCommand *user_find(UserTable *table, const char *name) {
+    if (table->count == 0) {
+        return NULL;
+    }
+    size_t len = strlen(name);
+    return *user_slot(table, name, len, cmd_hash(0, name, len));
+}
+
+
+void user_retain(UserCommand *f) {
+    f->refs++;
+}
+
+
+void user_release(UserCommand *f) {
+    if (--f->refs > 0) {
+        return;
+    }
+    arena_free(&f->arena);
+    free(f->name);
+    free(f);
+}
+
+
+/* Makes a new entry for name holding a copy of text
+ * Return: the entry, or NULL if memory ran out
+ */
+static UserCommand *user_new(const char *name, const char *text, size_t len) {
+    UserCommand *entry = calloc(1, sizeof(UserCommand));
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->refs = 1;
+    entry->name = strdup(name);
+    char *source = arena_alloc(&entry->arena, len + 1);
+    if (entry->name == NULL || source == NULL) {
+        user_release(entry);
+        return NULL;
+    }
+    memcpy(source, text, len);
+    entry->source = source;
+    entry->source_len = len;
+    entry->hash = cmd_hash(0, name, strlen(name));
+    return entry;
+}
+
+
+/* Stores entry under its name, releasing whatever was there
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int user_insert(UserTable *table, UserCommand *entry) {
+    if (2 * (table->count + 1) > table->slot_cap && user_grow(table) == -1) {
+        return -1;
+    }
+    UserCommand **slot = user_slot(table, entry->name, strlen(entry->name), entry->hash);
+    if (*slot != NULL) {
+        user_release(*slot);
+    } else {
+        table->count++;
+    }
+    *slot = entry;
+    return 0;
+}
+
+
+static int user_remove(UserTable *table, const char *name) {
+    if (table->count == 0) {
+        return -1;
+    }
+    size_t len = strlen(name);
+    UserCommand **slot = user_slot(table, name, len, cmd_hash(0, name, len));
+    if (*slot == NULL) {
+        return -1;
+    }
+    user_release(*slot);
+    *slot = NULL;
+    table->count--;
+
+    // re-seat the rest of the probe run so later lookups still find it
+    size_t mask = table->slot_cap - 1;
+    for (size_t i = (slot - table->slots + 1) & mask; table->slots[i] != NULL; i = (i + 1) & mask) {
+        UserCommand *moved = table->slots[i];
+        table->slots[i] = NULL;
+        *user_slot(table, moved->name, strlen(moved->name), moved->hash) = moved;
+    }
+    return 0;
+}
+
+
+static void user_table_free(UserTable *table) {
+    for (size_t i = 0; i < table->slot_cap; i++) {
+        if (table->slots[i] != NULL) {
+            user_release(table->slots[i]);
+        }
+    }
+    free(table->slots);
+    memset(table, 0, sizeof(UserTable));
+}
+
+
+int user_valid_name(const char *name, size_t len) {
+    if (len == 0 || (name[0] >= '0' && name[0] <= '9')) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (strchr(" \t\n|;&$=(){}/", name[i]) != NULL) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+// ===== Functions =====
+
+int function_define(const char *name, const char *body, size_t len) {
+    UserCommand *f = user_new(name, body, len);
+    if (f == NULL) {
+        return -1;
+    }
+    int err = ast_parse(&f->arena, f->source, f->source_len, &f->body, NULL);
+    if (err == 0) {
+        err = user_insert(&function_table, f);
+    }
+    if (err != 0) {
+        user_release(f);
+    }
+    return err;
+}
+
+
+UserCommand *function_find(const char *name) {
+    return user_find(&function_table, name);
+}
+
+
+// ===== Aliases =====
+
+int alias_define(const char *name, const char *value, size_t len) {
+    UserCommand *a = user_new(name, value, len);
+    if (a == NULL) {
+        return -1;
+    }
+    int err = ast_parse_command(&a->arena, a->source, a->source_len, &a->words);
+    if (err == 0) {
+        err = user_insert(&alias_table, a);
+    }
+    if (err != 0) {
+        user_release(a);
+    }
+    return err;
+}
+
+
+UserCommand *alias_find(const char *name) {
+    return user_find(&alias_table, name);
+}
+
+
+int alias_remove(const char *name) {
+    return user_remove(&alias_table, name);
+}
+
+
+static void alias_print_one(const UserCommand *a) {
+    display_message("alias ");
+    display_message(a->name);
+    display_message("=");
+    display_buffer(a->source, a->source_len);
+    display_message("\n");
+}
+
+
+size_t alias_print(const char *name) {
+    if (name != NULL) {
+        UserCommand *a = alias_find(name);
+        if (a == NULL) {
+            return 0;
+        }
+        alias_print_one(a);
+        return 1;
+    }
+    for (size_t i = 0; i < alias_table.slot_cap; i++) {
+        if (alias_table.slots[i] != NULL) {
+            alias_print_one(alias_table.slots[i]);
+        }
+    }
+    return alias_table.count;
+}
+
+
+void user_commands_free() {
+    user_table_free(&function_table);
+    user_table_free(&alias_table);
+}
@@ -0,0 +1,82 @@
+#ifndef __FUNCTIONS_H__
+#define __FUNCTIONS_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+#include "ast.h"
+
+
+#define USER_MIN_SLOTS 16           // power of 2
+#define FUNC_MAX_DEPTH 256          // nested function calls
+
+/* A shell function or alias. Its text is copied into arena and compiled there
+ * once; every use runs the compiled form. refs counts the table's reference
+ * plus each call in progress, so redefining a running function is safe.
+ */
+typedef struct {
+    char *name;
+    uint32_t hash;
+    int refs;
+    Arena arena;
+    const char *source;         // in arena
+    size_t source_len;
+    AndOr *body;                // functions
+    SimpleCommand *words;       // aliases
+} UserCommand;
+
+/* Name -> UserCommand, open addressing (at most half full), hashed with
+ * cmd_hash. Functions and aliases have a table each, as in sh.
+ */
+typedef struct {
+    UserCommand **slots;        // NULL marks an empty slot
+    size_t slot_cap;
+    size_t count;
+} UserTable;
+
+
+/* Defines (or replaces) function name with body (len bytes), the source
+ * between its braces, parsed again into the function's own arena
+ * Return: 0 on success, or a PARSE_* error
+ */
+int function_define(const char *name, const char *body, size_t len);
+
+
+/* Return: the function called name, or NULL. Costs nothing while no function
+ * is defined.
+ */
+UserCommand *function_find(const char *name);
+
+
+/* Pins / unpins f across a call
+ */
+void user_retain(UserCommand *f);
+void user_release(UserCommand *f);
+
+
+/* Defines (or replaces) alias name as the words of value (len bytes)
+ * Return: 0 on success, or a PARSE_* error (PARSE_SYNTAX if value is not a
+ * single command)
+ */
+int alias_define(const char *name, const char *value, size_t len);
+UserCommand *alias_find(const char *name);
+
+
+/* Return: 0 on success, -1 if name is not an alias
+ */
+int alias_remove(const char *name);
+
+
+/* Prints every alias (or one) as alias name=value
+ * Return: number printed
+ */
+size_t alias_print(const char *name);
+
+void user_commands_free();
+
+
+/* Return: 1 if name is a valid function or alias name
+ */
+int user_valid_name(const char *name, size_t len);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cmdhash.h"
+
+/* Build-time generator for builtins_table.h: finds a seed under which
+ * cmd_hash sends every name in builtins.def to its own slot of a power of two
+ * table, then prints that table. Looking a name up is one hash, one mask and
+ * one compare; a name that is not a builtin costs the same.
+ */
+
+#define GEN_MAX_SEEDS 10000000
+
+typedef struct {
+    const char *name;
+    const char *fn;
+    const char *flags;
+} Entry;
+
+static const Entry entries[] = {
+#define BUILTIN(name, fn, flags) {name, #fn, #flags},
+#include "builtins.def"
+#undef BUILTIN
+};
+#define ENTRY_COUNT (sizeof(entries) / sizeof(*entries))
+
+
+/* Return: 1 if seed gives every entry a distinct slot of a slots table
+ */
+static int try_seed(uint32_t seed, size_t slots, int *slot_of) {
+    char used[1024] = {0};
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+        size_t slot = cmd_hash(seed, entries[i].name, strlen(entries[i].name)) & (slots - 1);
+        if (used[slot]) {
+            return 0;
+        }
+        used[slot] = 1;
+        slot_of[i] = slot;
+    }
+    return 1;
+}
+
+
+int main() {
+    size_t max_len = 0;
+    for (size_t i = 0; i < ENTRY_COUNT; i++) {
+        if (strlen(entries[i].name) > max_len) max_len = strlen(entries[i].name);
+    }
+
+    // a table twice the size of the set keeps the search short
+    size_t slots = 16;
+    while (slots < 2 * ENTRY_COUNT) slots *= 2;
+
+    int slot_of[ENTRY_COUNT];
+    uint32_t seed = 0;
+    while (!try_seed(seed, slots, slot_of)) {
+        if (++seed == GEN_MAX_SEEDS) {
+            seed = 0;
+            slots *= 2;
+            if (slots > 1024) {
+                fprintf(stderr, "gen_builtins: no perfect hash found\n");
+                return 1;
+            }
+        }
+    }
+
+    printf("/* Generated by gen_builtins from builtins.def; do not edit */\n\n");
+    printf("#define BUILTIN_SEED %uu\n", seed);
+    printf("#define BUILTIN_SLOTS %zu\n", slots);
+    printf("#define BUILTIN_MAX_LEN %zu\n\n", max_len);
+    printf("static const Builtin BUILTIN_TABLE[BUILTIN_SLOTS] = {\n");
+    for (size_t slot = 0; slot < slots; slot++) {
+        for (size_t i = 0; i < ENTRY_COUNT; i++) {
+            if ((size_t)slot_of[i] == slot) {
+                printf("    [%zu] = {\"%s\", %zu, %s, %s},\n", slot, entries[i].name, strlen(entries[i].name), entries[i].fn, entries[i].flags);
+            }
+        }
+    }
+    printf("};\n");
+    return 0;
+}
@@ -2,85 +2,183 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "io_helpers.h"
 
 
 // ===== Output helpers =====
 
+static OutBuf out_stdout = {.fd = STDOUT_FILENO, .buffered = 1};
+static OutBuf out_stderr = {.fd = STDERR_FILENO, .buffered = 1};
+
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+
+void out_flush(OutBuf *out) {
+    write_all(out->fd, out->buf, out->len);
+    out->len = 0;
+}
+
+
+void out_write(OutBuf *out, const char *buf, size_t len) {
+    if (!out->buffered) {
+        write_all(out->fd, buf, len);
+        return;
+    }
+    if (out->len + len > OUTPUT_BUF_SIZE) {
+        out_flush(out);
+        if (len >= OUTPUT_BUF_SIZE) {
+            write_all(out->fd, buf, len);   // too big to be worth copying
+            return;
+        }
+    }
+    memcpy(out->buf + out->len, buf, len);
+    out->len += len;
+}
+
+
+void display_set_buffered(int buffered) {
+    display_flush();
+    out_stdout.buffered = buffered;
+}
+
+
+void display_flush() {
+    out_flush(&out_stdout);
+    out_flush(&out_stderr);
+}
+
+
 /* Prereq: str is a NULL terminated string
  */
 void display_message(char *str) {
-    write(STDOUT_FILENO, str, strnlen(str, MAX_STR_LEN));
+    out_write(&out_stdout, str, strlen(str));
 }
 
 
-/* Prereq: pre_str, str are NULL terminated string
+/* Writes exactly len bytes of buf, which may contain NUL bytes
  */
-void display_error(char *pre_str, char *str) {
-    write(STDERR_FILENO, pre_str, strnlen(pre_str, MAX_STR_LEN));
-    write(STDERR_FILENO, str, strnlen(str, MAX_STR_LEN));
-    write(STDERR_FILENO, "\n", 1);
+void display_buffer(const char *buf, size_t len) {
+    out_write(&out_stdout, buf, len);
 }
 
 
-// ===== Input tokenizing =====
-
-/* Prereq: in_ptr points to a character buffer of size > MAX_STR_LEN
- * Return: number of bytes read
+/* Diagnostics that are not errors, e.g. timing reports. Ordered like
+ * display_error.
  */
-ssize_t get_input(char *in_ptr) {
-    int retval = read(STDIN_FILENO, in_ptr, MAX_STR_LEN+1); // Not a sanitizer issue since in_ptr is allocated as MAX_STR_LEN+1
-    int read_len = retval;
-    if (retval == -1) {
-        read_len = 0;
-    }
-    if (read_len > MAX_STR_LEN) {
-        read_len = 0;
-        retval = -1;
-        write(STDERR_FILENO, "ERROR: input line too long\n", strlen("ERROR: input line too long\n"));
-        int junk = 0;
-        while((junk = getchar()) != EOF && junk != '\n');
-    }
-    in_ptr[read_len] = '\0';
-    return retval;
+void display_stderr(char *str) {
+    out_flush(&out_stdout);
+    out_write(&out_stderr, str, strlen(str));
+    out_flush(&out_stderr);
 }
 
-/* Prereq: in_ptr is a string, tokens is of size >= len(in_ptr)
- * Warning: in_ptr is modified
- * Return: number of tokens.
+
+/* Prereq: pre_str, str are NULL terminated string
  */
-size_t tokenize_input(char *in_ptr, char **tokens, Var_Node* vars) {
-    
-    char *curr_ptr = strtok (in_ptr, DELIMITERS);
-    size_t token_count = 0;
-    size_t total_len = 0;
-    
-
-    while (curr_ptr != NULL) {
-        char *copy = strdup(curr_ptr);  
-        char *expanded = expand_vars(curr_ptr, vars);
-        size_t exp_len = strlen(expanded);
-
-        // truncate last token before MAX_STR_LEN is hit
-        if (total_len + exp_len > MAX_STR_LEN){
-            size_t rem = MAX_STR_LEN - total_len;
-            if (rem > 0) {
-                expanded[rem] = '\0';
-                tokens[token_count] = expanded;
-                total_len += rem;
-                token_count++;
+void display_error(char *pre_str, char *str) {
+    out_flush(&out_stdout);    // keep errors in order with earlier output
+    out_write(&out_stderr, pre_str, strlen(pre_str));
+    out_write(&out_stderr, str, strlen(str));
+    out_write(&out_stderr, "\n", 1);
+    out_flush(&out_stderr);
+}
+
+
+// ===== Line reading =====
+
+ssize_t read_line(LineReader *reader, char **line) {
+    size_t scanned = reader->start;
+    while (1) {
+        char *nl = reader->len > scanned ? memchr(reader->buf + scanned, '\n', reader->len - scanned) : NULL;
+        if (nl != NULL || (reader->eof && reader->len > reader->start)) {
+            size_t end = nl ? (size_t)(nl - reader->buf) : reader->len;
+            reader->buf[end] = '\0';
+            *line = reader->buf + reader->start;
+            ssize_t consumed = end - reader->start + (nl != NULL);
+            reader->start = end + (nl != NULL);
+            return consumed;
+        }
+        if (reader->eof) {
+            return 0;
+        }
+        scanned = reader->len;
+
+        // keep the partial line at the front and make room for another chunk
+        if (reader->start > 0) {
+            memmove(reader->buf, reader->buf + reader->start, reader->len - reader->start);
+            reader->len -= reader->start;
+            scanned -= reader->start;
+            reader->start = 0;
+        }
+        if (reader->cap - reader->len < LINE_READ_CHUNK + 1) {
+            size_t cap = reader->cap ? reader->cap : LINE_READ_CHUNK + 1;
+            while (cap - reader->len < LINE_READ_CHUNK + 1) {
+                cap *= 2;
+            }
+            char *buf = realloc(reader->buf, cap);
+            if (buf == NULL) {
+                return -1;
             }
-            free(copy);
-            break;
+            reader->buf = buf;
+            reader->cap = cap;
         }
 
-        tokens[token_count] = expanded;
-        total_len += exp_len;
-        token_count++;
-        curr_ptr = strtok(NULL, DELIMITERS);
-        free(copy);
+        if (reader->wake_fd > 0) {
+            struct pollfd fds[2] = {
+                {.fd = reader->fd, .events = POLLIN},
+                {.fd = reader->wake_fd, .events = POLLIN},
+            };
+            if (poll(fds, 2, -1) < 0) {
+                return -1;
+            }
+            if (fds[0].revents == 0) {
+                errno = EINTR;      // woken before any input
+                return -1;
+            }
+        }
+        ssize_t n = read(reader->fd, reader->buf + reader->len, reader->cap - reader->len - 1);
+        if (n < 0) {
+            return -1;      // EINTR too, so a signal can interrupt the prompt
+        }
+        if (n == 0) {
+            reader->eof = 1;
+        }
+        reader->len += n;
+    }
+}
+
+
+int line_reader_set_string(LineReader *reader, const char *str) {
+    size_t len = strlen(str);
+    char *buf = malloc(len + 1);
+    if (buf == NULL) {
+        return -1;
     }
-    tokens[token_count] = NULL;
-    return token_count;
+    memcpy(buf, str, len + 1);
+    free(reader->buf);
+    reader->fd = -1;
+    reader->buf = buf;
+    reader->start = 0;
+    reader->len = len;
+    reader->cap = len + 1;
+    reader->eof = 1;
+    return 0;
+}
+
+
+void line_reader_free(LineReader *reader) {
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->start = reader->len = reader->cap = 0;
 }
@@ -9,23 +9,70 @@
 #define DELIMITERS " \t\n"     // Assumption: all input tokens are whitespace delimited
 
 
-/* Prereq: pre_str, str are NULL terminated string
+#define OUTPUT_BUF_SIZE (64 * 1024)
+
+/* Output collected for one fd and written in OUTPUT_BUF_SIZE blocks. Flushed
+ * when full and at the shell's flush points: before a prompt waits for input,
+ * before anything else may write to the fd (fork, spawn, exit), and ahead of
+ * every error message.
+ */
+typedef struct {
+    int fd;
+    int buffered;       // 0 writes straight through
+    size_t len;
+    char buf[OUTPUT_BUF_SIZE];
+} OutBuf;
+
+void out_write(OutBuf *out, const char *buf, size_t len);
+void out_flush(OutBuf *out);
+
+
+/* stdout and stderr, through their OutBufs. Messages have no length cap.
+ * Prereq: pre_str, str are NULL terminated string
  */
 void display_message(char *str);
+void display_buffer(const char *buf, size_t len);
 void display_error(char *pre_str, char *str);
+void display_stderr(char *str);
+
+
+/* stdout is buffered by default; with buffered cleared every call is written
+ * at once (e.g. a chat server's live log). display_flush empties both buffers.
+ */
+void display_set_buffered(int buffered);
+void display_flush();
+
+
+#define LINE_READ_CHUNK (64 * 1024)
+
+/* Buffered reader over fd. Bytes past the current line are kept for the next
+ * call, and the buffer grows to fit lines of any length. When wake_fd is set
+ * (> 0), a read that would block waits on it too.
+ */
+typedef struct {
+    int fd;
+    int wake_fd;
+    char *buf;
+    size_t start;       // first byte not yet returned
+    size_t len;         // bytes buffered
+    size_t cap;
+    int eof;
+} LineReader;
 
 
-/* Prereq: in_ptr points to a character buffer of size > MAX_STR_LEN
- * Return: number of bytes read
+/* Reads the next line. *line points at it inside the reader, NUL terminated
+ * and without its '\n', valid until the next call.
+ * Return: bytes consumed (> 0), 0 at EOF, -1 on error (errno is set, EINTR
+ * if a signal arrived or wake_fd became readable)
  */
-ssize_t get_input(char *in_ptr);
+ssize_t read_line(LineReader *reader, char **line);
 
 
-/* Prereq: in_ptr is a string, tokens is of size >= len(in_ptr)
- * Warning: in_ptr is modified
- * Return: number of tokens.
+/* Makes reader return the lines of str, as if read from a file
+ * Return: 0 on success, -1 if memory ran out
  */
-size_t tokenize_input(char *in_ptr, char **tokens, Var_Node* vars);
+int line_reader_set_string(LineReader *reader, const char *str);
+void line_reader_free(LineReader *reader);
 
 
 #endif
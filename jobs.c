@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/wait.h>
+
+#include "jobs.h"
+#include "io_helpers.h"
+#include "stats.h"
+
+JobTable job_table = {.free_head = -1};
+
+static int notify_pipe[2] = {-1, -1};
+static volatile sig_atomic_t notified = 0;
+
+
+// ===== pid index =====
+
+static size_t pid_hash(pid_t pid) {
+    return (uint32_t)pid * 2654435761u;     // Knuth multiplicative
+}
+
+
+/* Return: the by_pid bucket holding pid, or the empty one where it belongs
+ * Prereq: by_pid_cap > 0
+ */
+static int *pid_bucket(pid_t pid) {
+    size_t mask = job_table.by_pid_cap - 1;
+    for (size_t i = pid_hash(pid) & mask; ; i = (i + 1) & mask) {
+        int slot = job_table.by_pid[i];
+        if (slot == -1 || job_table.jobs[slot].pid == pid) {
+            return &job_table.by_pid[i];
+        }
+    }
+}
+
+
+/* Return: 0 on success, -1 if memory ran out
+ */
+static int pid_index_grow() {
+    size_t cap = job_table.by_pid_cap ? job_table.by_pid_cap * 2 : 2 * JOBS_MIN_CAP;
+    int *buckets = malloc(cap * sizeof(int));
+    if (buckets == NULL) {
+        return -1;
+    }
+    memset(buckets, 0xff, cap * sizeof(int));
+    int *old = job_table.by_pid;
+    size_t old_cap = job_table.by_pid_cap;
+    job_table.by_pid = buckets;
+    job_table.by_pid_cap = cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (old[i] != -1) {
+            *pid_bucket(job_table.jobs[old[i]].pid) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+
+/* Drops pid's bucket and re-seats the rest of its probe run
+ */
+static void pid_index_remove(pid_t pid) {
+    int *bucket = pid_bucket(pid);
+    if (*bucket == -1) {
+        return;
+    }
+    *bucket = -1;
+    size_t mask = job_table.by_pid_cap - 1;
+    for (size_t i = (bucket - job_table.by_pid + 1) & mask; job_table.by_pid[i] != -1; i = (i + 1) & mask) {
+        int slot = job_table.by_pid[i];
+        job_table.by_pid[i] = -1;
+        *pid_bucket(job_table.jobs[slot].pid) = slot;
+    }
+}
+
+
+// ===== Job slots =====
+
+/* Return: 0 on success, -1 if memory ran out
+ */
+static int jobs_grow() {
+    size_t cap = job_table.cap ? job_table.cap * 2 : JOBS_MIN_CAP;
+    Job *jobs = realloc(job_table.jobs, cap * sizeof(Job));
+    if (jobs == NULL) {
+        return -1;
+    }
+    // only called with an empty free list, so the new slots become all of it
+    for (size_t i = job_table.cap; i < cap; i++) {
+        jobs[i].pid = 0;
+        jobs[i].job_id = i + 1;
+        jobs[i].next_free = i + 1 < cap ? (int)i + 1 : -1;
+    }
+    job_table.free_head = job_table.cap;
+    job_table.jobs = jobs;
+    job_table.cap = cap;
+    return 0;
+}
+
+
+Job *job_add(pid_t pid, const char *command) {
+    if (job_table.free_head == -1 && jobs_grow() == -1) {
+        return NULL;
+    }
+    if (2 * (job_table.count + 1) > job_table.by_pid_cap && pid_index_grow() == -1) {
+        return NULL;
+    }
+
+    int slot = job_table.free_head;
+    Job *job = &job_table.jobs[slot];
+    job_table.free_head = job->next_free;
+    job->pid = pid;
+    snprintf(job->command, MAX_CMD_LEN, "%s", command);
+    *pid_bucket(pid) = slot;
+    job_table.count++;
+    return job;
+}
+
+
+static void job_remove(Job *job) {
+    pid_index_remove(job->pid);
+    job->pid = 0;
+    int slot = job - job_table.jobs;
+    job->next_free = job_table.free_head;
+    job_table.free_head = slot;
+    job_table.count--;
+}
+
+
+// ===== Reaping =====
+
+int jobs_init() {
+    return pipe2(notify_pipe, O_NONBLOCK | O_CLOEXEC);
+}
+
+
+void jobs_free() {
+    free(job_table.jobs);
+    free(job_table.by_pid);
+    job_table = (JobTable){.free_head = -1};
+    if (notify_pipe[0] != -1) {
+        close(notify_pipe[0]);
+        close(notify_pipe[1]);
+        notify_pipe[0] = notify_pipe[1] = -1;
+    }
+}
+
+
+void jobs_notify() {
+    int saved = errno;
+    notified = 1;
+    if (notify_pipe[1] != -1) {
+        write(notify_pipe[1], "", 1);   // a full pipe already says the same
+    }
+    errno = saved;
+}
+
+
+int jobs_notify_fd() {
+    return notify_pipe[0];
+}
+
+
+int jobs_pending() {
+    return notified;
+}
+
+
+void jobs_reap(int report) {
+    if (!notified) {
+        return;
+    }
+    notified = 0;
+    char drain[64];
+    while (notify_pipe[0] != -1 && read(notify_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+
+    int status;
+    struct rusage usage;
+    pid_t pid;
+    while ((pid = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        stats_child(&usage);
+        if (job_table.count == 0) continue;
+        int slot = *pid_bucket(pid);
+        if (slot == -1) continue;   // not a job, e.g. the chat server
+
+        Job *job = &job_table.jobs[slot];
+        if (report) {
+            char message[MAX_CMD_LEN + 32];
+            snprintf(message, sizeof(message), "[%d]+ Done %s\n", job->job_id, job->command);
+            display_message(message);
+        }
+        job_remove(job);
+    }
+}
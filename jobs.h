@@ -0,0 +1,71 @@
+#ifndef __JOBS_H__
+#define __JOBS_H__
+
+#include <sys/types.h>
+#include <signal.h>
+
+
+#define MAX_CMD_LEN 100
+#define JOBS_MIN_CAP 16
+
+/* A background job. Free slots (pid 0) are chained through next_free.
+ */
+typedef struct {
+    pid_t pid;
+    int job_id;             // slot index + 1
+    int next_free;
+    char command[MAX_CMD_LEN];
+} Job;
+
+/* Background jobs: a growable slot array with a free list, so ids and slots
+ * are reused as jobs finish, and an open-addressing pid -> slot index (at
+ * most half full) so reaping never scans the table.
+ */
+typedef struct {
+    Job *jobs;
+    size_t cap;
+    size_t count;           // live jobs
+    int free_head;          // -1 when every slot up to cap is in use
+    int *by_pid;            // slot index, -1 when empty
+    size_t by_pid_cap;
+} JobTable;
+
+extern JobTable job_table;
+
+
+/* Sets up the self-pipe SIGCHLD reports through.
+ * Return: 0 on success, -1 on failure
+ */
+int jobs_init();
+void jobs_free();
+
+
+/* Return: the read end of the self-pipe, readable from the moment a child
+ * exits until the next jobs_reap, so a blocking wait can poll it
+ */
+int jobs_notify_fd();
+
+
+/* Records that a child exited. Async-signal-safe: called from the SIGCHLD
+ * handler, which leaves the waiting to jobs_reap.
+ */
+void jobs_notify();
+
+
+/* Return: 1 if a child exited since the last jobs_reap
+ */
+int jobs_pending();
+
+
+/* Reaps every exited child if jobs_notify ran since the last call, printing
+ * a notice per finished job when report is set
+ */
+void jobs_reap(int report);
+
+
+/* Adds pid, described by command (truncated to MAX_CMD_LEN)
+ * Return: the new job, or NULL if memory ran out
+ */
+Job *job_add(pid_t pid, const char *command);
+
+#endif
@@ -0,0 +1,256 @@
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <emmintrin.h>
+#endif
+
+#include "match.h"
+
+
+void matcher_init_all(Matcher *m) {
+    memset(m, 0, sizeof(Matcher));
+    m->kind = MATCH_ALL;
+}
+
+
+void matcher_free(Matcher *m) {
+    free(m->dfa);
+    free(m->accept);
+    matcher_init_all(m);
+}
+
+
+// ===== Substring =====
+
+void matcher_init_substr(Matcher *m, const char *needle) {
+    matcher_init_all(m);
+    m->kind = MATCH_SUBSTR;
+    m->needle = needle;
+    m->needle_len = strlen(needle);
+}
+
+
+/* Return: 1 if needle occurs in name at an offset in [from, len - n]
+ */
+static int substr_scalar(const char *name, size_t len, size_t from, const char *needle, size_t n) {
+    const char last = needle[n - 1];
+    while (from + n <= len) {
+        const char *hit = memchr(name + from, needle[0], len - n + 1 - from);
+        if (hit == NULL) {
+            return 0;
+        }
+        size_t i = hit - name;
+        if (name[i + n - 1] == last && memcmp(hit + 1, needle + 1, n - 1) == 0) {
+            return 1;
+        }
+        from = i + 1;
+    }
+    return 0;
+}
+
+
+static int substr_search(const char *name, size_t len, const char *needle, size_t n) {
+    if (n == 0) {
+        return 1;
+    }
+    if (n > len) {
+        return 0;
+    }
+    size_t i = 0;
+#if defined(__x86_64__)
+    // 16 candidate offsets per step: both end bytes must agree before memcmp
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[n - 1]);
+    for (; i + n - 1 + 16 <= len; i += 16) {
+        __m128i head = _mm_loadu_si128((const __m128i *)(name + i));
+        __m128i tail = _mm_loadu_si128((const __m128i *)(name + i + n - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(head, first), _mm_cmpeq_epi8(tail, last)));
+        while (mask != 0) {
+            unsigned bit = __builtin_ctz(mask);
+            if (memcmp(name + i + bit + 1, needle + 1, n - 1) == 0) {
+                return 1;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    return substr_scalar(name, len, i, needle, n);
+}
+
+
+// ===== Glob =====
+
+/* One pattern element: a byte set, or a star matching any run of bytes
+ */
+typedef struct {
+    int star;
+    uint64_t set[4];
+} GlobItem;
+
+#define set_add(item, c) ((item)->set[(unsigned char)(c) >> 6] |= 1ull << ((unsigned char)(c) & 63))
+#define set_has(item, c) (((item)->set[(unsigned char)(c) >> 6] >> ((unsigned char)(c) & 63)) & 1)
+
+
+/* Parses a [...] class starting at p[0] == '['. A class without its closing
+ * ']' is a literal '['.
+ * Return: bytes consumed
+ */
+static size_t glob_class(const char *p, GlobItem *item) {
+    size_t i = 1;
+    int negate = p[i] == '!' || p[i] == '^';
+    if (negate) i++;
+    size_t start = i;
+    while (p[i] != '\0' && (p[i] != ']' || i == start)) {
+        if (p[i] == '\\' && p[i + 1] != '\0') i++;
+        unsigned char lo = p[i], hi = p[i];
+        if (p[i + 1] == '-' && p[i + 2] != '\0' && p[i + 2] != ']') {
+            i += 2;
+            if (p[i] == '\\' && p[i + 1] != '\0') i++;
+            hi = p[i];
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            set_add(item, c);
+        }
+        i++;
+    }
+    if (p[i] != ']') {
+        memset(item->set, 0, sizeof(item->set));
+        set_add(item, '[');
+        return 1;
+    }
+    if (negate) {
+        for (int w = 0; w < 4; w++) {
+            item->set[w] = ~item->set[w];
+        }
+    }
+    return i + 1;
+}
+
+
+/* Return: number of items, or -1 if the pattern has too many
+ */
+static int glob_parse(const char *pattern, GlobItem *items) {
+    int count = 0;
+    for (const char *p = pattern; *p != '\0'; ) {
+        if (*p == '*' && count > 0 && items[count - 1].star) {
+            p++;    // ** is *
+            continue;
+        }
+        if (count == GLOB_MAX_ITEMS) {
+            return -1;
+        }
+        GlobItem *item = &items[count++];
+        memset(item, 0, sizeof(GlobItem));
+        if (*p == '*') {
+            item->star = 1;
+            p++;
+        } else if (*p == '?') {
+            memset(item->set, 0xff, sizeof(item->set));
+            p++;
+        } else if (*p == '[') {
+            p += glob_class(p, item);
+        } else {
+            if (*p == '\\' && p[1] != '\0') p++;
+            set_add(item, *p);
+            p++;
+        }
+    }
+    return count;
+}
+
+
+/* Adds the states reachable without input: a star may match nothing
+ */
+static uint64_t glob_closure(const GlobItem *items, int count, uint64_t states) {
+    for (int i = 0; i < count; i++) {
+        if ((states >> i & 1) && items[i].star) {
+            states |= 1ull << (i + 1);
+        }
+    }
+    return states;
+}
+
+
+static uint64_t glob_step(const GlobItem *items, int count, uint64_t states, unsigned char c) {
+    uint64_t next = 0;
+    for (int i = 0; i < count; i++) {
+        if (!(states >> i & 1)) continue;
+        if (items[i].star) {
+            next |= 1ull << i;
+        } else if (set_has(&items[i], c)) {
+            next |= 1ull << (i + 1);
+        }
+    }
+    return glob_closure(items, count, next);
+}
+
+
+/* Subset construction: NFA state i means "items before i are matched";
+ * state count is accepting. Each DFA state is one set of NFA states.
+ */
+int matcher_init_glob(Matcher *m, const char *pattern) {
+    matcher_init_all(m);
+    GlobItem items[GLOB_MAX_ITEMS];
+    int count = glob_parse(pattern, items);
+    if (count == -1) {
+        return -1;
+    }
+
+    uint64_t *sets = malloc(GLOB_MAX_STATES * sizeof(uint64_t));
+    m->dfa = malloc(GLOB_MAX_STATES * sizeof(*m->dfa));
+    m->accept = calloc(GLOB_MAX_STATES, 1);
+    if (sets == NULL || m->dfa == NULL || m->accept == NULL) {
+        free(sets);
+        matcher_free(m);
+        return -1;
+    }
+
+    sets[0] = 0;    // dead
+    sets[1] = glob_closure(items, count, 1);
+    size_t state_count = 2;
+    for (size_t s = 0; s < state_count; s++) {
+        m->accept[s] = sets[s] >> count & 1;
+        for (unsigned c = 0; c < 256; c++) {
+            uint64_t next = s == 0 ? 0 : glob_step(items, count, sets[s], c);
+            size_t t = 0;
+            while (t < state_count && sets[t] != next) {
+                t++;
+            }
+            if (t == state_count) {
+                if (state_count == GLOB_MAX_STATES) {
+                    free(sets);
+                    matcher_free(m);
+                    return -1;
+                }
+                sets[state_count++] = next;
+            }
+            m->dfa[s][c] = t;
+        }
+    }
+    free(sets);
+    m->state_count = state_count;
+    m->kind = MATCH_GLOB;
+    return 0;
+}
+
+
+static int glob_run(const Matcher *m, const char *name, size_t len) {
+    uint16_t state = 1;
+    for (size_t i = 0; i < len && state != 0; i++) {
+        state = m->dfa[state][(unsigned char)name[i]];
+    }
+    return m->accept[state];
+}
+
+
+int matcher_match(const Matcher *m, const char *name, size_t len) {
+    switch (m->kind) {
+    case MATCH_SUBSTR:
+        return substr_search(name, len, m->needle, m->needle_len);
+    case MATCH_GLOB:
+        return glob_run(m, name, len);
+    default:
+        return 1;
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef __MATCH_H__
+#define __MATCH_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+
+#define GLOB_MAX_ITEMS 63       // pattern elements; NFA states must fit a uint64_t
+#define GLOB_MAX_STATES 512     // DFA states
+
+typedef enum {
+    MATCH_ALL,          // no filter
+    MATCH_SUBSTR,       // name contains needle
+    MATCH_GLOB          // whole name matches a glob (*, ?, [set], \x)
+} MatchKind;
+
+/* A name filter compiled once and applied to every entry of a listing.
+ * Substrings are found by comparing the needle's first and last bytes
+ * against 16 positions at a time and only verifying where both agree.
+ * Globs run as a DFA: one table lookup per byte of the name.
+ */
+typedef struct {
+    MatchKind kind;
+
+    const char *needle;
+    size_t needle_len;
+
+    uint16_t (*dfa)[256];       // dfa[state][byte] -> state; state 0 is dead
+    uint8_t *accept;
+    size_t state_count;
+} Matcher;
+
+
+void matcher_init_all(Matcher *m);
+
+
+/* Prereq: needle outlives m
+ */
+void matcher_init_substr(Matcher *m, const char *needle);
+
+
+/* Return: 0 on success, -1 if the pattern is too large or memory ran out
+ */
+int matcher_init_glob(Matcher *m, const char *pattern);
+
+void matcher_free(Matcher *m);
+
+
+/* Return: 1 if name (len bytes) passes the filter
+ */
+int matcher_match(const Matcher *m, const char *name, size_t len);
+
+#endif
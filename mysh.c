@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,20 +6,25 @@
 #include <unistd.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <limits.h>
 
 #include "builtins.h"
 #include "io_helpers.h"
 #include "variables.h"
+#include "pathcache.h"
+#include "jobs.h"
+#include "stats.h"
+#include "ast.h"
+#include "functions.h"
 
-BackgroundJob background_jobs[MAX_JOBS];
-int job_count = 0;
-int running_jobs = 0;
+extern char **environ;
 
-void free_token_arr(char **tokens, size_t token_count){
-    for (size_t i = 0;i<token_count;i++){
-            free(tokens[i]);
-        }
-}
+int interactive = 0;    // reading commands from a terminal
+static int shell_exit = 0;  // set by exit: every running list stops
+static int last_status = 0; // of the last pipeline run, and the shell's exit status
 
 void concatenate_tokens(char **tokens, char *res){
     res[0] = '\0';
@@ -32,128 +38,302 @@ void concatenate_tokens(char **tokens, char *res){
     }
 }
 
-void execute_command(char **tokens, int is_background_task, size_t token_count, Var_Node *variables_ll){
-    // just in case
-    if (token_count == 0){
-        display_error("ERROR: Builtin failed: ", "");
-        return;
-    } 
-
-    // builtin commands
-    bn_ptr builtin_fn = check_builtin(tokens[0]);
-    if (builtin_fn != NULL) {
-        if (!is_background_task){ //foreground builtin
-            ssize_t err = builtin_fn(tokens);
-            if (err == - 1) {
-                display_error("ERROR: Builtin failed: ", tokens[0]);
+// ===== Redirections =====
+
+/* Opens cmd's redirection targets in order: fds[i] is what the fd of the
+ * i-th redirection is to become a copy of
+ * Return: 0 on success, -1 (reported, nothing left open) if one failed
+ */
+static int redirect_open(const Command *cmd, int *fds) {
+    size_t i = 0;
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next, i++) {
+        char *target = cmd->targets[i];
+        if (r->kind == REDIR_DUP) {
+            char *end;
+            long fd = strtol(target, &end, 10);
+            fds[i] = (int)fd;
+            if (*target != '\0' && *end == '\0' && fd >= 0 && fd <= 9 && fcntl(fds[i], F_GETFD) != -1) {
+                continue;
             }
-        } else { //background builtin
-            int pid = fork();
-            if (pid == 0){ //child
-                ssize_t err = builtin_fn(tokens);
-                if (err == - 1) {
-                    display_error("ERROR: Builtin failed: ", tokens[0]);
-                }
-                free_token_arr(tokens, token_count);
-                free_vars(variables_ll);
-                exit(0);
-        
-            } else if (pid > 0){ //parent
-                if (job_count < MAX_JOBS) {
-                    background_jobs[job_count].pid = pid;
-                    concatenate_tokens(tokens, background_jobs[job_count].command);
-                    background_jobs[job_count].job_id = job_count + 1;
-                    char message[MAX_STR_LEN];
-                    snprintf(message, MAX_STR_LEN, "[%d] %d\n", background_jobs[job_count].job_id, pid);
-                    display_message(message);
-                    job_count++;
-                    running_jobs++;
-                } else {
-                    display_error("ERROR: Too many background jobs", "");
-                }
-            } else {
-                display_error("ERROR: Fork failed", "");
+            display_error("ERROR: Bad file descriptor: ", target);
+        } else {
+            int flags = r->kind == REDIR_IN ? O_RDONLY : O_WRONLY | O_CREAT | (r->kind == REDIR_APPEND ? O_APPEND : O_TRUNC);
+            fds[i] = open(target, flags | O_CLOEXEC, 0666);
+            if (fds[i] >= 0) {
+                continue;
             }
+            display_error("ERROR: Cannot open: ", target);
         }
-        return;  
+        // undo the ones before
+        size_t opened = 0;
+        for (const Redirect *o = cmd->redirects; opened < i; o = o->next, opened++) {
+            if (o->kind != REDIR_DUP) close(fds[opened]);
+        }
+        return -1;
     }
+    return 0;
+}
 
 
-    // bin commands
-    int pid = fork();
-    if (pid == 0){ //child
+static void redirect_close(const Command *cmd, const int *fds) {
+    size_t i = 0;
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next, i++) {
+        if (r->kind != REDIR_DUP) close(fds[i]);
+    }
+}
 
-        execvp(tokens[0], tokens);
 
-        display_error("ERROR: Unknown command: ", tokens[0]);
-        free_token_arr(tokens, token_count);
-        free_vars(variables_ll);
-        exit(1);
-
-    } else if (pid > 0){ //parent
-        if (!is_background_task){ // foreground
-            int status;
-            waitpid(pid, &status, 0);
-        } else {    // background
-            if (job_count < MAX_JOBS) {
-                background_jobs[job_count].pid = pid;
-                concatenate_tokens(tokens, background_jobs[job_count].command);
-                background_jobs[job_count].job_id = job_count + 1;
-                char message[MAX_STR_LEN];
-                snprintf(message, MAX_STR_LEN, "[%d] %d\n", background_jobs[job_count].job_id, pid);
-                display_message(message);
-                job_count++;
-                running_jobs++;
-            } else {
-                display_error("ERROR: Too many background jobs", "");
-            }
-        }   
-    } else {
-        display_error("ERROR: Fork failed", "");
+/* Applies cmd's redirections to the shell itself, around a builtin or
+ * function. saved holds 2 ints per redirection for redirect_restore.
+ * Return: 0 on success, -1 if a target could not be opened
+ */
+static int redirect_apply(const Command *cmd, int *saved) {
+    int fds[cmd->redirect_count];
+    if (redirect_open(cmd, fds) < 0) {
+        return -1;
     }
+    display_flush();
+    size_t i = 0;
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next, i++) {
+        saved[2 * i] = r->fd;
+        saved[2 * i + 1] = fcntl(r->fd, F_DUPFD_CLOEXEC, 10);    // -1 if r->fd was not open
+        dup2(fds[i], r->fd);
+    }
+    redirect_close(cmd, fds);
+    return 0;
 }
 
-int is_background_command(char **tokens, size_t *token_count){
-    if (*token_count == 0){
-        return 0;
+
+static void redirect_restore(const Command *cmd, const int *saved) {
+    display_flush();
+    // last first, so an fd redirected twice ends up as it began
+    for (size_t i = cmd->redirect_count; i-- > 0; ) {
+        if (saved[2 * i + 1] >= 0) {
+            dup2(saved[2 * i + 1], saved[2 * i]);
+            close(saved[2 * i + 1]);
+        } else {
+            close(saved[2 * i]);
+        }
+    }
+}
+
+
+// ===== Running commands =====
+
+/* execvp's fallback for a program with neither a #! line nor a binary
+ * format the kernel knows: it runs as a /bin/sh script
+ * Return: 0, or posix_spawn's error
+ */
+static int spawn_script(pid_t *pid, char *path, char **tokens, size_t token_count,
+                        const posix_spawn_file_actions_t *actions, const posix_spawnattr_t *attr) {
+    char *argv[token_count + 2];
+    argv[0] = "/bin/sh";
+    argv[1] = path;
+    memcpy(argv + 2, tokens + 1, token_count * sizeof(char *));    // with the NULL
+    return posix_spawn(pid, "/bin/sh", actions, attr, argv, environ);
+}
+
+
+/* Starts cmd as an external program with stdin/stdout moved onto in_fd and
+ * out_fd (-1 keeps the shell's), then cmd's own redirections applied.
+ * posix_spawn launches without copying the shell's page tables, which fork
+ * pays for in full under ASan.
+ * Return: pid of the program, or -1 if it could not be started
+ */
+pid_t spawn_command(const Command *cmd, int in_fd, int out_fd){
+    char **tokens = cmd->tokens;
+    int fds[cmd->redirect_count + 1];
+    if (redirect_open(cmd, fds) < 0) {
+        return -1;
+    }
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+    }
+    size_t i = 0;
+    for (const Redirect *r = cmd->redirects; r != NULL; r = r->next, i++) {
+        posix_spawn_file_actions_adddup2(&actions, fds[i], r->fd);
+    }
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t no_signals;
+    sigemptyset(&no_signals);
+    posix_spawnattr_setsigmask(&attr, &no_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+    display_flush();
+    uint64_t start = stats_now();
+    pid_t pid;
+    char path[PATH_MAX];
+    int err = ENOENT;
+    if (path_lookup(tokens[0], path, sizeof(path)) == 0) {
+        err = posix_spawn(&pid, path, &actions, &attr, tokens, environ);
+        if (err == ENOENT && strchr(tokens[0], '/') == NULL) {
+            // cached binary went away: walk PATH again
+            path_forget(tokens[0]);
+            if (path_lookup(tokens[0], path, sizeof(path)) == 0) {
+                err = posix_spawn(&pid, path, &actions, &attr, tokens, environ);
+            }
+        }
+        if (err == ENOEXEC) {
+            err = spawn_script(&pid, path, tokens, cmd->token_count, &actions, &attr);
+        }
     }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    redirect_close(cmd, fds);
+
+    if (err != 0) {
+        // reported where the program's stderr would have gone
+        int saved[2 * cmd->redirect_count + 1];
+        int redirected = cmd->redirect_count > 0 && redirect_apply(cmd, saved) == 0;
+        display_error("ERROR: Unknown command: ", tokens[0]);
+        if (redirected) {
+            redirect_restore(cmd, saved);
+        }
+        return -1;
+    }
+    stats_event(&shell_stats.spawns, &shell_stats.spawn_ns, start);
+    return pid;
+}
 
-    if (strcmp(tokens[(*token_count) - 1], "&") == 0){
-        free(tokens[(*token_count) - 1]);
-        tokens[(*token_count) - 1] = NULL;
-        (*token_count)--;
+/* Waits for pid, riding out SIGCHLDs from background jobs, and accounts
+ * its resource usage
+ * Return: its exit status, 128 + the signal if one killed it
+ */
+static int wait_child(pid_t pid) {
+    int status;
+    struct rusage usage;
+    pid_t done;
+    while ((done = wait4(pid, &status, 0, &usage)) == -1 && errno == EINTR) {
+    }
+    if (done != pid) {
         return 1;
     }
+    stats_child(&usage);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
 
-    return 0;
+
+/* Records pid as a background job and announces it
+ */
+static void start_job(pid_t pid, char **tokens) {
+    char command[MAX_CMD_LEN];
+    concatenate_tokens(tokens, command);
+    Job *job = job_add(pid, command);
+    if (job == NULL) {
+        display_error("ERROR: Out of memory for job", "");
+        return;
+    }
+    char message[MAX_STR_LEN];
+    snprintf(message, MAX_STR_LEN, "[%d] %d\n", job->job_id, pid);
+    display_message(message);
 }
 
-void handler_sigint(__attribute__((unused)) int code){
-    display_message("\n");
+
+static int run_function(UserCommand *f, char **tokens, size_t token_count, VarTable *variables);
+
+
+/* Return: the status of builtin fn run on tokens, reporting a failure
+ */
+static int run_builtin(bn_ptr fn, char **tokens) {
+    if (fn(tokens) == -1) {
+        display_error("ERROR: Builtin failed: ", tokens[0]);
+        return 1;
+    }
+    return 0;
 }
 
-void handler_sigchld(__attribute__((unused)) int code){
-    int status;
-    int pid;
 
-    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
-        for (int i = 0; i < job_count; i++) {
-            if (background_jobs[i].pid == pid) {
-                char message[MAX_STR_LEN];
-                snprintf(message, MAX_STR_LEN, "[%d]+ Done %s\n", background_jobs[i].job_id, background_jobs[i].command);
-                display_message("\n");
-                display_message(message);
-                running_jobs--;
-                break;
+/* Runs cmd as a function, builtin or program, in that order of lookup.
+ * Functions and builtins see cmd's redirections applied to the shell.
+ * Return: its exit status (0 once a background job is started)
+ */
+int execute_command(Command *cmd, int is_background_task, VarTable *variables){
+    char **tokens = cmd->tokens;
+    // just in case
+    if (cmd->token_count == 0){
+        display_error("ERROR: Builtin failed: ", "");
+        return 1;
+    } 
+
+    UserCommand *function = function_find(tokens[0]);
+    bn_ptr builtin_fn = function == NULL ? check_builtin(tokens[0]) : NULL;
+
+    // bin commands
+    if (function == NULL && builtin_fn == NULL) {
+        pid_t pid = spawn_command(cmd, -1, -1);
+        if (pid < 0) {
+            return 127;
+        }
+        if (is_background_task) {
+            start_job(pid, tokens);
+            return 0;
+        }
+        return wait_child(pid);
+    }
+
+    // shell functions and builtin commands
+    int saved[2 * cmd->redirect_count + 1];
+    if (cmd->redirect_count > 0 && redirect_apply(cmd, saved) < 0) {
+        return 1;
+    }
+    int status = 0;
+    pid_t job_pid = 0;
+    if (!is_background_task) {
+        if (function != NULL) {
+            status = run_function(function, tokens, cmd->token_count, variables);
+        } else {
+            uint64_t start = stats_now();
+            status = run_builtin(builtin_fn, tokens);
+            stats_event(&shell_stats.builtins, &shell_stats.builtin_ns, start);
+        }
+    } else {
+        display_flush();
+        int pid = stats_fork();
+        if (pid == 0) { //child
+            if (function != NULL) {
+                status = run_function(function, tokens, cmd->token_count, variables);
+            } else {
+                status = run_builtin(builtin_fn, tokens);
             }
+            send_pool_close();
+            display_flush();
+            free_vars(variables);
+            exit(status);
+        } else if (pid > 0) { //parent
+            job_pid = pid;
+        } else {
+            display_error("ERROR: Fork failed", "");
+            status = 1;
         }
     }
+    if (cmd->redirect_count > 0) {
+        redirect_restore(cmd, saved);
+    }
+    if (job_pid > 0) {
+        start_job(job_pid, tokens);     // the notice goes to the shell's stdout, not the job's
+    }
+    return status;
+}
 
-    if (running_jobs == 0){
-        job_count = 0;
+// prompt redraws only make sense at a terminal. They bypass the output
+// buffer, which the interrupted code may be in the middle of filling.
+void handler_sigint(__attribute__((unused)) int code){
+    if (interactive) {
+        write(STDOUT_FILENO, "\n", 1);
     }
 }
 
+void handler_sigchld(__attribute__((unused)) int code){
+    jobs_notify();  // reaped from the main loop
+}
+
 void set_sigactions(){
     struct sigaction sa_int;
     sa_int.sa_handler = handler_sigint;
@@ -161,172 +341,577 @@ void set_sigactions(){
     sigemptyset(&sa_int.sa_mask);
     sigaction(SIGINT, &sa_int, NULL);
 
+    // the main loop polls the self-pipe, so nothing needs interrupting
     struct sigaction sa_chld;
     sa_chld.sa_handler = handler_sigchld;
-    sa_chld.sa_flags = 0;
+    sa_chld.sa_flags = SA_RESTART;
     sigemptyset(&sa_chld.sa_mask);
     sigaction(SIGCHLD, &sa_chld, NULL);
 }
 
 
-typedef struct {
-    char **tokens;
-    size_t token_count;
-} Command;
+/* Runs a builtin stage inside the shell with stdin/stdout moved onto in_fd
+ * and out_fd (-1 keeps the shell's), then puts the shell's fds back. SIGPIPE
+ * is ignored meanwhile so a reader that quits early cannot kill the shell, and
+ * SIGCHLD is held off so an earlier stage exiting cannot cut a read short.
+ * Return: the stage's exit status
+ */
+static int run_stage_in_process(Command *cmd, int in_fd, int out_fd, VarTable *variables) {
+    display_flush();
+    int saved_in = -1, saved_out = -1;
+    if (in_fd >= 0) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+        dup2(out_fd, STDOUT_FILENO);
+    }
+    struct sigaction ignore, old_pipe;
+    ignore.sa_handler = SIG_IGN;
+    ignore.sa_flags = 0;
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, &old_pipe);
+    sigset_t chld, old_mask;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &old_mask);
+
+    int status = execute_command(cmd, 0, variables);
+    display_flush();
+
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    sigaction(SIGPIPE, &old_pipe, NULL);
+    if (saved_out >= 0) {
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    if (saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    return status;
+}
 
 
-void execute_pipeline(Command *commands, size_t num_commands, Var_Node *variables_ll) {
-    int pipes[2];
-    int prev_pipe_read = -1;
-    int pids[num_commands];
+/* Every pipe is opened first. External stages are spawned straight onto their
+ * pipe ends; builtin stages fork, except one safe builtin (the last one) that
+ * runs in the shell itself once every other stage is already running, so it
+ * can neither stall on a full pipe nor starve a reader.
+ * Return: the exit status of the last stage
+ */
+int execute_pipeline(Command *commands, size_t num_commands, VarTable *variables) {
+    int fds[2 * num_commands];     // stage i reads fds[2i] and writes fds[2i + 1]
+    pid_t pids[num_commands];
+
+    // Close-on-exec keeps stray pipe ends out of spawned stages, so readers
+    // still see EOF.
+    fds[0] = -1;
+    fds[2 * num_commands - 1] = -1;
+    for (size_t i = 0; i + 1 < num_commands; i++) {
+        int pipes[2];
+        if (pipe2(pipes, O_CLOEXEC) < 0) {
+            display_error("ERROR: pipe() failed", "");
+            for (size_t j = 1; j < 2 * i + 1; j++) {
+                close(fds[j]);
+            }
+            return 1;
+        }
+        fds[2 * i + 1] = pipes[1];
+        fds[2 * i + 2] = pipes[0];
+    }
+
+    ssize_t in_process = -1;
+    for (size_t i = num_commands; i-- > 0; ) {
+        Command *cmd = &commands[i];
+        // a function shadowing a builtin always gets a stage of its own
+        if (cmd->token_count > 0 && function_find(cmd->tokens[0]) == NULL && builtin_in_process(cmd->tokens, i > 0)) {
+            in_process = i;
+            break;
+        }
+    }
 
     for (size_t i = 0; i < num_commands; i++) {
-        // Create new pipe if not last command
-        if (i < num_commands - 1) {
-            if (pipe(pipes) < 0) {
-                display_error("ERROR: pipe() failed", "");
-                return;
-            }
+        Command *cmd = &commands[i];
+        int in_fd = fds[2 * i], out_fd = fds[2 * i + 1];
+        pids[i] = -1;
+        if ((ssize_t)i == in_process) {
+            continue;
         }
 
-        pids[i] = fork();
-        if (pids[i] == 0) { // CHILD
-            // in from prev child
-            if (prev_pipe_read != -1) {
-                dup2(prev_pipe_read, STDIN_FILENO);
-                close(prev_pipe_read);
-            }
+        if (cmd->token_count > 0 && check_builtin(cmd->tokens[0]) == NULL && function_find(cmd->tokens[0]) == NULL) {
+            // external stage: no shell copy needed
+            pids[i] = spawn_command(cmd, in_fd, out_fd);
+        } else {
+            display_flush();
+            pids[i] = stats_fork();
+            if (pids[i] == 0) { // CHILD
+                if (in_fd != -1) {
+                    dup2(in_fd, STDIN_FILENO);
+                }
+                if (out_fd != -1) {
+                    dup2(out_fd, STDOUT_FILENO);
+                }
+                // drop the pipe ends the shell still holds (this stage's, later
+                // stages', the in-process stage's) so their readers see EOF
+                for (size_t j = 0; j < num_commands; j++) {
+                    if (j < i && (ssize_t)j != in_process) continue;
+                    if (fds[2 * j] != -1) close(fds[2 * j]);
+                    if (fds[2 * j + 1] != -1) close(fds[2 * j + 1]);
+                }
 
-            // write to next command, only if not last command
-            if (i < num_commands - 1) {
-                close(pipes[0]);
-                dup2(pipes[1], STDOUT_FILENO);
-                close(pipes[1]);
+                // command exec
+                int status = execute_command(cmd, 0, variables);
+                send_pool_close();
+                display_flush();
+                exit(status);
+            } else if (pids[i] < 0) {
+                display_error("ERROR: fork() failed", "");
             }
+        }
 
-            // command exec
-            execute_command(commands[i].tokens, 0, commands[i].token_count, variables_ll);
-            exit(0);
-            
-        } else if (pids[i] > 0) { //PARENT
-            // close previous pipe read end (not needed in parent)
-            if (prev_pipe_read != -1) {
-                close(prev_pipe_read);
-            }
+        // PARENT: this stage's pipe ends now live in the child only
+        if (in_fd != -1) {
+            close(in_fd);
+        }
+        if (out_fd != -1) {
+            close(out_fd);
+        }
+    }
 
-            // save read end for next command
-            if (i < num_commands - 1) {
-                prev_pipe_read = pipes[0];
-                close(pipes[1]); // close write end 
-            }
-        } else {
-            display_error("ERROR: fork() failed", "");
-            return;
+    int status = 127;     // the last stage could not be started
+    if (in_process >= 0) {
+        int in_fd = fds[2 * in_process], out_fd = fds[2 * in_process + 1];
+        int in_process_status = run_stage_in_process(&commands[in_process], in_fd, out_fd, variables);
+        if ((size_t)in_process == num_commands - 1) {
+            status = in_process_status;
+        }
+        if (in_fd != -1) {
+            close(in_fd);
+        }
+        if (out_fd != -1) {
+            close(out_fd);
         }
     }
 
     // wait for children
     for (size_t i = 0; i < num_commands; i++) {
-        waitpid(pids[i], NULL, 0);
+        if (pids[i] > 0) {
+            int child_status = wait_child(pids[i]);
+            if (i == num_commands - 1) {
+                status = child_status;
+            }
+        }
     }
+    return status;
 }
 
 
-int main(__attribute__((unused)) int argc, 
-         __attribute__((unused)) char* argv[]) {
+// ===== Lists, functions and aliases =====
 
-    set_sigactions();
-    char *prompt = "mysh$ ";
+/* Return: cmd with a leading alias swapped for the alias's words, in
+ * *aliased (which borrows cmd's other tokens and its redirections), or cmd
+ * itself
+ */
+static Command *apply_alias(Command *cmd, Command *aliased, VarTable *variables) {
+    UserCommand *alias = cmd->token_count > 0 ? alias_find(cmd->tokens[0]) : NULL;
+    if (alias == NULL) {
+        return cmd;
+    }
+    if (ast_expand(alias->words, variables, NULL, 0, cmd->tokens + 1, aliased) < 0) {
+        display_error("ERROR: Out of memory", "");
+        return cmd;
+    }
+    aliased->redirects = cmd->redirects;
+    aliased->targets = cmd->targets;
+    aliased->redirect_count = cmd->redirect_count;
+    return aliased;
+}
 
-    char input_buf[MAX_STR_LEN + 1];
-    input_buf[MAX_STR_LEN] = '\0';
-    char *token_arr[MAX_STR_LEN] = {NULL};
 
-    Var_Node *variables_ll = NULL;
-        
-    while (1) {
-        display_message(prompt);
+/* Runs one expanded command: exit, NAME=VALUE, redirections alone, or
+ * anything execute_command runs
+ * Return: its exit status
+ */
+static int run_simple(Command *cmd, int background, VarTable *variables) {
+    Command aliased = {0};
+    cmd = apply_alias(cmd, &aliased, variables);
+
+    int status = 0;
+    if (cmd->token_count == 0) {
+        // redirections alone still create (or truncate) their files, as in sh
+        if (cmd->redirect_count > 0) {
+            int fds[cmd->redirect_count];
+            if (redirect_open(cmd, fds) < 0) {
+                status = 1;
+            } else {
+                redirect_close(cmd, fds);
+            }
+        }
+    } else if (strcmp("exit", cmd->tokens[0]) == 0) {
+        shell_exit = 1;
+        status = cmd->token_count > 1 ? atoi(cmd->tokens[1]) & 0xff : last_status;
+    } else {
+        //check for var creation
+        int assigned = assign_var(variables, cmd->tokens[0], cmd->token_count);
+        if (assigned < 0) {
+            display_error("ERROR: Out of memory for variable: ", cmd->tokens[0]);
+            status = 1;
+        } else if (assigned == 0) {
+            status = execute_command(cmd, background, variables);
+        }
+    }
+    command_free(&aliased);
+    return status;
+}
+
+
+/* Stores a NAME() { ... } definition; its body is parsed again into the
+ * function's own arena, since the tree it came from dies with its line
+ * Return: 0, or 1 if it was rejected
+ */
+static int define_function(const FunctionDef *def) {
+    char *name = strndup(def->name, def->name_len);
+    if (name == NULL) {
+        display_error("ERROR: Out of memory", "");
+        return 1;
+    }
+    int err = 1;
+    if (!user_valid_name(def->name, def->name_len)) {
+        display_error("ERROR: Invalid function name: ", name);
+    } else {
+        err = function_define(name, def->body, def->body_len);
+        if (err != 0) {
+            display_error("ERROR: Out of memory for function: ", name);
+        }
+    }
+    free(name);
+    return err == 0 ? 0 : 1;
+}
+
+
+/* Expands and runs each stage of pipeline; $1.. come from args. A single
+ * command may run in the background; longer background lists fork first.
+ * Return: the pipeline's exit status
+ */
+static int run_pipeline(const Pipeline *pipeline, int background, VarTable *variables, char **args, size_t arg_count) {
+    const SimpleCommand *stage = pipeline->stages;
+    if (stage->function != NULL) {
+        return define_function(stage->function);
+    }
+
+    size_t n = pipeline->stage_count;
+    Command expanded[n], aliased[n], ready[n];
+    memset(expanded, 0, sizeof(expanded));
+    memset(aliased, 0, sizeof(aliased));
+    size_t i = 0;
+    for (; stage != NULL; stage = stage->next, i++) {
+        if (ast_expand(stage, variables, args, arg_count, NULL, &expanded[i]) < 0) break;
+    }
 
-        int ret = get_input(input_buf);
-        if (strcmp(input_buf, "\n") == 0) {
+    int status = 1;
+    if (i < n) {
+        display_error("ERROR: Out of memory", "");
+    } else if (n == 1) {
+        status = run_simple(&expanded[0], background, variables);
+    } else {
+        for (i = 0; i < n; i++) {
+            ready[i] = *apply_alias(&expanded[i], &aliased[i], variables);
+        }
+        status = execute_pipeline(ready, n, variables);
+    }
+
+    for (i = 0; i < n; i++) {
+        command_free(&aliased[i]);
+        command_free(&expanded[i]);
+    }
+    return status;
+}
+
+
+/* Runs item's pipelines, each as its && or || allows
+ * Return: the status of the last one run
+ */
+static int run_and_or(const AndOr *item, int background, VarTable *variables, char **args, size_t arg_count) {
+    int status = 0;
+    for (const Pipeline *p = item->pipelines; p != NULL && !shell_exit; p = p->next) {
+        if ((p->join == JOIN_AND && status != 0) || (p->join == JOIN_OR && status == 0)) {
             continue;
         }
+        TimeMark mark = {0};    // zeroed only to quiet -Wmaybe-uninitialized under LTO
+        if (p->timed) stats_time_begin(&mark);
+        status = run_pipeline(p, background, variables, args, arg_count);
+        if (p->timed) stats_time_report(&mark);
+        last_status = status;
+    }
+    return status;
+}
 
-        // input with pipes
-        if (strchr(input_buf, '|') != NULL) {
-            char input_copy[MAX_STR_LEN];
-            strncpy(input_copy, input_buf, MAX_STR_LEN);
 
-            Command commands[MAX_STR_LEN] = {0};
-            size_t num_commands = 0;
-            
-            // count commands
-            char *count_ptr = input_copy;
-            while (*count_ptr && num_commands < MAX_STR_LEN) {
-                if (*count_ptr == '|') num_commands++;
-                count_ptr++;
-            }
-            num_commands++;
-            
-            char *saveptr;
-            char *cmd_str = strtok_r(input_buf, "|", &saveptr);
-            for (size_t i = 0; cmd_str && i < num_commands; i++) {
-                while (*cmd_str == ' ') cmd_str++; // trim whitespace
-                char *end = cmd_str + strlen(cmd_str) - 1;
-                while (end > cmd_str && *end == ' ') end--;
-                *(end+1) = '\0';
-                
-                commands[i].tokens = malloc(MAX_STR_LEN * sizeof(char*));
-                commands[i].token_count = tokenize_input(cmd_str, commands[i].tokens, variables_ll);
-                
-                cmd_str = strtok_r(NULL, "|", &saveptr);
+/* Runs item in a forked copy of the shell, as one job
+ */
+static void run_background(const AndOr *item, VarTable *variables, char **args, size_t arg_count) {
+    display_flush();
+    pid_t pid = stats_fork();
+    if (pid == 0) { //child
+        int status = run_and_or(item, 0, variables, args, arg_count);
+        send_pool_close();
+        display_flush();
+        free_vars(variables);
+        exit(status);
+    } else if (pid < 0) {
+        display_error("ERROR: Fork failed", "");
+        return;
+    }
+    char command[MAX_CMD_LEN];
+    snprintf(command, sizeof(command), "%.*s", (int)item->len, item->text);
+    char *tokens[] = {command, NULL};
+    start_job(pid, tokens);
+}
+
+
+/* Runs list item by item until it ends or exit runs
+ * Return: the status of the last item
+ */
+static int run_list(const AndOr *list, VarTable *variables, char **args, size_t arg_count) {
+    int status = 0;
+    for (const AndOr *item = list; item != NULL && !shell_exit; item = item->next) {
+        if (!item->background) {
+            status = run_and_or(item, 0, variables, args, arg_count);
+        } else if (item->pipelines->next == NULL && item->pipelines->stage_count == 1 && !item->pipelines->timed) {
+            // a lone command goes to the background itself, mostly without a fork;
+            // a timed one forks so the report waits for it
+            status = run_and_or(item, 1, variables, args, arg_count);
+        } else {
+            run_background(item, variables, args, arg_count);
+            status = 0;
+        }
+    }
+    return status;
+}
+
+
+/* Runs f's parsed body with tokens as its arguments: $1.. are tokens[1..],
+ * $# their count, $@ all of them. Nothing is parsed again; only the
+ * variable parts of each command are expanded.
+ * Return: the status of the body's last command
+ */
+static int run_function(UserCommand *f, char **tokens, size_t token_count, VarTable *variables) {
+    static int depth = 0;
+    if (depth == FUNC_MAX_DEPTH) {
+        display_error("ERROR: Function nesting too deep: ", tokens[0]);
+        return 1;
+    }
+    depth++;
+    user_retain(f);     // the body may redefine f
+
+    int status = run_list(f->body, variables, tokens, token_count);
+
+    user_release(f);
+    depth--;
+    return status;
+}
+
+
+// ===== Reading commands =====
+
+/* Grows *buf to hold need bytes
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int reserve_buf(char **buf, size_t *cap, size_t need) {
+    if (need <= *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap : MAX_STR_LEN;
+    while (new_cap < need) {
+        new_cap *= 2;
+    }
+    char *grown = realloc(*buf, new_cap);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buf = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+
+/* Reports a parse error at offset at of text
+ */
+static void show_parse_error(int err, const char *text, size_t len, size_t at) {
+    if (err == PARSE_NO_MEMORY) {
+        display_error("ERROR: Out of memory", "");
+        return;
+    }
+    char near[32];
+    size_t span = 0;
+    while (at + span < len && span < sizeof(near) - 1 && strchr(" \t\n", text[at + span]) == NULL &&
+           (span == 0 || strchr("|&;<>()", text[at + span]) == NULL)) {
+        span++;
+    }
+    snprintf(near, sizeof(near), "%.*s", (int)span, text + at);
+    display_error("ERROR: Syntax error near: ", span > 0 ? near : "end of line");
+}
+
+
+/* Parses the command that starts on line, reading more lines while it is
+ * incomplete (an open quote or brace, a trailing | && ||). A one-line
+ * command is parsed where it lies; longer ones are gathered in *buf.
+ * Return: 0 with the tree in *list (valid until the next line is read), or
+ * a PARSE_* error, already reported
+ */
+static int parse_command_line(LineReader *input, char *line, Arena *arena, char **buf, size_t *cap, AndOr **list) {
+    const char *text = line;
+    size_t len = strlen(line);
+    while (1) {
+        arena_reset(arena);
+        size_t error_at;
+        uint64_t start = stats_now();
+        int err = ast_parse(arena, text, len, list, &error_at);
+        stats_event(&shell_stats.parses, &shell_stats.parse_ns, start);
+        if (err != PARSE_INCOMPLETE) {
+            if (err != 0) {
+                show_parse_error(err, text, len, error_at);
             }
+            return err;
+        }
 
-            execute_pipeline(commands, num_commands, variables_ll);
-        
-            for (size_t i = 0; i < num_commands; i++) {
-                free_token_arr(commands[i].tokens, commands[i].token_count);
-                free(commands[i].tokens);
+        // line is only valid until the next read: move it first
+        if (text == line) {
+            if (reserve_buf(buf, cap, len + 1) < 0) {
+                show_parse_error(PARSE_NO_MEMORY, text, len, 0);
+                return PARSE_NO_MEMORY;
             }
-            continue;
+            memcpy(*buf, line, len);
+        }
+        if (interactive) {
+            display_message("> ");
+            display_flush();
         }
+        char *more;
+        ssize_t ret;
+        while ((ret = read_line(input, &more)) < 0 && errno == EINTR) {
+            int notices = interactive && jobs_pending();
+            if (notices) {
+                display_message("\n");
+            }
+            jobs_reap(interactive);     // empties the self-pipe read_line polls
+            if (notices) {
+                display_message("> ");
+                display_flush();
+            }
+        }
+        if (ret <= 0) {
+            display_error("ERROR: Syntax error: unexpected end of input", "");
+            return PARSE_SYNTAX;
+        }
+        size_t more_len = strlen(more);
+        if (reserve_buf(buf, cap, len + more_len + 2) < 0) {
+            show_parse_error(PARSE_NO_MEMORY, text, len, 0);
+            return PARSE_NO_MEMORY;
+        }
+        (*buf)[len++] = '\n';
+        memcpy(*buf + len, more, more_len);
+        len += more_len;
+        text = *buf;
+    }
+}
 
-        size_t token_count = tokenize_input(input_buf, token_arr, variables_ll);
 
-        // Clean exit
-        if (ret != -1 && (token_count == 0 || (strncmp("exit", token_arr[0], 5) == 0))) {
-            if (token_count == 0){
-                display_message("\n");  // for ctrl + d
-            }
-            free_token_arr(token_arr, token_count);
-            break;
+/* Usage: mysh [FILE | -c COMMANDS]
+ * With FILE or -c, or when stdin is not a terminal, commands run without a
+ * prompt and stdout is only flushed when full or when another process is
+ * about to write to it.
+ */
+int main(int argc, char* argv[]) {
+
+    if (jobs_init() == -1) {
+        display_error("ERROR: Cannot set up job control", "");
+        return 1;
+    }
+    set_sigactions();
+    char *prompt = "mysh$ ";
+
+    LineReader input = {.fd = STDIN_FILENO, .wake_fd = jobs_notify_fd()};
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            display_error("ERROR: -c needs a command string", "");
+            return 2;
+        }
+        if (line_reader_set_string(&input, argv[2]) < 0) {
+            display_error("ERROR: Out of memory", "");
+            return 1;
         }
+    } else if (argc > 1) {
+        input.fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (input.fd < 0) {
+            display_error("ERROR: Cannot open script: ", argv[1]);
+            return 1;
+        }
+    } else {
+        interactive = isatty(STDIN_FILENO);
+    }
+    Arena line_arena = {0};     // the current line's tree
+    char *pending = NULL;       // a command spread over several lines
+    size_t pending_cap = 0;
 
-        int background_task = is_background_command(token_arr, &token_count);
+    VarTable variables = {0};
+    uint64_t line_start = 0;    // 0 when no line is in progress
+        
+    while (1) {
+        if (line_start != 0) {
+            stats_line(line_start);
+            line_start = 0;
+        }
+        jobs_reap(interactive);     // job notices only make sense at a terminal
+        if (interactive) {
+            display_message(prompt);
+            display_flush();    // everything so far shows before we wait on the user
+        }
 
-        //check for var creation
-        Var_Node *var = make_var_node(token_arr[0], token_count);
-        if (var!=NULL){
-            if (variables_ll == NULL){
-                variables_ll = var;
-            } else{
-                var->next = variables_ll;
-                variables_ll = var;
+        char *input_buf;
+        ssize_t ret = read_line(&input, &input_buf);
+        if (ret < 0 && errno == EINTR) {
+            if (interactive && jobs_pending()) {
+                display_message("\n");     // notices start below the prompt
             }
-            free_token_arr(token_arr, token_count);
             continue;
         }
-
-        // Command execution
-        if (token_count >= 1) {
-            execute_command(token_arr, background_task, token_count, variables_ll);
+        // Clean exit on ctrl + d
+        if (ret <= 0) {
+            if (interactive) {
+                display_message("\n");
+            }
+            break;
         }
+        line_start = stats_now();
 
-        free_token_arr(token_arr, token_count);
+        AndOr *list;
+        if (parse_command_line(&input, input_buf, &line_arena, &pending, &pending_cap, &list) != 0) {
+            last_status = 2;    // as sh does for a syntax error
+            continue;
+        }
+        last_status = run_list(list, &variables, NULL, 0);
+        if (shell_exit) {
+            break;
+        }
     }
     
-    free_vars(variables_ll);
-    return 0;
+    if (line_start != 0) {
+        stats_line(line_start);
+    }
+    stats_dump_env();
+    send_pool_close();
+    display_flush();
+    arena_free(&line_arena);
+    free(pending);
+    if (input.fd > STDIN_FILENO) {
+        close(input.fd);
+    }
+    line_reader_free(&input);
+    free_vars(&variables);
+    path_cache_free();
+    user_commands_free();
+    jobs_free();
+    return last_status;
 }
-
-
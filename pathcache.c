@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "pathcache.h"
+#include "io_helpers.h"
+#include "cmdhash.h"
+
+static PathCache path_cache;
+
+
+// ===== Hash table =====
+
+static uint32_t path_hash(const char *name) {
+    return cmd_hash(0, name, strlen(name));
+}
+
+
+/* Prereq: path_cache.slot_cap > 0
+ * Return: the entry for name, or the empty slot where it belongs
+ */
+static PathEntry *path_slot(const char *name) {
+    size_t mask = path_cache.slot_cap - 1;
+    for (size_t i = path_hash(name) & mask; ; i = (i + 1) & mask) {
+        PathEntry *entry = &path_cache.slots[i];
+        if (entry->name == NULL || strcmp(entry->name, name) == 0) {
+            return entry;
+        }
+    }
+}
+
+
+/* Doubles the slot array and rehashes every entry
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int path_grow() {
+    size_t cap = path_cache.slot_cap ? path_cache.slot_cap * 2 : PATH_CACHE_MIN_SLOTS;
+    PathEntry *slots = calloc(cap, sizeof(PathEntry));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < path_cache.slot_cap; i++) {
+        PathEntry *old = &path_cache.slots[i];
+        if (old->name == NULL) continue;
+        size_t j = path_hash(old->name) & (cap - 1);
+        while (slots[j].name != NULL) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = *old;
+    }
+    free(path_cache.slots);
+    path_cache.slots = slots;
+    path_cache.slot_cap = cap;
+    return 0;
+}
+
+
+/* Remembers that name lives at path. Failure to allocate only costs the
+ * next lookup a PATH walk.
+ */
+static void path_insert(const char *name, const char *path) {
+    if (2 * (path_cache.count + 1) > path_cache.slot_cap && path_grow() == -1) {
+        return;
+    }
+    PathEntry *entry = path_slot(name);
+    char *name_copy = strdup(name);
+    char *path_copy = strdup(path);
+    if (name_copy == NULL || path_copy == NULL) {
+        free(name_copy);
+        free(path_copy);
+        return;
+    }
+    entry->name = name_copy;
+    entry->path = path_copy;
+    entry->hits = 1;
+    path_cache.count++;
+}
+
+
+void path_forget(const char *name) {
+    if (path_cache.count == 0) {
+        return;
+    }
+    PathEntry *entry = path_slot(name);
+    if (entry->name == NULL) {
+        return;
+    }
+    free(entry->name);
+    free(entry->path);
+    entry->name = NULL;
+    path_cache.count--;
+
+    // re-seat the rest of the probe run so later lookups still find it
+    size_t mask = path_cache.slot_cap - 1;
+    for (size_t i = (entry - path_cache.slots + 1) & mask; path_cache.slots[i].name != NULL; i = (i + 1) & mask) {
+        PathEntry moved = path_cache.slots[i];
+        path_cache.slots[i].name = NULL;
+        *path_slot(moved.name) = moved;
+    }
+}
+
+
+void path_cache_clear() {
+    for (size_t i = 0; i < path_cache.slot_cap; i++) {
+        PathEntry *entry = &path_cache.slots[i];
+        if (entry->name == NULL) continue;
+        free(entry->name);
+        free(entry->path);
+        entry->name = NULL;
+    }
+    path_cache.count = 0;
+}
+
+
+// ===== Invalidation =====
+
+static void path_dirs_free() {
+    for (size_t i = 0; i < path_cache.dir_count; i++) {
+        free(path_cache.dirs[i].dir);
+    }
+    free(path_cache.dirs);
+    free(path_cache.path_env);
+    path_cache.dirs = NULL;
+    path_cache.dir_count = 0;
+    path_cache.path_env = NULL;
+}
+
+
+/* Return: 1 if dir's mtime (or existence) differs from what was recorded
+ */
+static int path_dir_stat(PathDir *dir) {
+    struct stat st;
+    int missing = stat(dir->dir, &st) == -1;
+    int changed = missing != dir->missing ||
+        (!missing && (st.st_mtim.tv_sec != dir->mtime.tv_sec || st.st_mtim.tv_nsec != dir->mtime.tv_nsec));
+    dir->missing = missing;
+    if (!missing) {
+        dir->mtime = st.st_mtim;
+    }
+    return changed;
+}
+
+
+/* Splits path_env into its absolute directories and records their mtimes.
+ * Relative entries are skipped: what they name changes with the cwd.
+ */
+static void path_dirs_load(const char *path_env) {
+    path_dirs_free();
+    path_cache.path_env = strdup(path_env);
+    size_t count = 1;
+    for (const char *c = path_env; *c != '\0'; c++) {
+        count += *c == ':';
+    }
+    path_cache.dirs = calloc(count, sizeof(PathDir));
+    if (path_cache.path_env == NULL || path_cache.dirs == NULL) {
+        path_dirs_free();
+        return;
+    }
+
+    for (const char *start = path_env; ; ) {
+        const char *end = strchrnul(start, ':');
+        if (*start == '/') {
+            PathDir *dir = &path_cache.dirs[path_cache.dir_count];
+            dir->dir = strndup(start, end - start);
+            if (dir->dir != NULL) {
+                path_dir_stat(dir);
+                path_cache.dir_count++;
+            }
+        }
+        if (*end == '\0') break;
+        start = end + 1;
+    }
+}
+
+
+/* Clears the cache if PATH changed, or, at most every PATH_CACHE_RECHECK_MS,
+ * if any PATH directory was modified since the last check.
+ */
+static void path_validate(const char *path_env) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (path_cache.path_env == NULL || strcmp(path_cache.path_env, path_env) != 0) {
+        path_cache_clear();
+        path_dirs_load(path_env);
+        path_cache.checked = now;
+        return;
+    }
+
+    long elapsed_ms = (now.tv_sec - path_cache.checked.tv_sec) * 1000 +
+        (now.tv_nsec - path_cache.checked.tv_nsec) / 1000000;
+    if (elapsed_ms < PATH_CACHE_RECHECK_MS) {
+        return;
+    }
+    path_cache.checked = now;
+
+    int changed = 0;
+    for (size_t i = 0; i < path_cache.dir_count; i++) {
+        changed |= path_dir_stat(&path_cache.dirs[i]);
+    }
+    if (changed) {
+        path_cache_clear();
+    }
+}
+
+
+// ===== Lookup =====
+
+/* Return: 1 if path names an executable regular file
+ */
+static int is_program(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+
+/* Walks path_env for name, as execvp does (an empty entry means the cwd)
+ * Return: 0 and the program's path in out, -1 if it was not found. *cacheable
+ * is cleared when the match came from a relative entry.
+ */
+static int path_search(const char *name, const char *path_env, char *out, size_t size, int *cacheable) {
+    for (const char *start = path_env; ; ) {
+        const char *end = strchrnul(start, ':');
+        size_t dir_len = end - start;
+        int len = dir_len == 0 ?
+            snprintf(out, size, "%s", name) :
+            snprintf(out, size, "%.*s/%s", (int)dir_len, start, name);
+        if (len >= 0 && (size_t)len < size && is_program(out)) {
+            *cacheable = *start == '/';
+            return 0;
+        }
+        if (*end == '\0') break;
+        start = end + 1;
+    }
+    return -1;
+}
+
+
+int path_lookup(const char *name, char *out, size_t size) {
+    if (strchr(name, '/') != NULL) {
+        if ((size_t)snprintf(out, size, "%s", name) >= size) {
+            return -1;
+        }
+        return 0;
+    }
+
+    const char *path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "/bin:/usr/bin";     // execvp's default
+    }
+    path_validate(path_env);
+
+    if (path_cache.count > 0) {
+        PathEntry *entry = path_slot(name);
+        if (entry->name != NULL && (size_t)snprintf(out, size, "%s", entry->path) < size) {
+            entry->hits++;
+            return 0;
+        }
+    }
+
+    int cacheable = 0;
+    if (path_search(name, path_env, out, size, &cacheable) == -1) {
+        return -1;
+    }
+    if (cacheable) {
+        path_insert(name, out);
+    }
+    return 0;
+}
+
+
+void path_cache_free() {
+    path_cache_clear();
+    free(path_cache.slots);
+    path_cache.slots = NULL;
+    path_cache.slot_cap = 0;
+    path_dirs_free();
+}
+
+
+size_t path_cache_print() {
+    if (path_cache.count == 0) {
+        return 0;
+    }
+    display_message("hits\tcommand\n");
+    for (size_t i = 0; i < path_cache.slot_cap; i++) {
+        PathEntry *entry = &path_cache.slots[i];
+        if (entry->name == NULL) continue;
+        char hits[32];
+        snprintf(hits, sizeof(hits), "%4lu\t", entry->hits);
+        display_message(hits);
+        display_message(entry->path);
+        display_message("\n");
+    }
+    return path_cache.count;
+}
@@ -0,0 +1,62 @@
+#ifndef __PATHCACHE_H__
+#define __PATHCACHE_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+
+#define PATH_CACHE_MIN_SLOTS 64     // power of 2
+#define PATH_CACHE_RECHECK_MS 1000  // how often directory mtimes are re-read
+
+/* A resolved command: name found at path, hits lookups so far
+ */
+typedef struct {
+    char *name;                 // NULL marks an empty slot
+    char *path;
+    unsigned long hits;
+} PathEntry;
+
+/* A PATH directory and its mtime when the cache was last validated
+ */
+typedef struct {
+    char *dir;
+    struct timespec mtime;
+    int missing;
+} PathDir;
+
+/* Command hash table, bash style: maps command names to absolute paths so
+ * launching a command skips the PATH walk. Open addressing, at most half
+ * full. Cleared whenever PATH changes or any PATH directory's mtime moves
+ * (a new binary may shadow a cached one).
+ */
+typedef struct {
+    PathEntry *slots;
+    size_t slot_cap;
+    size_t count;
+    char *path_env;             // PATH the directories were taken from
+    PathDir *dirs;
+    size_t dir_count;
+    struct timespec checked;    // when dirs were last stat'ed
+} PathCache;
+
+
+/* Resolves name like execvp would, through the cache. Names containing '/'
+ * are used as given; matches in relative PATH entries are not cached.
+ * Return: 0 and the program's path in out, -1 if name is not on PATH
+ */
+int path_lookup(const char *name, char *out, size_t size);
+
+
+/* Drops name from the cache, e.g. after its binary disappeared
+ */
+void path_forget(const char *name);
+void path_cache_clear();
+void path_cache_free();
+
+
+/* Prints every cached command with its hit count
+ * Return: number of entries
+ */
+size_t path_cache_print();
+
+#endif
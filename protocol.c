@@ -0,0 +1,146 @@
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+
+
+// ===== Encoding =====
+
+void frame_header(char *hdr, FrameType type, size_t len) {
+    hdr[0] = (len >> 24) & 0xff;
+    hdr[1] = (len >> 16) & 0xff;
+    hdr[2] = (len >> 8) & 0xff;
+    hdr[3] = len & 0xff;
+    hdr[4] = type;
+}
+
+
+int frame_append(FrameWriter *writer, FrameType type, const char *payload, size_t len) {
+    if (len > FRAME_MAX_PAYLOAD) {
+        return -1;
+    }
+
+    size_t need = writer->len + FRAME_HEADER_LEN + len;
+    if (need > writer->cap) {
+        size_t cap = writer->cap ? writer->cap : FRAME_READ_CHUNK;
+        while (cap < need) cap *= 2;
+        char *buf = realloc(writer->buf, cap);
+        if (buf == NULL) return -1;
+        writer->buf = buf;
+        writer->cap = cap;
+    }
+
+    frame_header(writer->buf + writer->len, type, len);
+    if (len > 0) {
+        memcpy(writer->buf + writer->len + FRAME_HEADER_LEN, payload, len);
+    }
+    writer->len = need;
+    return 0;
+}
+
+
+int frame_flush(FrameWriter *writer, int fd) {
+    size_t off = 0;
+    while (off < writer->len) {
+        // a peer that hung up must not SIGPIPE the shell
+        ssize_t n = send(fd, writer->buf + off, writer->len - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            writer->len = 0;
+            return -1;
+        }
+        off += n;
+    }
+    writer->len = 0;
+    return 0;
+}
+
+
+void frame_writer_free(FrameWriter *writer) {
+    free(writer->buf);
+    *writer = (FrameWriter){0};
+}
+
+
+// ===== Decoding =====
+
+/* Makes room for at least n more bytes after the unparsed data
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int reader_reserve(FrameReader *reader, size_t n) {
+    // slide unparsed bytes to the front before growing
+    if (reader->pos > 0) {
+        memmove(reader->buf, reader->buf + reader->pos, reader->len - reader->pos);
+        reader->len -= reader->pos;
+        reader->pos = 0;
+    }
+
+    if (reader->cap - reader->len < n) {
+        size_t cap = reader->cap ? reader->cap : FRAME_READ_CHUNK;
+        while (cap - reader->len < n) cap *= 2;
+        char *buf = realloc(reader->buf, cap);
+        if (buf == NULL) return -1;
+        reader->buf = buf;
+        reader->cap = cap;
+    }
+    return 0;
+}
+
+
+ssize_t frame_read(FrameReader *reader, int fd) {
+    if (reader_reserve(reader, FRAME_READ_CHUNK) < 0) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    ssize_t n = read(fd, reader->buf + reader->len, reader->cap - reader->len);
+    if (n > 0) {
+        reader->len += n;
+    }
+    return n;
+}
+
+
+int frame_feed(FrameReader *reader, const char *data, size_t len) {
+    if (len == 0) {
+        return 0;   // an empty reader has no buffer to copy into yet
+    }
+    if (reader_reserve(reader, len) < 0) {
+        return -1;
+    }
+    memcpy(reader->buf + reader->len, data, len);
+    reader->len += len;
+    return 0;
+}
+
+
+int frame_next(FrameReader *reader, Frame *frame) {
+    size_t avail = reader->len - reader->pos;
+    if (avail < FRAME_HEADER_LEN) {
+        return 0;
+    }
+
+    const unsigned char *hdr = (const unsigned char *)reader->buf + reader->pos;
+    size_t len = ((size_t)hdr[0] << 24) | ((size_t)hdr[1] << 16) | ((size_t)hdr[2] << 8) | hdr[3];
+    if (len > FRAME_MAX_PAYLOAD || hdr[4] < FRAME_MSG || hdr[4] > FRAME_STATS) {
+        return -1;
+    }
+    if (avail < FRAME_HEADER_LEN + len) {
+        return 0;
+    }
+
+    frame->type = hdr[4];
+    frame->payload = reader->buf + reader->pos + FRAME_HEADER_LEN;
+    frame->len = len;
+    reader->pos += FRAME_HEADER_LEN + len;
+    return 1;
+}
+
+
+void frame_reader_free(FrameReader *reader) {
+    free(reader->buf);
+    *reader = (FrameReader){0};
+}
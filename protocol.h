@@ -0,0 +1,85 @@
+#ifndef __PROTOCOL_H__
+#define __PROTOCOL_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+
+/* Wire format shared by the chat server, start-client and send:
+ *   | length (4 bytes, big endian) | type (1 byte) | payload (length bytes) |
+ * length counts the payload only. Payloads are arbitrary bytes.
+ */
+#define FRAME_HEADER_LEN 5
+#define FRAME_MAX_PAYLOAD (64 * 1024)
+#define FRAME_READ_CHUNK 4096
+
+typedef enum {
+    FRAME_MSG = 1,          // chat text, in either direction
+    FRAME_CONNECTED = 2,    // client asks how many clients are connected
+    FRAME_STATS = 3         // client asks for server metrics
+} FrameType;
+
+typedef struct {
+    FrameType type;
+    const char *payload;    // points into the reader's buffer, valid until the next read
+    size_t len;
+} Frame;
+
+/* Incremental parse buffer for one connection. Bytes in [pos, len) are unparsed.
+ */
+typedef struct {
+    char *buf;
+    size_t pos;
+    size_t len;
+    size_t cap;
+} FrameReader;
+
+/* Frames appended here go out together in a single write.
+ */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+} FrameWriter;
+
+
+/* Writes the header for a payload of len bytes into hdr
+ */
+void frame_header(char *hdr, FrameType type, size_t len);
+
+
+/* Reads once from fd into the reader, growing it as needed.
+ * Return: bytes read, 0 on EOF, -1 on error (errno is set)
+ */
+ssize_t frame_read(FrameReader *reader, int fd);
+
+
+/* Appends bytes received some other way (e.g. an io_uring provided buffer)
+ * Return: 0 on success, -1 if memory ran out
+ */
+int frame_feed(FrameReader *reader, const char *data, size_t len);
+
+
+/* Return: 1 and fills frame if a whole frame is buffered, 0 if more bytes are
+ * needed, -1 if the stream is malformed
+ */
+int frame_next(FrameReader *reader, Frame *frame);
+
+void frame_reader_free(FrameReader *reader);
+
+
+/* Return: 0 on success, -1 if len is too large or memory ran out
+ */
+int frame_append(FrameWriter *writer, FrameType type, const char *payload, size_t len);
+
+
+/* Writes out every appended frame, blocking until done, and empties the writer.
+ * Prereq: fd is a socket
+ * Return: 0 on success, -1 on error
+ */
+int frame_flush(FrameWriter *writer, int fd);
+
+void frame_writer_free(FrameWriter *writer);
+
+
+#endif
@@ -0,0 +1,1269 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#else
+#include <poll.h>
+#endif
+
+#include "server.h"
+#include "protocol.h"
+#include "io_helpers.h"
+
+
+ServerState server_state = {0}; //set all fields to 0
+
+
+/* Shard metrics have a single writer, so a relaxed load+store is enough and
+ * other shards can still read them for \stats without tearing.
+ */
+#define stat_add(field, n) atomic_store_explicit(&(field), atomic_load_explicit(&(field), memory_order_relaxed) + (n), memory_order_relaxed)
+#define stat_get(field) atomic_load_explicit(&(field), memory_order_relaxed)
+
+
+// ===== Logging =====
+
+/* Shard threads log concurrently and the io_helpers buffers are not
+ * thread-safe, so every line goes out in a single writev(2) and can't
+ * interleave with another shard's.
+ */
+static void server_log(int fd, const char *head, const char *body, size_t body_len) {
+    struct iovec iov[2] = {
+        {.iov_base = (void *)head, .iov_len = strlen(head)},
+        {.iov_base = (void *)body, .iov_len = body_len},
+    };
+    while (writev(fd, iov, 2) < 0 && errno == EINTR) {
+    }
+}
+
+
+static void server_message(const char *str) {
+    server_log(STDOUT_FILENO, str, "", 0);
+}
+
+
+static void server_error(const char *str) {
+    server_log(STDERR_FILENO, str, "\n", 1);
+}
+
+
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+
+// ===== Shared messages =====
+
+/* Return: one frame of type whose payload is prefix followed by body, holding one
+ * reference, or NULL. The frame header is stored at the front of msg->prefix.
+ */
+static SharedMsg *msg_new(FrameType type, const char *prefix, size_t prefix_len, const char *body, size_t body_len) {
+    if (prefix_len > MSG_PREFIX_MAX - FRAME_HEADER_LEN) {
+        prefix_len = MSG_PREFIX_MAX - FRAME_HEADER_LEN;
+    }
+    if (prefix_len + body_len > FRAME_MAX_PAYLOAD) {
+        return NULL;
+    }
+
+    SharedMsg *msg = malloc(sizeof(SharedMsg) + body_len);
+    if (msg == NULL) return NULL;
+    atomic_init(&msg->refs, 1);
+    msg->prefix_len = FRAME_HEADER_LEN + prefix_len;
+    msg->body_len = body_len;
+    frame_header(msg->prefix, type, prefix_len + body_len);
+    memcpy(msg->prefix + FRAME_HEADER_LEN, prefix, prefix_len);
+    memcpy(msg->body, body, body_len);
+    return msg;
+}
+
+
+static void msg_retain(SharedMsg *msg) {
+    atomic_fetch_add_explicit(&msg->refs, 1, memory_order_relaxed);
+}
+
+
+static void msg_release(SharedMsg *msg) {
+    if (atomic_fetch_sub_explicit(&msg->refs, 1, memory_order_acq_rel) == 1) {
+        free(msg);
+    }
+}
+
+
+/* Fills at most 2 iovecs with the part of msg past off
+ * Return: number of iovecs used
+ */
+static int msg_iov(const SharedMsg *msg, size_t off, struct iovec *iov) {
+    int n = 0;
+    if (off < msg->prefix_len) {
+        iov[n].iov_base = (char *)msg->prefix + off;
+        iov[n].iov_len = msg->prefix_len - off;
+        n++;
+        off = 0;
+    } else {
+        off -= msg->prefix_len;
+    }
+    if (off < msg->body_len) {
+        iov[n].iov_base = (char *)msg->body + off;
+        iov[n].iov_len = msg->body_len - off;
+        n++;
+    }
+    return n;
+}
+
+
+// ===== Output queues =====
+
+static MsgRef *ring_at(OutRing *ring, size_t i) {
+    return &ring->refs[(ring->head + i) % ring->cap];
+}
+
+
+/* Takes a new reference to msg, starting at byte off
+ * Return: 0 on success, -1 if the ring could not grow
+ */
+static int ring_push(OutRing *ring, SharedMsg *msg, size_t off) {
+    if (ring->count == ring->cap) {
+        size_t cap = ring->cap ? ring->cap * 2 : OUT_RING_MIN_CAP;
+        MsgRef *refs = malloc(cap * sizeof(MsgRef));
+        if (refs == NULL) return -1;
+
+        // linearize so head restarts at 0
+        for (size_t i = 0; i < ring->count; i++) {
+            refs[i] = *ring_at(ring, i);
+        }
+        free(ring->refs);
+        ring->refs = refs;
+        ring->cap = cap;
+        ring->head = 0;
+    }
+
+    msg_retain(msg);
+    *ring_at(ring, ring->count) = (MsgRef){msg, off};
+    ring->count++;
+    ring->bytes += msg_len(msg) - off;
+    return 0;
+}
+
+
+/* Advances the ring past n written bytes, releasing finished messages
+ */
+static void ring_consume(OutRing *ring, size_t n) {
+    ring->bytes -= n;
+    while (n > 0) {
+        MsgRef *ref = ring_at(ring, 0);
+        size_t left = msg_len(ref->msg) - ref->off;
+        if (n < left) {
+            ref->off += n;
+            return;
+        }
+        n -= left;
+        msg_release(ref->msg);
+        ring->head = (ring->head + 1) % ring->cap;
+        ring->count--;
+    }
+}
+
+
+static void ring_clear(OutRing *ring) {
+    while (ring->count > 0) {
+        msg_release(ring_at(ring, 0)->msg);
+        ring->head = (ring->head + 1) % ring->cap;
+        ring->count--;
+    }
+    free(ring->refs);
+    *ring = (OutRing){0};
+}
+
+
+// ===== Cross-shard inbox =====
+
+static void inbox_init(Inbox *inbox) {
+    atomic_init(&inbox->stub.next, NULL);
+    inbox->stub.msg = NULL;
+    atomic_init(&inbox->head, &inbox->stub);
+    inbox->tail = &inbox->stub;
+}
+
+
+/* Safe to call from any thread
+ */
+static void inbox_push(Inbox *inbox, InboxNode *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    InboxNode *prev = atomic_exchange_explicit(&inbox->head, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+
+/* Owning shard only.
+ * Return: oldest node, or NULL if the inbox is empty or a push is half done
+ * (the pusher wakes the shard again once it finishes)
+ */
+static InboxNode *inbox_pop(Inbox *inbox) {
+    InboxNode *tail = inbox->tail;
+    InboxNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &inbox->stub) {
+        if (next == NULL) return NULL;
+        inbox->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        inbox->tail = next;
+        return tail;
+    }
+    if (tail != atomic_load_explicit(&inbox->head, memory_order_acquire)) {
+        return NULL;
+    }
+
+    // tail is the last real node; park the stub behind it so it can be handed out
+    inbox_push(inbox, &inbox->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next != NULL) {
+        inbox->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+
+/* Hands msg to another shard and wakes it if it isn't already due to wake
+ */
+static void shard_post(Shard *shard, SharedMsg *msg) {
+    InboxNode *node = malloc(sizeof(InboxNode));
+    if (node == NULL) {
+        return;
+    }
+    msg_retain(msg);
+    node->msg = msg;
+    inbox_push(&shard->inbox, node);
+
+    if (atomic_exchange(&shard->wake_pending, 1) == 0) {
+        uint64_t one = 1;
+        write(shard->wake_fd, &one, sizeof(one));
+    }
+}
+
+
+// ===== Client table =====
+
+/* Return: the client, or NULL if fd is not a connected client of shard
+ */
+static Client *client_lookup(Shard *shard, int fd) {
+    if (fd < 0 || (size_t)fd >= shard->fd_table_cap) {
+        return NULL;
+    }
+    return shard->fd_table[fd];
+}
+
+
+/* Return: new client registered under fd, or NULL on allocation failure
+ */
+static Client *client_add(Shard *shard, int fd) {
+    if ((size_t)fd >= shard->fd_table_cap) {
+        size_t cap = shard->fd_table_cap ? shard->fd_table_cap : 64;
+        while (cap <= (size_t)fd) cap *= 2;
+
+        Client **table = realloc(shard->fd_table, cap * sizeof(Client *));
+        if (table == NULL) return NULL;
+        memset(table + shard->fd_table_cap, 0, (cap - shard->fd_table_cap) * sizeof(Client *));
+        shard->fd_table = table;
+        shard->fd_table_cap = cap;
+    }
+
+    if (shard->client_count == shard->clients_cap) {
+        size_t cap = shard->clients_cap ? shard->clients_cap * 2 : 64;
+        Client **clients = realloc(shard->clients, cap * sizeof(Client *));
+        if (clients == NULL) return NULL;
+        shard->clients = clients;
+        shard->clients_cap = cap;
+    }
+
+    Client *client = malloc(sizeof(Client));
+    if (client == NULL) return NULL;
+    client->socket = fd;
+    client->id = atomic_fetch_add(&server_state.next_id, 1) + 1;
+    client->slot = shard->client_count;
+    client->shard = shard;
+    client->out = (OutRing){0};
+    client->in = (FrameReader){0};
+    client->dropped = 0;
+    client->inflight = 0;
+    client->closing = 0;
+    client->dirty = 0;
+    client->sending = 0;
+    client->send_iov = NULL;
+
+    shard->clients[shard->client_count++] = client;
+    shard->fd_table[fd] = client;
+    atomic_fetch_add(&server_state.client_count, 1);
+    return client;
+}
+
+
+static void client_free(Client *client) {
+    stat_add(client->shard->queued_bytes, -client->out.bytes);
+    ring_clear(&client->out);
+    frame_reader_free(&client->in);
+    free(client->send_iov);
+    free(client);
+}
+
+
+/* Closes the client socket and swap-removes it from its shard. Under io_uring
+ * the memory lives on until the kernel has finished with its buffers.
+ */
+static void client_remove(Client *client) {
+    Shard *shard = client->shard;
+    size_t last = shard->client_count - 1;
+    if (client->slot != last) {
+        Client *moved = shard->clients[last];
+        moved->slot = client->slot;
+        shard->clients[client->slot] = moved;
+    }
+    shard->client_count--;
+    shard->fd_table[client->socket] = NULL;
+    atomic_fetch_sub(&server_state.client_count, 1);
+
+    if (client->inflight > 0 || client->dirty) {
+        // shutdown completes the pending recv/send so their cqes come back
+        shutdown(client->socket, SHUT_RDWR);
+        close(client->socket);
+        client->closing = 1;
+        return;
+    }
+    close(client->socket);  // also drops it from the epoll set
+    client_free(client);
+}
+
+
+// ===== Client output =====
+
+static int shard_uses_uring(const Shard *shard) {
+#if HAVE_URING
+    return shard->use_uring;
+#else
+    (void)shard;
+    return 0;
+#endif
+}
+
+
+#if HAVE_URING
+/* Queues client for the send batch submitted after the current completions
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int uring_mark_dirty(Client *client) {
+    Shard *shard = client->shard;
+    if (shard->dirty_count == shard->dirty_cap) {
+        size_t cap = shard->dirty_cap ? shard->dirty_cap * 2 : OUT_RING_MIN_CAP;
+        Client **dirty = realloc(shard->dirty, cap * sizeof(Client *));
+        if (dirty == NULL) return -1;
+        shard->dirty = dirty;
+        shard->dirty_cap = cap;
+    }
+    shard->dirty[shard->dirty_count++] = client;
+    client->dirty = 1;
+    return 0;
+}
+#endif
+
+
+/* Fills iov with the head of client's queue
+ * Return: number of iovecs used
+ */
+static int client_gather(Client *client, struct iovec *iov) {
+    OutRing *ring = &client->out;
+    int iovcnt = 0;
+    for (size_t i = 0; i < ring->count && iovcnt + 2 <= FLUSH_IOV_MAX; i++) {
+        MsgRef *ref = ring_at(ring, i);
+        iovcnt += msg_iov(ref->msg, ref->off, iov + iovcnt);
+    }
+    return iovcnt;
+}
+
+
+/* Writes as much of client's queue as the socket accepts, gathering many
+ * queued messages into each writev.
+ * Return: 0 on success (queue may still be non-empty), -1 if the socket failed
+ */
+static int client_flush(Client *client) {
+    OutRing *ring = &client->out;
+    struct iovec iov[FLUSH_IOV_MAX];
+
+    while (ring->count > 0) {
+        ssize_t n = writev(client->socket, iov, client_gather(client, iov));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        ring_consume(ring, n);
+        stat_add(client->shard->queued_bytes, -(size_t)n);
+    }
+    return 0;
+}
+
+
+/* Sends msg to client without copying it, writing straight through when nothing
+ * is pending and otherwise queueing a reference. Under io_uring it is always
+ * queued and the loop submits every pending send in one batch. A message that
+ * would push the queue past the high-water mark is dropped, or the client is
+ * marked a laggard, depending on lag_policy.
+ * Return: 0 if the message was sent, queued or dropped, -1 if client must be disconnected
+ */
+static int client_send(Client *client, SharedMsg *msg) {
+    Shard *shard = client->shard;
+    OutRing *ring = &client->out;
+    size_t off = 0;
+
+    if (ring->count == 0) {
+        if (!shard_uses_uring(shard)) {
+            struct iovec iov[2];
+            ssize_t written = writev(client->socket, iov, msg_iov(msg, 0, iov));
+            if (written < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) return -1;
+                written = 0;
+            }
+            off = written;
+            if (off == msg_len(msg)) return 0;
+        }
+    } else if (ring->bytes + msg_len(msg) > server_state.high_water) {
+        if (server_state.lag_policy == LAG_DISCONNECT) {
+            stat_add(shard->laggards, 1);
+            return -1;
+        }
+        client->dropped++;
+        stat_add(shard->dropped_msgs, 1);
+        stat_add(shard->dropped_bytes, msg_len(msg));
+        return 0;
+    }
+
+    // an empty queue always takes the remainder so messages are never torn
+    if (ring_push(ring, msg, off) < 0) {
+        return -1;
+    }
+    stat_add(shard->queued_bytes, msg_len(msg) - off);
+    if (stat_get(shard->queued_bytes) > stat_get(shard->peak_queued_bytes)) {
+        atomic_store_explicit(&shard->peak_queued_bytes, stat_get(shard->queued_bytes), memory_order_relaxed);
+    }
+
+#if HAVE_URING
+    if (shard->use_uring && !client->dirty && uring_mark_dirty(client) < 0) {
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+
+/* Sends a one-off text reply to client
+ * Return: same as client_send
+ */
+static int client_reply(Client *client, const char *text) {
+    SharedMsg *msg = msg_new(FRAME_MSG, "", 0, text, strlen(text));
+    if (msg == NULL) return -1;
+    int ret = client_send(client, msg);
+    msg_release(msg);
+    return ret;
+}
+
+
+static void client_drop(Client *client, const char *reason) {
+    char msg[128];
+    snprintf(msg, sizeof(msg), "client%d disconnected%s\n", client->id, reason);
+    server_message(msg);
+    client_remove(client);
+}
+
+
+/* Sends msg to every client of shard except sender (NULL for none)
+ */
+static void shard_broadcast(Shard *shard, SharedMsg *msg, Client *sender) {
+    // walk backwards so a laggard swap-removed at i was already visited
+    for (size_t i = shard->client_count; i-- > 0;) {
+        Client *receiver = shard->clients[i];
+        if (receiver != sender && client_send(receiver, msg) < 0) {
+            client_drop(receiver, " (slow consumer)");
+        }
+    }
+}
+
+
+/* Totals over all shards; peak is the largest single-shard peak
+ */
+static void format_stats(char *buf, size_t size) {
+    size_t queued = 0, peak = 0;
+    unsigned long dropped_msgs = 0, dropped_bytes = 0, laggards = 0;
+    for (int i = 0; i < server_state.workers; i++) {
+        Shard *shard = &server_state.shards[i];
+        queued += stat_get(shard->queued_bytes);
+        if (stat_get(shard->peak_queued_bytes) > peak) peak = stat_get(shard->peak_queued_bytes);
+        dropped_msgs += stat_get(shard->dropped_msgs);
+        dropped_bytes += stat_get(shard->dropped_bytes);
+        laggards += stat_get(shard->laggards);
+    }
+
+    snprintf(buf, size, "server: %zu clients, %zu B queued (peak %zu), %lu msgs dropped (%lu B), %lu laggards\n",
+             atomic_load(&server_state.client_count), queued, peak, dropped_msgs, dropped_bytes, laggards);
+}
+
+
+// ===== io_uring submissions =====
+
+#if HAVE_URING
+// user_data is the Client pointer (or NULL) tagged in its low bits
+#define UD_RECV 0
+#define UD_SEND 1
+#define UD_ACCEPT 2
+#define UD_WAKE 3
+#define UD_CANCEL 4
+#define UD_TAG_MASK 7
+
+/* Arms a recv into the shard's provided buffers. It is one-shot on purpose:
+ * a multishot recv from a flooding sender posts a burst of completions ahead
+ * of the receivers' send completions and overruns their high-water marks.
+ * Return: 0 on success, -1 if the submission queue is stuck
+ */
+static int uring_arm_recv(Client *client) {
+    Shard *shard = client->shard;
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->socket;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = shard->bufs.bgid;
+    sqe->user_data = (uintptr_t)client | UD_RECV;
+    client->inflight++;
+    shard->ops++;
+    return 0;
+}
+
+
+/* Submits one sendmsg covering the head of client's queue. Unlike writev on
+ * a blocking socket, it completes with a short count instead of parking an
+ * io-wq thread until everything fits.
+ * Return: 0 on success, -1 on failure
+ */
+static int uring_arm_send(Client *client) {
+    Shard *shard = client->shard;
+    if (client->send_iov == NULL) {
+        client->send_iov = malloc(FLUSH_IOV_MAX * sizeof(struct iovec));
+        if (client->send_iov == NULL) return -1;
+    }
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (sqe == NULL) return -1;
+
+    // the ring keeps its messages referenced until the completion consumes them
+    memset(&client->send_msg, 0, sizeof(client->send_msg));
+    client->send_msg.msg_iov = client->send_iov;
+    client->send_msg.msg_iovlen = client_gather(client, client->send_iov);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->socket;
+    sqe->addr = (uintptr_t)&client->send_msg;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (uintptr_t)client | UD_SEND;
+    client->sending = 1;
+    client->inflight++;
+    shard->ops++;
+    return 0;
+}
+
+
+static int uring_arm_accept(Shard *shard) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = shard->server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = UD_ACCEPT;
+    shard->ops++;
+    return 0;
+}
+
+
+static int uring_arm_wake(Shard *shard) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (sqe == NULL) return -1;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = shard->wake_fd;
+    sqe->addr = (uintptr_t)&shard->wake_count;
+    sqe->len = sizeof(shard->wake_count);
+    sqe->user_data = UD_WAKE;
+    shard->ops++;
+    return 0;
+}
+
+
+static void uring_cancel(Shard *shard, uint64_t user_data) {
+    struct io_uring_sqe *sqe = uring_get_sqe(&shard->ring);
+    if (sqe == NULL) return;
+
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = user_data;
+    sqe->user_data = UD_CANCEL;
+    shard->ops++;
+}
+
+
+/* Frees a removed client once the kernel holds no more references to it
+ */
+static void uring_release(Client *client) {
+    if (client->closing && client->inflight == 0 && !client->dirty) {
+        client_free(client);
+    }
+}
+#endif
+
+
+// ===== Event handling =====
+
+/* Registers a freshly accepted socket with shard and greets it
+ */
+static void client_open(Shard *shard, int fd) {
+    Client *new_client = client_add(shard, fd);
+    if (new_client == NULL) {
+        server_error("ERROR: Out of memory for client");
+        close(fd);
+        return;
+    }
+
+#ifdef __linux__
+    if (!shard_uses_uring(shard)) {
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.fd = fd};
+        if (epoll_ctl(shard->poll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            server_error("ERROR: epoll_ctl failed");
+            client_remove(new_client);
+            return;
+        }
+    }
+#endif
+#if HAVE_URING
+    if (shard->use_uring && uring_arm_recv(new_client) < 0) {
+        server_error("ERROR: io_uring submit failed");
+        client_remove(new_client);
+        return;
+    }
+#endif
+
+    char welcome[MAX_STR_LEN];
+    snprintf(welcome, sizeof(welcome), "client%d: connected\n", new_client->id);
+    server_message(welcome);
+    if (client_reply(new_client, welcome) < 0) {
+        client_drop(new_client, "");
+    }
+}
+
+
+static void server_accept(Shard *shard) {
+    struct sockaddr_in address;
+    socklen_t addrlen = sizeof(address);
+
+    // listener is edge-triggered, so drain the whole accept queue
+    while (1) {
+#ifdef __linux__
+        int new_socket = accept4(shard->server_fd, (struct sockaddr *)&address, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int new_socket = accept(shard->server_fd, (struct sockaddr *)&address, &addrlen);
+        if (new_socket >= 0) set_nonblocking(new_socket);
+#endif
+        if (new_socket < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                server_error("ERROR: accept failed");
+            }
+            return;
+        }
+        client_open(shard, new_socket);
+    }
+}
+
+
+/* Acts on one complete frame from client.
+ * Return: 0 on success, -1 if client was dropped
+ */
+static int handle_frame(Client *client, const Frame *frame) {
+    Shard *shard = client->shard;
+
+    if (frame->type == FRAME_CONNECTED || frame->type == FRAME_STATS) {
+        char msg[MAX_STR_LEN];
+        if (frame->type == FRAME_CONNECTED) {
+            snprintf(msg, sizeof(msg), "client%d: %zu clients connected\n", client->id, atomic_load(&server_state.client_count));
+        } else {
+            format_stats(msg, sizeof(msg));
+        }
+        if (client_reply(client, msg) < 0) {
+            client_drop(client, "");
+            return -1;
+        }
+        return 0;
+    }
+
+    // format once; every receiver on every shard shares the same buffer
+    char prefix[MSG_PREFIX_MAX];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "client%d: ", client->id);
+    SharedMsg *msg = msg_new(FRAME_MSG, prefix, prefix_len, frame->payload, frame->len);
+    if (msg == NULL) {
+        server_error("ERROR: Out of memory for message");
+        return 0;
+    }
+
+    for (int i = 0; i < server_state.workers; i++) {
+        if (i != shard->index) {
+            shard_post(&server_state.shards[i], msg);
+        }
+    }
+    shard_broadcast(shard, msg, client);
+
+    server_log(STDOUT_FILENO, prefix, msg->body, msg->body_len);
+    msg_release(msg);
+    return 0;
+}
+
+
+/* Drains everything readable on client's socket and handles each complete frame.
+ * Partial frames stay buffered until the rest arrives. The client is freed if it
+ * disconnected or broke the protocol.
+ */
+static void handle_server_activity(Client *client) {
+    while (1) {
+        ssize_t valread = frame_read(&client->in, client->socket);
+
+        if (valread < 0 && errno == EINTR) {
+            continue;
+        }
+        if (valread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+
+        if (valread <= 0) { // disconnected
+            client_drop(client, "");
+            return;
+        }
+
+        Frame frame;
+        int ret;
+        while ((ret = frame_next(&client->in, &frame)) == 1) {
+            if (handle_frame(client, &frame) < 0) {
+                return;
+            }
+        }
+        if (ret < 0) {
+            client_drop(client, " (protocol error)");
+            return;
+        }
+    }
+}
+
+
+/* Delivers up to max broadcasts posted by other shards to this shard's clients
+ * Return: 1 if more may be waiting, 0 if the inbox is empty
+ */
+static int inbox_drain(Shard *shard, size_t max) {
+    atomic_store(&shard->wake_pending, 0);
+
+    for (size_t i = 0; i < max; i++) {
+        InboxNode *node = inbox_pop(&shard->inbox);
+        if (node == NULL) return 0;
+        shard_broadcast(shard, node->msg, NULL);
+        msg_release(node->msg);
+        free(node);
+    }
+    return 1;
+}
+
+
+static void handle_inbox(Shard *shard) {
+    uint64_t count;
+    read(shard->wake_fd, &count, sizeof(count));
+    inbox_drain(shard, SIZE_MAX);
+}
+
+
+// ===== Event loop =====
+
+/* Return: listening socket bound to server_state.port, or -1 on error
+ */
+static int server_listen(int reuse_port) {
+    struct sockaddr_in address;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        server_error("ERROR: Socket creation failed");
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+#ifdef SO_REUSEPORT
+    // every worker binds its own listener and the kernel spreads connections
+    if (reuse_port) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt));
+    }
+#else
+    (void)reuse_port;
+#endif
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(server_state.port);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        listen(fd, SERVER_BACKLOG) < 0 || set_nonblocking(fd) < 0) {
+        server_error("ERROR: Cannot listen on port");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+#if HAVE_URING
+static void uring_recv_done(Shard *shard, Client *client, const struct io_uring_cqe *cqe) {
+    int alive = !client->closing;
+    int res = cqe->res;
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (alive && res > 0 && frame_feed(&client->in, uring_buf(&shard->bufs, bid), res) < 0) {
+            client_drop(client, " (out of memory)");
+            alive = 0;
+        }
+        uring_buf_recycle(&shard->bufs, bid);
+    }
+
+    if (alive && res > 0) {
+        Frame frame;
+        int ret;
+        while ((ret = frame_next(&client->in, &frame)) == 1) {
+            if (handle_frame(client, &frame) < 0) {
+                alive = 0;
+                break;
+            }
+        }
+        if (alive && ret < 0) {
+            client_drop(client, " (protocol error)");
+            alive = 0;
+        }
+    } else if (alive && res != -ENOBUFS) {
+        client_drop(client, "");    // EOF or socket error
+        alive = 0;
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        client->inflight--;
+        if (alive && uring_arm_recv(client) < 0) {
+            client_drop(client, "");
+        }
+    }
+    uring_release(client);
+}
+
+
+static void uring_send_done(Client *client, int res) {
+    client->inflight--;
+    client->sending = 0;
+    if (!client->closing) {
+        if (res < 0) {
+            client_drop(client, "");
+        } else {
+            ring_consume(&client->out, res);
+            stat_add(client->shard->queued_bytes, -(size_t)res);
+            if (client->out.count > 0 && !client->dirty && uring_mark_dirty(client) < 0) {
+                client_drop(client, "");
+            }
+        }
+    }
+    uring_release(client);
+}
+
+
+static void uring_complete(Shard *shard, const struct io_uring_cqe *cqe) {
+    Client *client = (Client *)(uintptr_t)(cqe->user_data & ~(uint64_t)UD_TAG_MASK);
+    int more = cqe->flags & IORING_CQE_F_MORE;
+    if (!more) shard->ops--;
+
+    switch (cqe->user_data & UD_TAG_MASK) {
+        case UD_RECV:
+            uring_recv_done(shard, client, cqe);
+            break;
+        case UD_SEND:
+            uring_send_done(client, cqe->res);
+            break;
+        case UD_ACCEPT:
+            if (cqe->res >= 0) {
+                client_open(shard, cqe->res);
+            } else if (cqe->res != -ECANCELED) {
+                server_error("ERROR: accept failed");
+            }
+            if (!more && atomic_load(&server_state.running) && uring_arm_accept(shard) < 0) {
+                server_error("ERROR: io_uring submit failed");
+            }
+            break;
+        case UD_WAKE:
+            if (atomic_load(&server_state.running)) {
+                shard->inbox_backlog = inbox_drain(shard, URING_SEND_BATCH);
+                uring_arm_wake(shard);
+            }
+            break;
+    }
+}
+
+
+/* Submits one send per client that had output queued since the last batch
+ */
+static void uring_flush_dirty(Shard *shard) {
+    for (size_t i = 0; i < shard->dirty_count; i++) {
+        Client *client = shard->dirty[i];
+        client->dirty = 0;
+        if (client->closing) {
+            uring_release(client);
+        } else if (!client->sending && client->out.count > 0 && uring_arm_send(client) < 0) {
+            client_drop(client, "");
+        }
+    }
+    shard->dirty_count = 0;
+}
+
+
+/* Submits pending work, waits for at least one completion and handles
+ * everything that has completed. Sends go out every URING_SEND_BATCH
+ * completions or inbox messages, so a burst can't outrun the high-water mark
+ * before the receivers' sends complete.
+ * Return: 0, or -errno from the wait (-EINTR on SIGTERM)
+ */
+static int uring_step(Shard *shard, const sigset_t *wait_mask) {
+    uring_flush_dirty(shard);
+    int ret = uring_submit_and_wait(&shard->ring, shard->inbox_backlog ? 0 : 1, wait_mask);
+    if (ret < 0 && ret != -EBUSY) return ret;
+
+    struct io_uring_cqe *cqe;
+    unsigned handled = 0;
+    while ((cqe = uring_peek_cqe(&shard->ring)) != NULL) {
+        // copy first: handling it may submit, and the slot is reusable once seen
+        struct io_uring_cqe done = *cqe;
+        uring_cqe_seen(&shard->ring);
+        uring_complete(shard, &done);
+
+        if (++handled % URING_SEND_BATCH == 0 && shard->dirty_count > 0) {
+            uring_flush_dirty(shard);
+            uring_submit_and_wait(&shard->ring, 0, NULL);
+        }
+    }
+
+    if (shard->inbox_backlog && atomic_load(&server_state.running)) {
+        shard->inbox_backlog = inbox_drain(shard, URING_SEND_BATCH);
+    }
+    return 0;
+}
+
+
+/* Prereq: same as run_events
+ */
+static void run_uring(Shard *shard, const sigset_t *wait_mask) {
+    if (uring_arm_accept(shard) < 0 || uring_arm_wake(shard) < 0) {
+        server_error("ERROR: io_uring submit failed");
+        return;
+    }
+
+    while (atomic_load(&server_state.running)) {
+        int ret = uring_step(shard, wait_mask);
+        if (ret < 0 && ret != -EINTR) {
+            server_error("ERROR: io_uring_enter failed");
+        }
+    }
+
+    // let the kernel finish with every buffer and client before teardown
+    uring_cancel(shard, UD_ACCEPT);
+    uring_cancel(shard, UD_WAKE);
+    while (shard->client_count > 0) {
+        client_remove(shard->clients[shard->client_count - 1]);
+    }
+    while (shard->ops > 0) {
+        if (uring_step(shard, NULL) < 0) break;
+    }
+    uring_flush_dirty(shard);
+}
+
+
+/* Sets shard up for io_uring; the caller falls back to epoll on failure
+ * Return: 0 on success, -1 if io_uring is unavailable
+ */
+static int shard_open_uring(Shard *shard) {
+    if (uring_init(&shard->ring, URING_ENTRIES) < 0) {
+        return -1;
+    }
+    if (uring_buf_ring_init(&shard->ring, &shard->bufs, 0, URING_BUFS, URING_BUF_SIZE) < 0) {
+        uring_free(&shard->ring);
+        return -1;
+    }
+    shard->use_uring = 1;
+    return 0;
+}
+
+
+static void shard_close_uring(Shard *shard) {
+    if (!shard->use_uring) return;
+    uring_buf_ring_free(&shard->ring, &shard->bufs);
+    uring_free(&shard->ring);
+    free(shard->dirty);
+}
+#endif
+
+
+#ifdef __linux__
+/* Return: 0 on success, -1 on error
+ */
+static int shard_open(Shard *shard) {
+    shard->server_fd = server_listen(server_state.workers > 1);
+    shard->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (shard->server_fd < 0 || shard->wake_fd < 0) {
+        server_error("ERROR: Cannot start server worker");
+        return -1;
+    }
+
+#if HAVE_URING
+    if (server_state.engine == ENGINE_URING) {
+        if (shard_open_uring(shard) == 0) return 0;
+        if (shard->index == 0) {
+            server_error("ERROR: io_uring unavailable, using epoll");
+        }
+    }
+#endif
+
+    shard->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (shard->poll_fd < 0) {
+        server_error("ERROR: Cannot start server worker");
+        return -1;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.fd = shard->server_fd};
+    epoll_ctl(shard->poll_fd, EPOLL_CTL_ADD, shard->server_fd, &ev);
+    struct epoll_event wake = {.events = EPOLLIN, .data.fd = shard->wake_fd};
+    epoll_ctl(shard->poll_fd, EPOLL_CTL_ADD, shard->wake_fd, &wake);
+    return 0;
+}
+
+
+/* Prereq: SIGTERM is blocked; wait_mask is the mask to wait under, or NULL
+ * to keep it blocked (worker threads)
+ */
+static void run_events(Shard *shard, const sigset_t *wait_mask) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (atomic_load(&server_state.running)) {
+        int n = epoll_pwait(shard->poll_fd, events, SERVER_MAX_EVENTS, -1, wait_mask);
+        if (n < 0) {
+            if (errno != EINTR) server_error("ERROR: epoll_wait failed");
+            continue;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == shard->server_fd) {
+                server_accept(shard);
+                continue;
+            }
+            if (fd == shard->wake_fd) {
+                handle_inbox(shard);
+                continue;
+            }
+
+            // a client removed earlier in this batch may have had its fd reused
+            Client *client = client_lookup(shard, fd);
+            if (client != NULL && (events[i].events & EPOLLOUT) && client_flush(client) < 0) {
+                client_drop(client, "");
+                continue;
+            }
+            if (client != NULL && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+                handle_server_activity(client);
+            }
+        }
+    }
+}
+#else
+static int shard_open(Shard *shard) {
+    shard->server_fd = server_listen(0);
+    shard->poll_fd = -1;
+    shard->wake_fd = -1;
+    return shard->server_fd < 0 ? -1 : 0;
+}
+
+
+/* poll() fallback for platforms without epoll; no FD_SETSIZE limit but O(n) per wakeup.
+ * Always a single shard, so there is no inbox to watch.
+ */
+static void run_events(Shard *shard, const sigset_t *wait_mask) {
+    struct pollfd *fds = NULL;
+    size_t fds_cap = 0;
+
+    while (atomic_load(&server_state.running)) {
+        size_t nfds = shard->client_count + 1;
+        if (nfds > fds_cap) {
+            fds_cap = nfds * 2;
+            struct pollfd *grown = realloc(fds, fds_cap * sizeof(struct pollfd));
+            if (grown == NULL) break;
+            fds = grown;
+        }
+
+        fds[0].fd = shard->server_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < shard->client_count; i++) {
+            fds[i + 1].fd = shard->clients[i]->socket;
+            fds[i + 1].events = POLLIN | (shard->clients[i]->out.count ? POLLOUT : 0);
+        }
+
+        // no portable ppoll, so wake up periodically to notice SIGTERM
+        sigset_t blocked;
+        sigprocmask(SIG_SETMASK, wait_mask, &blocked);
+        int ready = poll(fds, nfds, 500);
+        sigprocmask(SIG_SETMASK, &blocked, NULL);
+        if (ready < 0) {
+            if (errno != EINTR) server_error("ERROR: poll failed");
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            server_accept(shard);
+        }
+        for (size_t i = 1; i < nfds; i++) {
+            Client *client = client_lookup(shard, fds[i].fd);
+            if (client != NULL && (fds[i].revents & POLLOUT) && client_flush(client) < 0) {
+                client_drop(client, "");
+                continue;
+            }
+            if (client != NULL && (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                handle_server_activity(client);
+            }
+        }
+    }
+    free(fds);
+}
+#endif
+
+
+static void shard_run(Shard *shard, const sigset_t *wait_mask) {
+#if HAVE_URING
+    if (shard->use_uring) {
+        run_uring(shard, wait_mask);
+        return;
+    }
+#endif
+    run_events(shard, wait_mask);
+}
+
+
+static void *shard_main(void *arg) {
+    shard_run(arg, NULL);
+    return NULL;
+}
+
+
+static void shard_close(Shard *shard) {
+    while (shard->client_count > 0) {
+        client_remove(shard->clients[shard->client_count - 1]);
+    }
+    free(shard->clients);
+    free(shard->fd_table);
+
+    InboxNode *node;
+    while ((node = inbox_pop(&shard->inbox)) != NULL) {
+        msg_release(node->msg);
+        free(node);
+    }
+
+    if (shard->server_fd >= 0) close(shard->server_fd);
+    if (shard->poll_fd >= 0) close(shard->poll_fd);
+    if (shard->wake_fd >= 0) close(shard->wake_fd);
+#if HAVE_URING
+    shard_close_uring(shard);
+#endif
+}
+
+
+static void handler_sigterm(__attribute__((unused)) int code) {
+    atomic_store(&server_state.running, 0);
+}
+
+
+void server_loop() {
+    // a peer closing mid-write must not kill the server; SIGTERM stops the loop cleanly
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa_term;
+    sa_term.sa_handler = handler_sigterm;
+    sa_term.sa_flags = 0;
+    sigemptyset(&sa_term.sa_mask);
+    sigaction(SIGTERM, &sa_term, NULL);
+
+    // SIGTERM is only delivered to shard 0 while it waits for events, so a stop
+    // request can't slip in between the running check and the wait. Worker
+    // threads inherit the blocked mask.
+    sigset_t term_mask, wait_mask;
+    sigemptyset(&term_mask);
+    sigaddset(&term_mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &term_mask, &wait_mask);
+    sigdelset(&wait_mask, SIGTERM);
+
+    int workers = server_state.workers;
+    server_state.shards = calloc(workers, sizeof(Shard));
+    if (server_state.shards == NULL) {
+        server_error("ERROR: Out of memory for server");
+        return;
+    }
+
+    int started = 0;
+    for (int i = 0; i < workers; i++) {
+        Shard *shard = &server_state.shards[i];
+        shard->index = i;
+        shard->server_fd = shard->poll_fd = shard->wake_fd = -1;
+        inbox_init(&shard->inbox);
+    }
+    for (; started < workers; started++) {
+        Shard *shard = &server_state.shards[started];
+        if (shard_open(shard) < 0) break;
+        if (started > 0 && pthread_create(&shard->thread, NULL, shard_main, shard) != 0) {
+            server_error("ERROR: Cannot start server worker");
+            break;
+        }
+    }
+
+    if (started == workers) {
+        shard_run(&server_state.shards[0], &wait_mask);
+    }
+
+    // stop the workers; the eventfd wakes any that are blocked
+    atomic_store(&server_state.running, 0);
+    for (int i = 1; i < started; i++) {
+        uint64_t one = 1;
+        write(server_state.shards[i].wake_fd, &one, sizeof(one));
+        pthread_join(server_state.shards[i].thread, NULL);
+    }
+
+    char stats[MAX_STR_LEN];
+    format_stats(stats, sizeof(stats));
+    server_message(stats);
+
+    // server cleanup after close
+    for (int i = 0; i < workers; i++) {
+        shard_close(&server_state.shards[i]);
+    }
+    free(server_state.shards);
+    server_state.shards = NULL;
+}
@@ -0,0 +1,171 @@
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <sys/types.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+#include "uring.h"
+
+
+#define BUFFER_SIZE 1024
+#define SERVER_BACKLOG 4096
+#define SERVER_MAX_EVENTS 256
+#define SERVER_DEFAULT_HWM (256 * 1024)
+#define SERVER_MAX_WORKERS 64
+#define OUT_RING_MIN_CAP 16
+#define MSG_PREFIX_MAX 32
+#define FLUSH_IOV_MAX 64
+#define URING_ENTRIES 4096
+#define URING_BUFS 256                  // provided recv buffers per shard, power of 2
+#define URING_BUF_SIZE FRAME_READ_CHUNK
+#define URING_SEND_BATCH 16            // completions handled between send submissions
+
+/* What to do with a client whose output queue would pass the high-water mark
+ */
+typedef enum {
+    LAG_DROP,           // drop the message for that client only
+    LAG_DISCONNECT      // disconnect the client
+} LagPolicy;
+
+/* I/O backend for the server's event loops
+ */
+typedef enum {
+    ENGINE_EPOLL,       // readiness: epoll (poll on non-Linux)
+    ENGINE_URING        // completion: io_uring, falls back to epoll if unavailable
+} ServerEngine;
+
+/* A broadcast frame, formatted once and shared by every receiver's queue,
+ * across all shards. prefix holds the frame header and the sender tag.
+ * Freed when the last reference is released.
+ */
+typedef struct {
+    atomic_uint refs;
+    size_t prefix_len;
+    size_t body_len;
+    char prefix[MSG_PREFIX_MAX];
+    char body[];
+} SharedMsg;
+
+#define msg_len(msg) ((msg)->prefix_len + (msg)->body_len)
+
+typedef struct {
+    SharedMsg *msg;
+    size_t off;         // bytes of msg already written
+} MsgRef;
+
+/* Pending output for one client: a ring of message references.
+ * Grows on demand; total bytes are bounded by the high-water mark.
+ */
+typedef struct {
+    MsgRef *refs;
+    size_t cap;
+    size_t head;
+    size_t count;
+    size_t bytes;
+} OutRing;
+
+struct shard;
+
+typedef struct client_node {
+    int socket;
+    int id;
+    size_t slot;        // index of this client in shard->clients
+    struct shard *shard;
+    OutRing out;
+    FrameReader in;
+    unsigned long dropped;
+
+    // io_uring engine only
+    int inflight;           // submitted ops whose completion is still due
+    int closing;            // removed, freed once inflight drops to 0
+    int dirty;              // queued output waiting for the next send batch
+    int sending;
+    struct iovec *send_iov;
+    struct msghdr send_msg;
+} Client;
+
+typedef struct inbox_node {
+    _Atomic(struct inbox_node *) next;
+    SharedMsg *msg;
+} InboxNode;
+
+/* Lock-free multi-producer single-consumer queue of broadcasts from other
+ * shards. Producers push at head; only the owning shard pops at tail.
+ */
+typedef struct {
+    _Atomic(InboxNode *) head;
+    InboxNode *tail;
+    InboxNode stub;
+} Inbox;
+
+/* One event loop thread and the clients it accepted. clients is a dense array
+ * used for broadcast; fd_table maps a socket fd straight to its Client so
+ * event dispatch never walks the client set. Only the owning thread touches
+ * clients; other shards reach it through inbox.
+ */
+typedef struct shard {
+    int index;
+    int server_fd;
+    int poll_fd;
+    int wake_fd;
+    pthread_t thread;
+    Client **clients;
+    size_t client_count;
+    size_t clients_cap;
+    Client **fd_table;
+    size_t fd_table_cap;
+    Inbox inbox;
+    atomic_int wake_pending;
+
+#if HAVE_URING
+    int use_uring;
+    Uring ring;
+    UringBufRing bufs;
+    unsigned ops;           // ring ops in flight, drained before teardown
+    uint64_t wake_count;    // eventfd read target
+    int inbox_backlog;      // inbox left non-empty, keep draining between sends
+    Client **dirty;
+    size_t dirty_count;
+    size_t dirty_cap;
+#endif
+
+    // metrics, written only by the owning thread
+    atomic_size_t queued_bytes;
+    atomic_size_t peak_queued_bytes;
+    atomic_ulong dropped_msgs;
+    atomic_ulong dropped_bytes;
+    atomic_ulong laggards;
+} Shard;
+
+typedef struct {
+    int port;
+    atomic_int running;     // cleared by SIGTERM, read by every shard
+    pid_t server_pid;
+
+    // config
+    size_t high_water;
+    LagPolicy lag_policy;
+    int workers;
+    ServerEngine engine;
+
+    // only used inside the server process
+    Shard *shards;
+    atomic_int next_id;
+    atomic_size_t client_count;
+} ServerState;
+
+extern ServerState server_state;
+
+
+/* Runs the chat server until SIGTERM, with one event loop per worker.
+ * Prereq: server_state.port, high_water, lag_policy, workers and engine are set
+ */
+void server_loop();
+
+
+#endif
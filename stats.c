@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "stats.h"
+#include "io_helpers.h"
+
+ShellStats shell_stats;
+
+
+uint64_t stats_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+
+void stats_add(atomic_ulong *counter, uint64_t value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+
+static void stats_max(atomic_ulong *counter, uint64_t value) {
+    unsigned long seen = atomic_load_explicit(counter, memory_order_relaxed);
+    while (seen < value &&
+           !atomic_compare_exchange_weak_explicit(counter, &seen, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+
+void stats_event(atomic_ulong *count, atomic_ulong *total_ns, uint64_t start) {
+    stats_add(count, 1);
+    stats_add(total_ns, stats_now() - start);
+}
+
+
+pid_t stats_fork() {
+    uint64_t start = stats_now();
+    pid_t pid = fork();
+    if (pid > 0) {
+        stats_event(&shell_stats.forks, &shell_stats.fork_ns, start);
+    } else if (pid == 0) {
+        stats_reset();  // the child counts only its own work
+    }
+    return pid;
+}
+
+
+static uint64_t timeval_us(const struct timeval *tv) {
+    return (uint64_t)tv->tv_sec * 1000000u + tv->tv_usec;
+}
+
+
+void stats_child(const struct rusage *usage) {
+    stats_add(&shell_stats.children, 1);
+    stats_add(&shell_stats.child_user_us, timeval_us(&usage->ru_utime));
+    stats_add(&shell_stats.child_sys_us, timeval_us(&usage->ru_stime));
+    stats_max(&shell_stats.child_max_rss_kb, usage->ru_maxrss);
+    stats_max(&shell_stats.window_max_rss_kb, usage->ru_maxrss);
+}
+
+
+void stats_window_reset() {
+    atomic_store_explicit(&shell_stats.window_max_rss_kb, 0, memory_order_relaxed);
+}
+
+
+void stats_line(uint64_t start) {
+    uint64_t elapsed = stats_now() - start;
+    stats_add(&shell_stats.lines, 1);
+    stats_add(&shell_stats.line_ns, elapsed);
+    stats_max(&shell_stats.line_max_ns, elapsed);
+}
+
+
+void stats_reset() {
+    memset(&shell_stats, 0, sizeof(shell_stats));
+}
+
+
+// ===== Reporting =====
+
+void stats_time_begin(TimeMark *mark) {
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    mark->self_user_us = timeval_us(&self.ru_utime);
+    mark->self_sys_us = timeval_us(&self.ru_stime);
+    mark->child_user_us = atomic_load_explicit(&shell_stats.child_user_us, memory_order_relaxed);
+    mark->child_sys_us = atomic_load_explicit(&shell_stats.child_sys_us, memory_order_relaxed);
+    stats_window_reset();
+    mark->start = stats_now();
+}
+
+
+void stats_time_report(const TimeMark *mark) {
+    uint64_t real_us = (stats_now() - mark->start) / 1000;
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+    uint64_t user_us = timeval_us(&self.ru_utime) - mark->self_user_us +
+        atomic_load_explicit(&shell_stats.child_user_us, memory_order_relaxed) - mark->child_user_us;
+    uint64_t sys_us = timeval_us(&self.ru_stime) - mark->self_sys_us +
+        atomic_load_explicit(&shell_stats.child_sys_us, memory_order_relaxed) - mark->child_sys_us;
+    unsigned long rss_kb = atomic_load_explicit(&shell_stats.window_max_rss_kb, memory_order_relaxed);
+    if (rss_kb == 0) {
+        rss_kb = self.ru_maxrss;    // nothing was spawned: the shell itself did the work
+    }
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), "real\t%lu.%06lus\nuser\t%lu.%06lus\nsys\t%lu.%06lus\nmaxrss\t%lukB\n",
+             (unsigned long)(real_us / 1000000), (unsigned long)(real_us % 1000000),
+             (unsigned long)(user_us / 1000000), (unsigned long)(user_us % 1000000),
+             (unsigned long)(sys_us / 1000000), (unsigned long)(sys_us % 1000000), rss_kb);
+    display_stderr(buf);
+}
+
+
+typedef struct {
+    const char *name;
+    atomic_ulong *value;
+} StatField;
+
+#define STAT_FIELD(field) {#field, &shell_stats.field}
+
+static const StatField STAT_FIELDS[] = {
+    STAT_FIELD(lines), STAT_FIELD(line_ns), STAT_FIELD(line_max_ns),
+    STAT_FIELD(parses), STAT_FIELD(parse_ns),
+    STAT_FIELD(builtins), STAT_FIELD(builtin_ns),
+    STAT_FIELD(forks), STAT_FIELD(fork_ns),
+    STAT_FIELD(spawns), STAT_FIELD(spawn_ns),
+    STAT_FIELD(children), STAT_FIELD(child_user_us), STAT_FIELD(child_sys_us), STAT_FIELD(child_max_rss_kb),
+};
+#define STAT_FIELD_COUNT (sizeof(STAT_FIELDS) / sizeof(StatField))
+
+
+/* Return: length of the report written into buf (at most size - 1)
+ */
+static size_t stats_format(char *buf, size_t size, int json) {
+    struct rusage self;
+    getrusage(RUSAGE_SELF, &self);
+
+    size_t len = 0;
+    len += snprintf(buf + len, size - len, json ? "{" : "");
+    for (size_t i = 0; i < STAT_FIELD_COUNT && len < size; i++) {
+        unsigned long value = atomic_load_explicit(STAT_FIELDS[i].value, memory_order_relaxed);
+        len += snprintf(buf + len, size - len, json ? "\"%s\": %lu, " : "%-18s %lu\n", STAT_FIELDS[i].name, value);
+    }
+    if (len < size) {
+        len += snprintf(buf + len, size - len, json ?
+            "\"self_user_us\": %lu, \"self_sys_us\": %lu, \"self_max_rss_kb\": %ld}\n" :
+            "self_user_us       %lu\nself_sys_us        %lu\nself_max_rss_kb    %ld\n",
+            (unsigned long)timeval_us(&self.ru_utime), (unsigned long)timeval_us(&self.ru_stime), self.ru_maxrss);
+    }
+    return len < size ? len : size - 1;
+}
+
+
+void stats_print(int json) {
+    char buf[2048];
+    size_t len = stats_format(buf, sizeof(buf), json);
+    display_buffer(buf, len);
+}
+
+
+void stats_dump_env() {
+    const char *target = getenv("MYSH_STATS");
+    if (target == NULL || target[0] == '\0') {
+        return;
+    }
+    char buf[2048];
+    size_t len = stats_format(buf, sizeof(buf), 1);
+    int fd = STDERR_FILENO;
+    if (strcmp(target, "1") != 0) {
+        fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            display_error("ERROR: Cannot write stats to: ", (char *)target);
+            return;
+        }
+    }
+    display_flush();
+    if (write(fd, buf, len) < 0) {
+        display_error("ERROR: Cannot write stats to: ", (char *)target);
+    }
+    if (fd != STDERR_FILENO) {
+        close(fd);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+
+/* Counters for where the shell spends its time. Updated with relaxed atomics
+ * so worker threads may add to them too; each process (a forked job) keeps
+ * its own copy. Times are in nanoseconds unless the name says otherwise.
+ */
+typedef struct {
+    atomic_ulong lines;             // command lines run
+    atomic_ulong line_ns;
+    atomic_ulong line_max_ns;
+    atomic_ulong parses;            // command lines parsed
+    atomic_ulong parse_ns;
+    atomic_ulong builtins;          // builtins run inside the shell
+    atomic_ulong builtin_ns;
+    atomic_ulong forks;
+    atomic_ulong fork_ns;           // time fork() takes in the parent
+    atomic_ulong spawns;
+    atomic_ulong spawn_ns;          // time posix_spawn takes to return
+    atomic_ulong children;          // children reaped
+    atomic_ulong child_user_us;
+    atomic_ulong child_sys_us;
+    atomic_ulong child_max_rss_kb;
+    atomic_ulong window_max_rss_kb; // since the last stats_window_reset, for time
+} ShellStats;
+
+extern ShellStats shell_stats;
+
+
+/* Return: CLOCK_MONOTONIC in nanoseconds
+ */
+uint64_t stats_now();
+
+void stats_add(atomic_ulong *counter, uint64_t value);
+
+
+/* Adds one event that started at start (a stats_now value)
+ */
+void stats_event(atomic_ulong *count, atomic_ulong *total_ns, uint64_t start);
+
+
+/* fork, timed and counted
+ */
+pid_t stats_fork();
+
+
+/* Accounts a reaped child's resource usage (from wait4)
+ */
+void stats_child(const struct rusage *usage);
+void stats_window_reset();
+
+
+/* Accounts a finished command line that started at start
+ */
+void stats_line(uint64_t start);
+
+
+/* Snapshot taken when a timed command line starts
+ */
+typedef struct {
+    uint64_t start;
+    uint64_t self_user_us;
+    uint64_t self_sys_us;
+    uint64_t child_user_us;
+    uint64_t child_sys_us;
+} TimeMark;
+
+void stats_time_begin(TimeMark *mark);
+
+
+/* Prints real, user and sys time since mark (shell plus reaped children) and
+ * the largest child max RSS, like the time keyword, on stderr
+ */
+void stats_time_report(const TimeMark *mark);
+
+
+/* Prints every counter, as text or as one JSON object
+ */
+void stats_print(int json);
+void stats_reset();
+
+
+/* With MYSH_STATS set, writes the JSON counters to stderr ("1") or to the
+ * file it names. Called as the shell exits.
+ */
+void stats_dump_env();
+
+#endif
@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+
+
+/* Chat fan-out test. One sender and RECEIVERS receivers connect to a running
+ * server. The sender sends MSGS messages in windows of CHAT_WINDOW frames per
+ * write, some holding a NUL byte and some larger than one read, and every
+ * receiver but the first must get each window, prefixed with the sender's
+ * name, before the next goes out. The first receiver reads nothing until the
+ * end, so its copies pile up on the server; it must then get all of them, in
+ * order.
+ *
+ *   chat PORT HOST RECEIVERS MSGS
+ *
+ * Prints the first lost, altered or reordered message and exits 1.
+ *
+ *   chat PORT HOST --listen COUNT
+ *
+ * Connects one client, prints "connected" once it is welcomed, then prints
+ * the next COUNT messages as they arrive, one per line. Exits 1 if they stop
+ * coming.
+ */
+
+#define CHAT_WINDOW 16
+#define CHAT_BIG_LEN 10000      // bigger than FRAME_READ_CHUNK
+#define CHAT_CONNECT_MS 5000    // the server may still be starting
+#define CHAT_WAIT_MS 2000       // longest wait for one delivery
+
+
+static long now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+
+static int chat_connect(const char *host, int port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(host);
+
+    long deadline = now_ms() + CHAT_CONNECT_MS;
+    while (1) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        if (errno != ECONNREFUSED || now_ms() > deadline) {
+            return -1;
+        }
+        usleep(10000);
+    }
+}
+
+
+/* Waits for the next whole frame, at most CHAT_WAIT_MS between reads
+ * Return: 0 and the frame, or -1 on EOF, error, timeout or a malformed stream
+ */
+static int next_frame(int fd, FrameReader *in, Frame *frame) {
+    int ret;
+    while ((ret = frame_next(in, frame)) == 0) {
+        struct pollfd pfd = {.fd = fd, .events = POLLIN};
+        if (poll(&pfd, 1, CHAT_WAIT_MS) <= 0) {
+            return -1;
+        }
+        ssize_t n = frame_read(in, fd);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            return -1;
+        }
+    }
+    return ret == 1 ? 0 : -1;
+}
+
+
+/* Reads the welcome frame "clientN: connected\n"
+ * Return: N, or -1 on error
+ */
+static int read_welcome(int fd, FrameReader *in) {
+    Frame frame;
+    char line[64];
+    if (next_frame(fd, in, &frame) < 0 || frame.type != FRAME_MSG || frame.len >= sizeof(line)) {
+        return -1;
+    }
+    memcpy(line, frame.payload, frame.len);
+    line[frame.len] = '\0';
+    int id;
+    return sscanf(line, "client%d: connected\n", &id) == 1 ? id : -1;
+}
+
+
+/* Builds message k as the server relays it from client sender
+ * Return: its length; the sent payload starts after the first space
+ */
+static size_t expected(char *buf, size_t size, int sender, long k) {
+    size_t len = snprintf(buf, size, "client%d: msg %ld", sender, k);
+    if (k % 3 == 0) {
+        buf[len++] = '\0';      // payloads are bytes, not strings
+        len += snprintf(buf + len, size - len, "after nul");
+    }
+    if (k % 100 == 50) {
+        memset(buf + len, 'x', CHAT_BIG_LEN);
+        len += CHAT_BIG_LEN;
+    }
+    buf[len++] = '\n';
+    return len;
+}
+
+
+/* Return: 0 if the next frame on fd is message k, else -1
+ */
+static int expect_msg(int fd, FrameReader *in, int sender, long k) {
+    static char want[CHAT_BIG_LEN + 128];
+    size_t len = expected(want, sizeof(want), sender, k);
+    Frame frame;
+    if (next_frame(fd, in, &frame) < 0 || frame.type != FRAME_MSG) {
+        return -1;
+    }
+    return frame.len == len && memcmp(frame.payload, want, len) == 0 ? 0 : -1;
+}
+
+
+/* Return: 0 once count messages were printed, 1 if they stopped coming
+ */
+static int listen_for(const char *host, int port, long count) {
+    FrameReader in = {0};
+    int fd = chat_connect(host, port);
+    if (fd < 0 || read_welcome(fd, &in) < 0) {
+        fprintf(stderr, "chat: cannot connect to %s:%d\n", host, port);
+        return 1;
+    }
+    printf("connected\n");
+    fflush(stdout);
+
+    Frame frame;
+    long got = 0;
+    while (got < count && next_frame(fd, &in, &frame) == 0) {
+        fwrite(frame.payload, 1, frame.len, stdout);
+        if (frame.len == 0 || frame.payload[frame.len - 1] != '\n') {
+            putchar('\n');
+        }
+        fflush(stdout);
+        got++;
+    }
+    frame_reader_free(&in);
+    close(fd);
+    return got < count;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 5) {
+        fprintf(stderr, "usage: chat PORT HOST RECEIVERS MSGS\n       chat PORT HOST --listen COUNT\n");
+        return 2;
+    }
+    int port = atoi(argv[1]);
+    const char *host = argv[2];
+    if (strcmp(argv[3], "--listen") == 0) {
+        return listen_for(host, port, atol(argv[4]));
+    }
+    int count = atoi(argv[3]);
+    long msgs = atol(argv[4]);
+    if (count < 2 || msgs < 1) {
+        fprintf(stderr, "chat: need at least 2 receivers and 1 message\n");
+        return 2;
+    }
+
+    FrameReader sender_in = {0};
+    int sender = chat_connect(host, port);
+    int sender_id = sender < 0 ? -1 : read_welcome(sender, &sender_in);
+    if (sender_id < 0) {
+        fprintf(stderr, "chat: cannot connect to %s:%d\n", host, port);
+        return 1;
+    }
+    int *receivers = malloc(count * sizeof(int));
+    FrameReader *in = calloc(count, sizeof(FrameReader));
+    for (int i = 0; i < count; i++) {
+        receivers[i] = chat_connect(host, port);
+        if (receivers[i] < 0 || read_welcome(receivers[i], &in[i]) < 0) {
+            fprintf(stderr, "chat: receiver %d could not connect\n", i);
+            return 1;
+        }
+    }
+
+    static char msg[CHAT_BIG_LEN + 128];
+    FrameWriter out = {0};
+    int failed = 0;
+    for (long k = 0; k < msgs && !failed; k += CHAT_WINDOW) {
+        long end = k + CHAT_WINDOW < msgs ? k + CHAT_WINDOW : msgs;
+        for (long j = k; j < end; j++) {
+            size_t len = expected(msg, sizeof(msg), sender_id, j);
+            size_t prefix_len = strcspn(msg, " ") + 1;
+            frame_append(&out, FRAME_MSG, msg + prefix_len, len - prefix_len);
+        }
+        if (frame_flush(&out, sender) < 0) {
+            fprintf(stderr, "chat: send failed at message %ld\n", k);
+            failed = 1;
+            break;
+        }
+        for (int i = 1; i < count && !failed; i++) {
+            for (long j = k; j < end; j++) {
+                if (expect_msg(receivers[i], &in[i], sender_id, j) < 0) {
+                    fprintf(stderr, "chat: receiver %d lost or garbled message %ld\n", i, j);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    // the lazy receiver gets everything it left queued, in order
+    for (long k = 0; k < msgs && !failed; k++) {
+        if (expect_msg(receivers[0], &in[0], sender_id, k) < 0) {
+            fprintf(stderr, "chat: lazy receiver lost or garbled message %ld\n", k);
+            failed = 1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        frame_reader_free(&in[i]);
+        close(receivers[i]);
+    }
+    free(in);
+    free(receivers);
+    frame_reader_free(&sender_in);
+    frame_writer_free(&out);
+    close(sender);
+    return failed;
+}
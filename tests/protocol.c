@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "protocol.h"
+
+
+/* Framing tests: frames split at every byte, partial reads from a socket,
+ * malformed headers and the payload size limit. Prints each failure and
+ * exits 1 if there was any.
+ */
+
+static int failures = 0;
+
+#define check(cond, what) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, what); \
+            failures++; \
+        } \
+    } while (0)
+
+
+// ===== Helpers =====
+
+static int pair[2];     // feed writes into pair[1], the reader reads pair[0]
+
+
+/* Hands len bytes to reader as exactly one frame_read, as if they were one
+ * chunk off the network
+ */
+static void feed(FrameReader *reader, const char *buf, size_t len) {
+    if (len == 0) return;   // a read of nothing would block
+    check(write(pair[1], buf, len) == (ssize_t)len, "write");
+    check(frame_read(reader, pair[0]) == (ssize_t)len, "read");
+}
+
+
+/* Encodes the three sample frames every test sends
+ */
+static void sample_frames(FrameWriter *out) {
+    frame_append(out, FRAME_MSG, "hello", 5);
+    frame_append(out, FRAME_CONNECTED, NULL, 0);
+    frame_append(out, FRAME_MSG, "with\0nul\n", 9);
+}
+
+
+/* Pulls every complete frame out of reader and checks them against
+ * sample_frames, starting at sample *next
+ * Return: 0, or -1 if the stream was reported malformed
+ */
+static int expect_samples(FrameReader *reader, int *next) {
+    static const struct {
+        FrameType type;
+        const char *payload;
+        size_t len;
+    } samples[] = {
+        {FRAME_MSG, "hello", 5},
+        {FRAME_CONNECTED, "", 0},
+        {FRAME_MSG, "with\0nul\n", 9},
+    };
+
+    Frame frame;
+    int ret;
+    while ((ret = frame_next(reader, &frame)) == 1) {
+        check(*next < 3, "more frames than were sent");
+        if (*next >= 3) return -1;
+        check(frame.type == samples[*next].type, "frame type");
+        check(frame.len == samples[*next].len, "frame length");
+        check(memcmp(frame.payload, samples[*next].payload, frame.len) == 0, "frame payload");
+        (*next)++;
+    }
+    return ret;
+}
+
+
+// ===== Tests =====
+
+static void test_whole_buffer() {
+    FrameWriter out = {0};
+    sample_frames(&out);
+    check(out.len == 3 * FRAME_HEADER_LEN + 14, "encoded size");
+
+    FrameReader reader = {0};
+    feed(&reader, out.buf, out.len);
+    int next = 0;
+    check(expect_samples(&reader, &next) == 0, "well-formed stream");
+    check(next == 3, "every frame decoded");
+    frame_reader_free(&reader);
+    frame_writer_free(&out);
+}
+
+
+/* frame_feed takes bytes that arrived some other way, in any pieces, none
+ * at all included
+ */
+static void test_feed() {
+    FrameWriter out = {0};
+    sample_frames(&out);
+
+    FrameReader reader = {0};
+    int next = 0;
+    check(frame_feed(&reader, out.buf, 0) == 0, "nothing fed to an empty reader");
+    check(expect_samples(&reader, &next) == 0 && next == 0, "nothing decoded");
+    for (size_t pos = 0; pos < out.len; pos += 7) {
+        size_t len = out.len - pos < 7 ? out.len - pos : 7;
+        check(frame_feed(&reader, out.buf + pos, len) == 0, "feed");
+        check(expect_samples(&reader, &next) == 0, "fed pieces");
+    }
+    check(next == 3, "every frame decoded from fed pieces");
+    frame_reader_free(&reader);
+    frame_writer_free(&out);
+}
+
+
+/* Every way of cutting the stream in two, plus one byte at a time: a frame
+ * only comes out once its last byte is in
+ */
+static void test_split_frames() {
+    FrameWriter out = {0};
+    sample_frames(&out);
+
+    for (size_t cut = 0; cut <= out.len; cut++) {
+        FrameReader reader = {0};
+        int next = 0;
+        feed(&reader, out.buf, cut);
+        check(expect_samples(&reader, &next) == 0, "first half");
+        feed(&reader, out.buf + cut, out.len - cut);
+        check(expect_samples(&reader, &next) == 0, "second half");
+        check(next == 3, "every frame decoded after a split");
+        frame_reader_free(&reader);
+    }
+
+    FrameReader reader = {0};
+    int next = 0;
+    for (size_t i = 0; i < out.len; i++) {
+        feed(&reader, out.buf + i, 1);
+        check(expect_samples(&reader, &next) == 0, "byte at a time");
+        if (i < FRAME_HEADER_LEN + 5 - 1) {
+            check(next == 0, "frame decoded before its last byte");
+        }
+    }
+    check(next == 3, "every frame decoded a byte at a time");
+    frame_reader_free(&reader);
+    frame_writer_free(&out);
+}
+
+
+/* frame_read returns whatever one read gives; frames straddling reads are
+ * kept until the rest arrives
+ */
+static void test_partial_reads() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+        check(0, "socketpair");
+        return;
+    }
+
+    FrameWriter out = {0};
+    sample_frames(&out);
+    FrameReader reader = {0};
+    int next = 0;
+    size_t cuts[] = {3, FRAME_HEADER_LEN + 2, FRAME_HEADER_LEN + 5 + 1, out.len};
+    size_t sent = 0;
+    for (size_t c = 0; c < sizeof(cuts) / sizeof(*cuts); c++) {
+        write(fds[1], out.buf + sent, cuts[c] - sent);
+        sent = cuts[c];
+        check(frame_read(&reader, fds[0]) > 0, "read");
+        check(expect_samples(&reader, &next) == 0, "partial read");
+    }
+    check(next == 3, "every frame decoded across reads");
+
+    // a frame bigger than one read chunk arrives over several reads
+    char *big = malloc(FRAME_MAX_PAYLOAD);
+    memset(big, 'x', FRAME_MAX_PAYLOAD);
+    out.len = 0;    // the samples went out by hand above
+    frame_append(&out, FRAME_MSG, big, FRAME_MAX_PAYLOAD);
+    check(frame_flush(&out, fds[1]) == 0, "flush");
+    check(out.len == 0, "flush empties the writer");
+    Frame frame;
+    int ret = 0, reads = 0;
+    while (ret == 0 && frame_read(&reader, fds[0]) > 0) {
+        reads++;
+        ret = frame_next(&reader, &frame);
+    }
+    check(reads > 1, "large frame took several reads");
+    check(ret == 1 && frame.len == FRAME_MAX_PAYLOAD, "large frame decoded");
+    check(ret == 1 && memcmp(frame.payload, big, FRAME_MAX_PAYLOAD) == 0, "large payload");
+
+    // EOF after a partial frame leaves it undecoded
+    frame_header(big, FRAME_MSG, 10);
+    write(fds[1], big, FRAME_HEADER_LEN + 4);
+    close(fds[1]);
+    check(frame_read(&reader, fds[0]) == FRAME_HEADER_LEN + 4, "partial frame read");
+    check(frame_next(&reader, &frame) == 0, "partial frame held back");
+    check(frame_read(&reader, fds[0]) == 0, "EOF");
+
+    free(big);
+    close(fds[0]);
+    frame_reader_free(&reader);
+    frame_writer_free(&out);
+}
+
+
+static void test_malformed() {
+    char hdr[FRAME_HEADER_LEN];
+    Frame frame;
+
+    FrameReader reader = {0};
+    frame_header(hdr, FRAME_MSG, FRAME_MAX_PAYLOAD + 1);
+    feed(&reader, hdr, sizeof(hdr));
+    check(frame_next(&reader, &frame) == -1, "oversized length rejected");
+    frame_reader_free(&reader);
+
+    frame_header(hdr, FRAME_STATS + 1, 0);
+    feed(&reader, hdr, sizeof(hdr));
+    check(frame_next(&reader, &frame) == -1, "unknown type rejected");
+    frame_reader_free(&reader);
+
+    frame_header(hdr, 0, 0);
+    feed(&reader, hdr, sizeof(hdr));
+    check(frame_next(&reader, &frame) == -1, "type 0 rejected");
+    frame_reader_free(&reader);
+
+    // the header alone decides: a short header is just incomplete
+    frame_header(hdr, FRAME_STATS + 1, 0);
+    feed(&reader, hdr, FRAME_HEADER_LEN - 1);
+    check(frame_next(&reader, &frame) == 0, "short header waits");
+    frame_reader_free(&reader);
+}
+
+
+static void test_payload_limit() {
+    FrameWriter out = {0};
+    char *big = calloc(FRAME_MAX_PAYLOAD + 1, 1);
+    check(frame_append(&out, FRAME_MSG, big, FRAME_MAX_PAYLOAD) == 0, "largest payload accepted");
+    size_t len = out.len;
+    check(frame_append(&out, FRAME_MSG, big, FRAME_MAX_PAYLOAD + 1) == -1, "oversized payload refused");
+    check(out.len == len, "refused frame left nothing behind");
+    free(big);
+    frame_writer_free(&out);
+}
+
+
+int main() {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        perror("socketpair");
+        return 1;
+    }
+    test_whole_buffer();
+    test_split_frames();
+    test_partial_reads();
+    test_feed();
+    test_malformed();
+    test_payload_limit();
+    if (failures > 0) {
+        fprintf(stderr, "protocol: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("protocol: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,654 @@
+#!/bin/sh
+# Behaviour tests: runs commands through mysh in a scratch directory and
+# compares stdout and stderr (together) and the exit status with the expected
+# ones. Job ids print as "[N] PID", ps lines as "NAME PID" and time reports
+# as bare field names so the output is stable. The chat cases
+# start a server from mysh, fed commands on a pipe as if typed, and run
+# tests/chat against it.
+#
+# MYSH picks the shell under test (default ./mysh, the sanitizer build).
+# Exits 1 if any case fails.
+
+set -u
+cd "$(dirname "$0")/.."
+export LC_ALL=C     # sort order
+
+MYSH=${MYSH:-mysh}
+case $MYSH in /*) ;; *) MYSH=$(pwd)/$MYSH ;; esac    # cases run in $TMP
+TMP=$(mktemp -d "${TMPDIR:-/tmp}/mysh-test.XXXXXX") || exit 1
+trap 'rm -rf "$TMP"' EXIT INT TERM
+failed=0
+passed=0
+port=$((20000 + $$ % 1000))
+
+# result NAME STATUS DETAILS-FILE
+result() {
+    if [ "$2" -eq 0 ]; then
+        passed=$((passed + 1))
+        return
+    fi
+    failed=$((failed + 1))
+    printf 'FAIL %s\n' "$1"
+    cat "$3"
+}
+
+
+# expect NAME STATUS EXPECTED GOT-STATUS GOT INPUT
+expect() {
+    got=$(printf '%s\n' "$5" | sed -e 's/^\[\([0-9]*\)\] [0-9]*$/[\1] PID/' \
+        -e 's/^\([a-z]*\) [0-9][0-9]*$/\1 PID/' -e 's/^\(real\|user\|sys\|maxrss\)\t.*/\1/')
+    if [ "$got" = "$3" ] && [ "$4" -eq "$2" ]; then
+        passed=$((passed + 1))
+        return
+    fi
+    failed=$((failed + 1))
+    printf 'FAIL %s\n  commands: %s\n  expected (status %s):\n%s\n  got (status %s):\n%s\n' \
+        "$1" "$6" "$2" "$3" "$4" "$got"
+}
+
+
+# check NAME STATUS EXPECTED COMMANDS
+check() {
+    rm -rf "$TMP"/*
+    got=$(cd "$TMP" && "$MYSH" -c "$4" 2>&1)
+    expect "$1" "$2" "$3" $? "$got" "$4"
+}
+
+
+# script NAME STATUS EXPECTED INPUT
+# Runs INPUT, as is, from a script file and then from piped stdin.
+script() {
+    rm -rf "$TMP"/*
+    printf '%s' "$4" > "$TMP/script"
+    got=$(cd "$TMP" && "$MYSH" script 2>&1)
+    expect "$1 (file)" "$2" "$3" $? "$got" "$4"
+    got=$(cd "$TMP" && "$MYSH" < script 2>&1)
+    expect "$1 (stdin)" "$2" "$3" $? "$got" "$4"
+}
+
+
+# same NAME EXPECTED-FILE GOT-FILE
+same() {
+    if cmp -s "$2" "$3"; then
+        passed=$((passed + 1))
+        return
+    fi
+    failed=$((failed + 1))
+    printf 'FAIL %s\n' "$1"
+    cmp "$2" "$3"
+}
+
+
+# chat NAME RECEIVERS MSGS [START-SERVER OPTIONS]...
+# The server runs until tests/chat is done; its own output is dropped.
+chat() {
+    name=$1 receivers=$2 msgs=$3
+    shift 3
+    port=$((port + 1))
+    rm -f "$TMP/chat.done"
+    {
+        echo "start-server $port $*"
+        while [ ! -e "$TMP/chat.done" ]; do sleep 0.05; done
+        echo close-server
+    } | "$MYSH" > /dev/null 2>&1 &
+    tests/chat "$port" 127.0.0.1 "$receivers" "$msgs" 2> "$TMP/chat.err"
+    status=$?
+    touch "$TMP/chat.done"
+    wait
+    result "$name" "$status" "$TMP/chat.err"
+}
+
+
+# sends NAME EXPECTED COMMANDS...
+# Types COMMANDS into mysh once a listener is connected to its server, with
+# PORT replaced by the server's port, and compares what the listener gets,
+# client names stripped, with EXPECTED.
+sends() {
+    name=$1 want=$2
+    shift 2
+    port=$((port + 1))
+    rm -f "$TMP/chat.done" "$TMP/listen.out"
+    tests/chat "$port" 127.0.0.1 --listen "$(printf '%s\n' "$want" | wc -l)" \
+        > "$TMP/listen.out" 2> "$TMP/chat.err" &
+    listener=$!
+    {
+        echo "start-server $port"
+        until grep -q '^connected$' "$TMP/listen.out" 2> /dev/null; do sleep 0.05; done
+        for cmd; do
+            printf '%s\n' "$cmd" | sed "s/PORT/$port/g"
+            sleep 0.1
+        done
+        while [ ! -e "$TMP/chat.done" ]; do sleep 0.05; done
+        echo close-server
+    } | "$MYSH" > /dev/null 2>&1 &
+    wait "$listener"
+    status=$?
+    touch "$TMP/chat.done"
+    wait
+    got=$(sed -e '1d' -e 's/^client[0-9]*: //' "$TMP/listen.out")
+    if [ "$status" -eq 0 ] && [ "$got" != "$want" ]; then
+        printf 'expected:\n%s\ngot:\n%s\n' "$want" "$got" > "$TMP/chat.err"
+        status=1
+    fi
+    result "$name" "$status" "$TMP/chat.err"
+}
+
+
+# ===== Input =====
+
+script "several lines in one read" 0 'a
+b
+c' \
+    'echo a
+echo b
+echo c
+'
+long=$(printf '%0300d' 0)
+script "line longer than MAX_STR_LEN" 0 "$long" \
+    "echo $long
+"
+script "last line without a newline" 0 'a
+b' \
+    'echo a
+echo b'
+script "line of spaces does not exit" 0 'after' \
+    '   
+echo after
+'
+
+check "-c runs every line" 0 'hi' \
+    'x=hi
+echo $x'
+check "output keeps its order around external commands" 0 'a
+b
+c
+d' \
+    'echo a
+/bin/echo b
+echo c
+/bin/echo d | cat'
+check "unknown command" 127 'ERROR: Unknown command: nosuch' \
+    'nosuch'
+check "errors keep their place in the output" 0 'a
+ERROR: Unknown command: nosuch
+b' \
+    'echo a
+nosuch
+echo b'
+check "long error message" 127 "ERROR: Unknown command: $long" \
+    "$long"
+big=$(i=0; while [ $i -lt 20000 ]; do echo "echo $i done"; i=$((i+1)); done)
+script "buffered output is complete" 0 "$(seq 0 19999 | sed 's/$/ done/')" \
+    "$big
+"
+
+
+# ===== Quoting and expansion =====
+
+check "single quotes are literal" 0 'a  $x b' \
+    "x=1; echo 'a  \$x b'"
+check "double quotes expand" 0 'a  1 b' \
+    'x=1; echo "a  $x b"'
+check "backslash escapes" 0 'c d $x' \
+    'x=1; echo c\ d \$x'
+check "braced names" 0 'vx vy' \
+    'n=v; echo ${n}x "${n}y"'
+check "unset names expand to nothing" 0 'ab' \
+    'echo a${nope}b$nope'
+check "adjacent quoted parts join" 0 'one two' \
+    "x=one; echo \"\$x\"' 'two"
+check "quoted and escaped separators" 0 'a;b x;y' \
+    'echo "a;b" x\;y'
+check "comments" 0 'a' \
+    'echo a # b'
+check "open quote continues on the next line" 0 'a
+b' \
+    "echo 'a
+b'"
+check "unterminated quote" 2 'ERROR: Syntax error: unexpected end of input' \
+    "echo 'a"
+check "unterminated brace" 2 'ERROR: Syntax error: unexpected end of input' \
+    'echo ${x'
+
+
+# ===== Redirections =====
+
+check "truncate and append" 0 'hi
+more' \
+    'echo hi > f; echo more >> f; cat f'
+check "input" 0 'hi' \
+    'echo hi > f; cat < f'
+check "stderr to a file" 0 'ERROR: Unknown command: nosuch' \
+    'nosuch 2> err; cat err'
+check "stderr onto stdout" 0 'out
+err' \
+    "sh -c 'echo out; echo err >&2' > o 2>&1; cat o"
+check "redirection alone creates the file" 0 'made' \
+    '> f; cat f && echo made'
+check "missing input file" 1 'ERROR: Cannot open: missing' \
+    'cat < missing'
+check "redirection without a file" 2 'ERROR: Syntax error near: end of line' \
+    'echo a >'
+
+
+# ===== Lists =====
+
+check "&& runs on success" 0 'yes' \
+    'false && echo no; true && echo yes'
+check "|| runs on failure" 0 'alt' \
+    'false || echo alt'
+check "; runs both" 0 'a
+b' \
+    'echo a; echo b'
+check "trailing && continues" 0 'a
+b' \
+    'echo a &&
+echo b'
+check "background job notice skips its redirection" 0 '[1] PID
+f:
+bg' \
+    'echo bg > f &
+sleep 0.2; echo f:; cat f'
+check "background list" 0 '[1] PID
+a
+b' \
+    'echo a > f && echo b >> f &
+sleep 0.2; cat f'
+check "syntax error" 2 'ERROR: Syntax error near: |' \
+    'echo a | | cat'
+check "exit status of the last command" 1 '' \
+    'true; false'
+check "exit with a status" 3 '' \
+    'exit 3; echo unreached'
+check "exit keeps the last status" 1 '' \
+    'false; exit'
+check "exit status wraps at 256" 4 '' \
+    'exit 260'
+check "exit from a function" 5 '' \
+    'f() { exit 5; echo unreached; }; f; echo unreached'
+check "status of a function" 1 '' \
+    'f() { false; }; f'
+script "exit in a script stops it" 3 'a' \
+    'echo a
+exit 3
+echo b
+'
+
+
+# ===== Commands and pipelines =====
+
+check "external command with arguments" 0 'a b' \
+    '/bin/echo a  b'
+check "external pipeline" 0 '3
+2' \
+    'seq 3 | sort -r | head -n 2'
+check "program without #! runs under /bin/sh" 0 'got 2 a
+b' \
+    'echo "echo got \$# \$1" > s; chmod +x s; ./s a b | cat; echo b'
+check "file that is not executable" 127 'ERROR: Unknown command: ./s' \
+    'echo "echo x" > s; ./s'
+check "builtin stage in a pipeline" 0 'abc' \
+    'echo abc | cat | cat'
+check "last reader sees EOF" 0 '5' \
+    'seq 5 | cat | tail -n 1'
+check "builtin stage outlives an earlier one" 0 'abc' \
+    'sleep 0.1 | sleep 0.3 | xargs echo abc | cat'
+check "builtin last stage" 0 'word count 2
+character count 4
+newline count 1' \
+    'echo a b | cat | wc'
+check "shell survives a reader that quits" 0 'alive' \
+    'seq 100000 | cat | true
+echo hi | true
+echo alive'
+script "cat on piped shell input" 0 'a
+b' \
+    'echo a | cat
+echo b
+'
+check "builtin names match exactly" 0 'ERROR: Unknown command: ech
+ERROR: Unknown command: echoo
+ERROR: Unknown command: start-server-now
+hi' \
+    'ech hi
+echoo hi
+start-server-now
+echo hi'
+check "failed stage does not stop the pipeline" 0 'ERROR: Unknown command: nosuch
+after' \
+    'nosuch | /bin/echo after'
+
+
+# ===== cat =====
+
+# cat picks its copy method by what its ends are, so run it into each kind
+rm -rf "$TMP"/*
+{ printf 'with\0nul\n'; seq 100000; } > "$TMP/data"
+(cd "$TMP" && "$MYSH" -c 'cat data' > out)
+same "cat into a file" "$TMP/data" "$TMP/out"
+(cd "$TMP" && printf 'old\n' > out && "$MYSH" -c 'cat data' >> out)
+{ printf 'old\n'; cat "$TMP/data"; } > "$TMP/want"
+same "cat onto an append-mode file" "$TMP/want" "$TMP/out"
+(cd "$TMP" && "$MYSH" -c 'cat data' | cat > out)
+same "cat into a pipe" "$TMP/data" "$TMP/out"
+(cd "$TMP" && cat data | "$MYSH" -c 'cat' > out)
+same "cat from a pipe" "$TMP/data" "$TMP/out"
+(cd "$TMP" && "$MYSH" -c 'echo before
+cat data
+echo after' > out)
+{ echo before; cat "$TMP/data"; echo after; } > "$TMP/want"
+same "cat keeps buffered output in order" "$TMP/want" "$TMP/out"
+
+
+# ===== wc =====
+
+# counts FILE: mysh's wc output for FILE, from coreutils wc
+counts() {
+    printf 'word count %s\ncharacter count %s\nnewline count %s' \
+        "$(wc -w < "$1")" "$(wc -c < "$1")" "$(wc -l < "$1")"
+}
+
+check "wc separators" 0 'word count 6
+character count 11
+newline count 1' \
+    "printf 'a\\tb\\rc\\vd\\fe\\nf' | wc"
+check "wc of nothing" 0 'word count 0
+character count 0
+newline count 0' \
+    'true | wc'
+
+# a file this big is mapped and counted on several threads
+rm -rf "$TMP"/*
+yes 'one two  three' | head -c 67200000 > "$TMP/big"
+got=$(cd "$TMP" && "$MYSH" -c 'wc big' 2>&1)
+expect "wc of a file past WC_PARALLEL_MIN" 0 "$(counts "$TMP/big")" $? "$got" 'wc big'
+got=$(cd "$TMP" && "$MYSH" -c 'cat big | wc' 2>&1)
+expect "wc of the same bytes from a pipe" 0 "$(counts "$TMP/big")" $? "$got" 'cat big | wc'
+# stdin that was partly read already: only the rest counts, from mid-word
+tail -c +12351 "$TMP/big" > "$TMP/rest"
+got=$(cd "$TMP" && { dd bs=12350 count=1 of=/dev/null 2> /dev/null; "$MYSH" -c wc; } < big 2>&1)
+expect "wc of a partly read stdin" 0 "$(counts "$TMP/rest")" $? "$got" 'wc < big, 12350 bytes in'
+got=$(cd "$TMP" && { "$MYSH" -c wc > /dev/null; wc -c; } < big 2>&1)
+expect "wc leaves stdin at its end" 0 '0' $? "$got" 'wc < big, then wc -c'
+rm -f "$TMP/big" "$TMP/rest"
+
+
+# ===== ls =====
+
+# directory order depends on the filesystem, so listings are sorted
+rm -rf "$TMP"/*
+for i in $(seq 20); do
+    for j in $(seq 10); do
+        mkdir -p "$TMP/t/d$i/e$j"
+        touch "$TMP/t/d$i/e$j/f1" "$TMP/t/d$i/e$j/f2"
+    done
+done
+want=$(cd "$TMP/t" && { find . -mindepth 1 -printf '%f\n'; find . -type d -printf '.\n..\n'; } | sort)
+got=$(cd "$TMP" && "$MYSH" -c 'ls --rec t | sort' 2>&1)
+expect "ls --rec lists every entry once" 0 "$want" $? "$got" 'ls --rec t | sort'
+
+check "ls --d limits the depth" 0 '.
+.
+..
+..
+b
+c' \
+    'mkdir -p a/b/c/d
+ls --rec --d 2 a | sort'
+check "ls --f filters names" 0 'f1
+f2' \
+    'mkdir -p a/b
+touch a/f1 a/b/f2 a/b/g
+ls --rec --f f a | sort'
+check "ls --rec follows symlinked directories" 0 'f
+f' \
+    'mkdir -p d/x
+touch d/x/f
+ln -s x d/l
+ln -s /nonexistent d/dangling
+ls --rec --f f d'
+check "ls --rec stops where a symlink loops back" 0 '.
+.
+.
+..
+..
+..
+a
+b
+self
+up' \
+    'mkdir -p a/b
+ln -s .. a/up
+ln -s . a/b/self
+ls --rec a | sort'
+names='touch abc abd axc a-c Abc a*c ab b [ab 0123456789abcdefXYZ zzzzzzzzzzzzzzzzzzzzzzzzzzzzzneedle needle xneedlex
+'
+check "ls --g set" 0 'abc
+axc' \
+    "${names}ls --g a[bx]c | sort"
+check "ls --g negated sets" 0 'a*c
+a-c
+axc
+Abc
+abc' \
+    "${names}ls --g a[!b]c | sort
+ls --g [^b]bc | sort"
+check "ls --g range and ?" 0 'abc
+abd' \
+    "${names}ls --g a[a-c]? | sort"
+check "ls --g escaped star" 0 'a*c' \
+    "${names}ls --g 'a\\*c'"
+check "ls --g star at the start" 0 'Abc
+a*c
+a-c
+abc
+axc' \
+    "${names}ls --g *c | sort"
+check "ls --g star in the middle" 0 'a*c
+a-c
+abc
+axc' \
+    "${names}ls --g a*c | sort"
+check "ls --g star at the end" 0 'a*c
+a-c
+ab
+abc
+abd
+axc' \
+    "${names}ls --g a* | sort"
+check "ls --g unterminated set is literal" 0 '[ab' \
+    "${names}ls --g [ab"
+check "ls --f needle across a 16-byte step" 0 '0123456789abcdefXYZ' \
+    "${names}ls --f efXY"
+check "ls --f needle at the end of the name" 0 '0123456789abcdefXYZ' \
+    "${names}ls --f XYZ"
+check "ls --f needle anywhere" 0 'needle
+xneedlex
+zzzzzzzzzzzzzzzzzzzzzzzzzzzzzneedle' \
+    "${names}ls --f needle | sort"
+check "ls --f needle longer than every name" 0 '' \
+    "${names}ls --f needlessly-long-needle-longer-than-names"
+check "ls --f and --g together" 1 'ERROR: --f and --g cannot be combined
+ERROR: Builtin failed: ls' \
+    'ls --f a --g b'
+check "ls of a missing path" 1 'ERROR: Invalid path: nosuch
+ERROR: Builtin failed: ls' \
+    'ls nosuch'
+
+
+# ===== Background jobs =====
+
+check "finished job ids are reused" 0 '[1] PID
+[2] PID
+sleep PID
+[2] PID' \
+    'sleep 1 &
+true &
+sleep 0.2
+ps
+true &'
+many=$(i=0; while [ $i -lt 500 ]; do echo 'true &'; i=$((i+1)); done)
+got=$(cd "$TMP" && "$MYSH" -c "$many
+echo done" 2>&1 | grep -v '^\[[0-9]*\] [0-9]*$')
+expect "more jobs than the old table held" 0 'done' $? "$got" '500 x true &'
+
+# a job that ends while the shell waits for input is reaped then, not after
+# the next line
+rm -rf "$TMP"/*
+mkfifo "$TMP/in"
+"$MYSH" < "$TMP/in" > /dev/null 2>&1 &
+shell=$!
+exec 3> "$TMP/in"
+echo 'sleep 0.1 &' >&3
+sleep 0.5
+got=$(ps -o stat= --ppid "$shell" | grep -c Z)
+exec 3>&-
+wait "$shell"
+expect "job reaped while the shell waits for input" 0 '0' $? "$got" 'sleep 0.1 &, then nothing'
+
+
+# ===== time and stats =====
+
+check "time reports after the line" 0 '1
+2
+real
+user
+sys
+maxrss' \
+    'time seq 2 | cat'
+check "time keyword times each pipeline" 0 't
+real
+user
+sys
+maxrss
+u
+real
+user
+sys
+maxrss' \
+    'time echo t | cat && echo u && time true'
+check "time as an argument is a word" 0 'time
+time a' \
+    'echo time; echo "time" a'
+
+# a line is counted once it finishes: stats -r's counts, the stats line's not
+counters='stats -r
+seq 1 | cat
+/bin/true
+stats'
+got=$(cd "$TMP" && "$MYSH" -c "$counters" 2>&1 | grep -E '^(lines|spawns|children) ')
+expect "stats counts lines, spawns and children" 0 'lines              3
+spawns             2
+children           2' $? "$got" "$counters"
+got=$(cd "$TMP" && "$MYSH" -c 'stats --json' 2>&1 | sed 's/[0-9][0-9]*/N/g')
+expect "stats --json" 0 '{"lines": N, "line_ns": N, "line_max_ns": N, "parses": N, "parse_ns": N, "builtins": N, "builtin_ns": N, "forks": N, "fork_ns": N, "spawns": N, "spawn_ns": N, "children": N, "child_user_us": N, "child_sys_us": N, "child_max_rss_kb": N, "self_user_us": N, "self_sys_us": N, "self_max_rss_kb": N}' \
+    $? "$got" 'stats --json'
+rm -rf "$TMP"/*
+MYSH_STATS="$TMP/stats" "$MYSH" -c true && MYSH_STATS="$TMP/stats" "$MYSH" -c true
+expect "MYSH_STATS=FILE appends a line per shell" 0 '2' $? "$(grep -c '^{"lines": 1,' "$TMP/stats")" \
+    'MYSH_STATS=FILE mysh -c true, twice'
+
+
+# ===== Command hash =====
+
+seq=$(command -v seq)
+check "hash counts hits" 0 "1
+1
+hits	command
+   2	$seq" \
+    'seq 1
+seq 1
+hash'
+check "hash NAME caches without running" 0 "hits	command
+   1	$seq" \
+    'hash seq
+hash'
+check "hash -r clears" 0 '1
+hash: hash table empty' \
+    'seq 1
+hash -r
+hash'
+check "hash skips functions and builtins" 0 'hash: hash table empty' \
+    'f() { true; }; hash f echo; hash'
+check "hash of an unknown name" 1 'ERROR: Not found: nosuch
+ERROR: Builtin failed: hash' \
+    'hash nosuch'
+
+# a cached binary that moved within PATH is looked up again
+rm -rf "$TMP"/*
+mkdir "$TMP/a" "$TMP/b"
+moved='cp /bin/echo a/tool
+tool one
+mv a/tool b/tool
+tool two'
+got=$(cd "$TMP" && PATH="$TMP/a:$TMP/b:$PATH" "$MYSH" -c "$moved" 2>&1)
+expect "cached command that moved is found again" 0 'one
+two' $? "$got" "$moved"
+
+
+# ===== Functions and aliases =====
+
+check "function arguments" 0 '2 a a b
+0 ' \
+    'f() { echo $# $1 $@; }
+f a b
+f'
+check "\$@ inside a longer word" 0 '2:a:a b
+xa by
+0::
+xy' \
+    'f() { echo "$#:$1:$@"; echo x$@y; }; f a b; f'
+check "function over several lines" 0 'in
+out' \
+    'f() {
+echo in
+}
+f
+echo out'
+check "function calling a function" 0 'a
+b' \
+    'a() { echo a; }
+b() { a; echo b; }
+b'
+check "function in a pipeline" 0 'x' \
+    'f() { echo x; }
+f | cat'
+check "runaway recursion stops" 1 'ERROR: Function nesting too deep: d' \
+    'd() { d; }
+d'
+check "function on one line" 0 'a
+b' \
+    'f() { echo a; echo b; }; f'
+check "function shadowing a builtin stays out of the shell" 0 '1' \
+    'x=1; cat() { x=2; }; echo a | cat; /bin/echo $x'
+check "alias and unalias" 127 'hi there
+ERROR: Unknown command: greet' \
+    'alias greet=echo hi
+greet there
+unalias greet
+greet'
+
+
+# ===== Chat server =====
+
+chat "fan-out to 20 clients" 20 300
+chat "queued copies under the high-water mark" 5 300 --hwm 65536
+chat "fan-out across 4 workers" 20 300 --workers 4
+chat "fan-out on the io_uring engine" 20 300 --engine uring
+chat "fan-out across 4 io_uring workers" 20 300 --workers 4 --engine uring
+
+sends "pooled sends arrive in order" 'one
+two
+three' \
+    'send PORT 127.0.0.1 one' 'send PORT 127.0.0.1 two' 'send PORT 127.0.0.1 three'
+sends "send joins its words into one message" 'hello there
+again' \
+    'send PORT 127.0.0.1 hello there' 'send PORT 127.0.0.1 again'
+sends "send --batch sends one message per line" '1
+2
+3' \
+    'seq 3 | send --batch PORT 127.0.0.1'
+
+
+printf '%d passed, %d failed\n' "$passed" "$failed"
+[ "$failed" -eq 0 ]
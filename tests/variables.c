@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "variables.h"
+
+
+/* Variable table tests: growth past many names, reassignment in place and
+ * through the arena, compaction of dead values and assignment parsing.
+ * Prints each failure and exits 1 if there was any.
+ */
+
+static int failures = 0;
+
+#define check(cond, what) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, what); \
+            failures++; \
+        } \
+    } while (0)
+
+
+// ===== Helpers =====
+
+/* Return: 1 if name is bound to value
+ */
+static int has(VarTable *vars, const char *name, const char *value) {
+    return strcmp(find_var(name, strlen(name), vars), value) == 0;
+}
+
+
+static int put(VarTable *vars, const char *name, const char *value) {
+    return set_var(vars, name, strlen(name), value, strlen(value));
+}
+
+
+// ===== Tests =====
+
+static void test_empty() {
+    VarTable vars = {0};
+    check(has(&vars, "x", ""), "unset name on an empty table");
+    check(put(&vars, "", "v") == 0 && vars.count == 0, "empty name binds nothing");
+    free_vars(&vars);
+}
+
+
+/* The table stays at most half full however many names it holds
+ */
+static void test_growth() {
+    VarTable vars = {0};
+    char name[32], value[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        snprintf(value, sizeof(value), "value %d", i);
+        check(put(&vars, name, value) == 0, "set");
+    }
+    check(vars.count == 1000, "every name bound once");
+    check(vars.count * 2 <= vars.slot_cap, "at most half full");
+    for (int i = 0; i < 1000; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        snprintf(value, sizeof(value), "value %d", i);
+        check(has(&vars, name, value), "value survives growth");
+    }
+    check(has(&vars, "v1000", ""), "unset name among many");
+    free_vars(&vars);
+}
+
+
+/* Shorter values reuse their room; longer ones move, and the arena compacts
+ * instead of growing without bound
+ */
+static void test_reassign() {
+    VarTable vars = {0};
+    put(&vars, "x", "a fairly long first value");
+    char *first = find_var("x", 1, &vars);
+    put(&vars, "x", "short");
+    check(has(&vars, "x", "short"), "shorter value");
+    check(find_var("x", 1, &vars) == first, "shorter value updated in place");
+    put(&vars, "x", "");
+    check(has(&vars, "x", ""), "empty value");
+
+    char value[200];
+    for (int i = 0; i < 10000; i++) {
+        memset(value, 'a' + i % 26, sizeof(value) - 1);
+        value[10 + i % 180] = '\0';
+        check(put(&vars, "x", value) == 0, "reassign");
+        check(has(&vars, "x", value), "reassigned value");
+    }
+    check(vars.count == 1, "reassignment keeps one binding");
+    check(vars.arena_cap <= 64 * 1024, "dead values are reclaimed");
+    free_vars(&vars);
+}
+
+
+/* A full table only grows for a new name, not for a reassignment
+ */
+static void test_reassign_full() {
+    VarTable vars = {0};
+    char name[32];
+    for (int i = 0; i < VARS_MIN_SLOTS / 2; i++) {
+        snprintf(name, sizeof(name), "v%d", i);
+        put(&vars, name, "1");
+    }
+    check(vars.slot_cap == VARS_MIN_SLOTS, "half full at the smallest size");
+    put(&vars, "v0", "2");
+    check(vars.slot_cap == VARS_MIN_SLOTS && has(&vars, "v0", "2"), "reassignment does not grow the table");
+    put(&vars, "new", "3");
+    check(vars.slot_cap == 2 * VARS_MIN_SLOTS, "a new name does");
+    check(has(&vars, "new", "3") && has(&vars, "v0", "2"), "values survive the growth");
+    free_vars(&vars);
+}
+
+
+static void test_assign_var() {
+    VarTable vars = {0};
+    char a[] = "x=a=b", b[] = "y=1", c[] = "novalue", d[] = "z=";
+    check(assign_var(&vars, a, 1) == 1 && has(&vars, "x", "a=b"), "value may hold =");
+    check(assign_var(&vars, b, 2) == 0 && has(&vars, "y", ""), "not the only token");
+    check(assign_var(&vars, c, 1) == 0, "no =");
+    check(assign_var(&vars, d, 1) == 1 && has(&vars, "z", ""), "empty value");
+    free_vars(&vars);
+}
+
+
+int main() {
+    test_empty();
+    test_growth();
+    test_reassign();
+    test_reassign_full();
+    test_assign_var();
+    if (failures > 0) {
+        fprintf(stderr, "variables: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("variables: all checks passed\n");
+    return 0;
+}
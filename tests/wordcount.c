@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// the kernels are static, so the module is compiled into the test
+#include "../wordcount.c"
+
+
+/* Word count tests: every kernel against a byte-at-a-time reference, words
+ * straddling 16, 32 and 64 byte steps, read boundaries and thread chunk
+ * boundaries. Prints each failure and exits 1 if there was any.
+ */
+
+static int failures = 0;
+
+#define check(cond, what) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "FAIL %s:%d: %s\n", __func__, __LINE__, what); \
+            failures++; \
+        } \
+    } while (0)
+
+
+// ===== Helpers =====
+
+static void reference_classify(const unsigned char *block, uint64_t *space, uint64_t *newline) {
+    uint64_t sp = 0, nl = 0;
+    for (int i = 0; i < WC_BLOCK; i++) {
+        sp |= (uint64_t)is_space(block[i]) << i;
+        nl |= (uint64_t)(block[i] == '\n') << i;
+    }
+    *space = sp;
+    *newline = nl;
+}
+
+
+static WcCounts reference_count(const unsigned char *buf, size_t len) {
+    WcCounts counts = {0};
+    int prev_space = 1;
+    for (size_t i = 0; i < len; i++) {
+        int space = buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n'
+                 || buf[i] == '\v' || buf[i] == '\f' || buf[i] == '\r';
+        counts.words += prev_space && !space;
+        counts.newlines += buf[i] == '\n';
+        prev_space = space;
+    }
+    counts.bytes = len;
+    return counts;
+}
+
+
+static int same_counts(WcCounts a, WcCounts b) {
+    return a.words == b.words && a.bytes == b.bytes && a.newlines == b.newlines;
+}
+
+
+static struct {
+    const char *name;
+    wc_kernel classify;
+} kernels[4];
+static int kernel_count = 0;
+
+
+/* Collects every kernel this CPU can run, plus the reference
+ */
+static void find_kernels() {
+    kernels[kernel_count].name = "reference";
+    kernels[kernel_count++].classify = reference_classify;
+#if defined(__x86_64__)
+    kernels[kernel_count].name = "sse2";
+    kernels[kernel_count++].classify = classify_sse2;
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[kernel_count].name = "avx2";
+        kernels[kernel_count++].classify = classify_avx2;
+    }
+#else
+    kernels[kernel_count].name = "scalar";
+    kernels[kernel_count++].classify = classify_scalar;
+#endif
+}
+
+
+/* Bytes around every whitespace character and the signed/unsigned edges
+ */
+static const unsigned char edge_bytes[] = {
+    ' ', '\t', '\n', '\v', '\f', '\r', 0, 0x08, 0x0e, 0x1f, 0x21, 'a', 0x7f, 0x80, 0x85, 0xa0, 0xff,
+};
+
+
+// ===== Tests =====
+
+static void test_kernels_classify() {
+    unsigned char block[WC_BLOCK];
+    srand(1);
+    for (int round = 0; round < 20000; round++) {
+        for (int i = 0; i < WC_BLOCK; i++) {
+            block[i] = round < 256 ? (unsigned char)(round + i) : edge_bytes[rand() % sizeof(edge_bytes)];
+        }
+        uint64_t want_space, want_newline;
+        reference_classify(block, &want_space, &want_newline);
+        for (int k = 1; k < kernel_count; k++) {
+            uint64_t space, newline;
+            kernels[k].classify(block, &space, &newline);
+            if (space != want_space || newline != want_newline) {
+                fprintf(stderr, "  kernel %s, round %d\n", kernels[k].name, round);
+                check(0, "kernel masks differ from the reference");
+                return;
+            }
+        }
+    }
+}
+
+
+/* A word ending or starting at every offset across the 16, 32 and 64 byte
+ * steps, fed whole and in pieces of several sizes
+ */
+static void test_words_across_steps() {
+    unsigned char buf[4 * WC_BLOCK + 7];
+    size_t len = sizeof(buf);
+    size_t pieces[] = {1, 7, 16, 31, 32, 63, 64, 65, 100, sizeof(buf)};
+
+    for (size_t split = 1; split < len; split++) {
+        memset(buf, 'x', len);
+        buf[split] = split % 2 ? ' ' : '\t';     // one separator moves along
+        buf[len - 1 - split / 2] = "\r\v\f\n"[split % 4];
+        WcCounts want = reference_count(buf, len);
+
+        for (int k = 0; k < kernel_count; k++) {
+            for (size_t p = 0; p < sizeof(pieces) / sizeof(*pieces); p++) {
+                WcState state = {.prev_space = 1};
+                for (size_t pos = 0; pos < len; pos += pieces[p]) {
+                    size_t n = len - pos < pieces[p] ? len - pos : pieces[p];
+                    wc_feed(&state, kernels[k].classify, buf + pos, n);
+                }
+                if (!same_counts(state.counts, want)) {
+                    fprintf(stderr, "  kernel %s, separator at %zu, pieces of %zu\n",
+                            kernels[k].name, split, pieces[p]);
+                    check(0, "counts differ from the reference");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+
+/* Every thread count, with a word across every chunk boundary: chunks start
+ * on multiples of WC_BLOCK, never on a separator
+ */
+static void test_chunks() {
+    size_t len = (1 << 20) + 3 * WC_BLOCK + 5;
+    unsigned char *buf = malloc(len);
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = i % 1000 == 999 ? ' ' : i % 4002 == 4001 ? '\n' : 'w';
+    }
+    WcCounts want = reference_count(buf, len);
+    for (int k = 0; k < kernel_count; k++) {
+        for (size_t threads = 1; threads <= WC_MAX_THREADS; threads++) {
+            WcCounts got;
+            wc_count_chunks(buf, len, kernels[k].classify, threads, &got);
+            if (!same_counts(got, want)) {
+                fprintf(stderr, "  kernel %s, %zu threads\n", kernels[k].name, threads);
+                check(0, "chunked counts differ from the reference");
+            }
+        }
+    }
+    free(buf);
+}
+
+
+int main() {
+    find_kernels();
+    test_kernels_classify();
+    test_words_across_steps();
+    test_chunks();
+    if (failures > 0) {
+        fprintf(stderr, "wordcount: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("wordcount: all checks passed (kernels:");
+    for (int k = 1; k < kernel_count; k++) {
+        printf(" %s", kernels[k].name);
+    }
+    printf(")\n");
+    return 0;
+}
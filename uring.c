@@ -0,0 +1,213 @@
+#include "uring.h"
+
+#if HAVE_URING
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+// ===== Syscalls =====
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const sigset_t *sig) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, sig, _NSIG / 8);
+}
+
+
+static int sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+// ===== Ring setup =====
+
+int uring_init(Uring *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = sys_setup(entries, &p);
+    if (ring->fd < 0) {
+        return -errno;
+    }
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(ring->fd);
+        return -ENOSYS;
+    }
+
+    // SQ and CQ rings share one mapping
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_mem_size = sq_size > cq_size ? sq_size : cq_size;
+    ring->ring_mem = mmap(NULL, ring->ring_mem_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring_mem == MAP_FAILED) {
+        int err = errno;
+        close(ring->fd);
+        return -err;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        int err = errno;
+        munmap(ring->ring_mem, ring->ring_mem_size);
+        close(ring->fd);
+        return -err;
+    }
+
+    char *sq = ring->ring_mem;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    char *cq = ring->ring_mem;
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+
+void uring_free(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_mem, ring->ring_mem_size);
+    close(ring->fd);
+}
+
+
+// ===== Submission and completion =====
+
+/* Makes every sqe handed out so far visible to the kernel
+ * Return: number of newly published sqes
+ */
+static unsigned uring_flush_sq(Uring *ring) {
+    unsigned tail = *ring->sq_tail;
+    unsigned n = ring->sqe_tail - tail;
+    for (; tail != ring->sqe_tail; tail++) {
+        ring->sq_array[tail & *ring->sq_mask] = tail & *ring->sq_mask;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+    return n;
+}
+
+
+struct io_uring_sqe *uring_get_sqe(Uring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->sq_entries) {
+        if (uring_submit_and_wait(ring, 0, NULL) < 0) {
+            return NULL;
+        }
+        head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (ring->sqe_tail - head >= ring->sq_entries) {
+            return NULL;
+        }
+    }
+
+    struct io_uring_sqe *sqe = &ring->sqes[ring->sqe_tail & *ring->sq_mask];
+    ring->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, const sigset_t *sigmask) {
+    unsigned to_submit = uring_flush_sq(ring);
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    if (to_submit == 0 && wait_nr == 0) {
+        return 0;
+    }
+
+    int ret = sys_enter(ring->fd, to_submit, wait_nr, flags, sigmask);
+    return ret < 0 ? -errno : ret;
+}
+
+
+struct io_uring_cqe *uring_peek_cqe(Uring *ring) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+void uring_cqe_seen(Uring *ring) {
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+
+// ===== Provided buffers =====
+
+int uring_buf_ring_init(Uring *ring, UringBufRing *br, unsigned short bgid, unsigned entries, size_t buf_size) {
+    memset(br, 0, sizeof(*br));
+    br->br_size = entries * sizeof(struct io_uring_buf);
+    br->br = mmap(NULL, br->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (br->br == MAP_FAILED) {
+        return -errno;
+    }
+    br->bufs = malloc(entries * buf_size);
+    if (br->bufs == NULL) {
+        munmap(br->br, br->br_size);
+        return -ENOMEM;
+    }
+    br->entries = entries;
+    br->buf_size = buf_size;
+    br->bgid = bgid;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long)br->br;
+    reg.ring_entries = entries;
+    reg.bgid = bgid;
+    if (sys_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = errno;
+        free(br->bufs);
+        munmap(br->br, br->br_size);
+        return -err;
+    }
+
+    for (unsigned i = 0; i < entries; i++) {
+        uring_buf_recycle(br, i);
+    }
+    return 0;
+}
+
+
+void uring_buf_ring_free(Uring *ring, UringBufRing *br) {
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = br->bgid;
+    sys_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    free(br->bufs);
+    munmap(br->br, br->br_size);
+}
+
+
+char *uring_buf(UringBufRing *br, unsigned short bid) {
+    return br->bufs + (size_t)bid * br->buf_size;
+}
+
+
+void uring_buf_recycle(UringBufRing *br, unsigned short bid) {
+    struct io_uring_buf *buf = &br->br->bufs[br->tail & (br->entries - 1)];
+    buf->addr = (unsigned long)uring_buf(br, bid);
+    buf->len = br->buf_size;
+    buf->bid = bid;
+    br->tail++;
+    __atomic_store_n(&br->br->tail, br->tail, __ATOMIC_RELEASE);
+}
+
+
+#endif
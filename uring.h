@@ -0,0 +1,94 @@
+#ifndef __URING_H__
+#define __URING_H__
+
+/* Minimal io_uring wrapper over the raw syscalls, just enough for the chat
+ * server engine. HAVE_URING is 0 where the kernel headers are missing.
+ */
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define HAVE_URING 1
+#else
+#define HAVE_URING 0
+#endif
+
+#if HAVE_URING
+
+#include <sys/types.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+
+
+typedef struct {
+    int fd;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_entries;
+    unsigned sqe_tail;      // sqes handed out but not yet published
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_mem;         // SQ and CQ rings share one mapping
+    size_t ring_mem_size;
+    size_t sqes_size;
+} Uring;
+
+/* A provided buffer ring: the kernel picks a free buffer for each recv and
+ * reports its id in the completion.
+ */
+typedef struct {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    char *bufs;
+    unsigned entries;
+    size_t buf_size;
+    unsigned short bgid;
+    unsigned short tail;
+} UringBufRing;
+
+
+/* Return: 0 on success, -errno if io_uring is unavailable
+ */
+int uring_init(Uring *ring, unsigned entries);
+void uring_free(Uring *ring);
+
+
+/* Return: a zeroed sqe, flushing the queue to the kernel first if it is full,
+ * or NULL if that fails
+ */
+struct io_uring_sqe *uring_get_sqe(Uring *ring);
+
+
+/* Publishes queued sqes and waits for at least wait_nr completions under
+ * sigmask (NULL keeps the current mask).
+ * Return: number submitted, or -errno (-EINTR if a signal arrived)
+ */
+int uring_submit_and_wait(Uring *ring, unsigned wait_nr, const sigset_t *sigmask);
+
+
+/* Return: the next completion, or NULL if none is ready
+ */
+struct io_uring_cqe *uring_peek_cqe(Uring *ring);
+void uring_cqe_seen(Uring *ring);
+
+
+/* Registers entries buffers of buf_size bytes under group bgid. entries must be a power of 2.
+ * Return: 0 on success, -errno on failure (older kernels)
+ */
+int uring_buf_ring_init(Uring *ring, UringBufRing *br, unsigned short bgid, unsigned entries, size_t buf_size);
+void uring_buf_ring_free(Uring *ring, UringBufRing *br);
+
+char *uring_buf(UringBufRing *br, unsigned short bid);
+
+
+/* Hands buffer bid back to the kernel
+ */
+void uring_buf_recycle(UringBufRing *br, unsigned short bid);
+
+
+#endif
+#endif
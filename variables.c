@@ -5,113 +5,212 @@
 
 #include "variables.h"
 #include "io_helpers.h"
+#include "cmdhash.h"
 
 
-Var_Node *make_var_node(char *str, size_t token_count){
-    if(token_count != 1){
-        return NULL;
+// ===== Hash table =====
+
+/* Prereq: vars->slot_cap > 0
+ * Return: the slot bound to name, or the empty slot where it belongs
+ */
+static VarSlot *var_slot(VarTable *vars, const char *name, size_t len, uint32_t hash) {
+    size_t mask = vars->slot_cap - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        VarSlot *slot = &vars->slots[i];
+        if (slot->name_len == 0) {
+            return slot;
+        }
+        if (slot->hash == hash && slot->name_len == len &&
+            memcmp(vars->arena + slot->name_off, name, len) == 0) {
+            return slot;
+        }
     }
+}
 
-    char var_name[128];
-    char var_data[128];
-    char *curr = strchr(str, '=');
 
-    if (curr){
-        int var_name_len = curr - str;
-        strncpy(var_name, str, var_name_len);
-        var_name[var_name_len] = '\0';
+/* Doubles the slot array and rehashes every binding
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int vars_grow(VarTable *vars) {
+    size_t cap = vars->slot_cap ? vars->slot_cap * 2 : VARS_MIN_SLOTS;
+    VarSlot *slots = calloc(cap, sizeof(VarSlot));
+    if (slots == NULL) {
+        return -1;
+    }
 
-        strcpy(var_data, curr + 1);
-    } else {
-        return NULL;
+    for (size_t i = 0; i < vars->slot_cap; i++) {
+        VarSlot *old = &vars->slots[i];
+        if (old->name_len == 0) continue;
+        size_t j = old->hash & (cap - 1);
+        while (slots[j].name_len != 0) {
+            j = (j + 1) & (cap - 1);
+        }
+        slots[j] = *old;
     }
+    free(vars->slots);
+    vars->slots = slots;
+    vars->slot_cap = cap;
+    return 0;
+}
 
-    Var_Node *var = malloc(sizeof(Var_Node));
-    var->name = malloc(strlen(var_name) + 1);
-    var->data = malloc(strlen(var_data) + 1);
-    var->next = NULL;
 
-    strcpy(var->name, var_name);
-    strcpy(var->data, var_data);
-    return var;
+// ===== Arena =====
+
+/* Copies every live name and value into a fresh arena, dropping dead bytes
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int arena_compact(VarTable *vars, size_t extra) {
+    size_t live = vars->arena_len - vars->arena_dead;
+    size_t cap = VARS_MIN_ARENA;
+    while (cap < 2 * (live + extra)) {
+        cap *= 2;
+    }
+    char *arena = malloc(cap);
+    if (arena == NULL) {
+        return -1;
+    }
+
+    size_t len = 0;
+    for (size_t i = 0; i < vars->slot_cap; i++) {
+        VarSlot *slot = &vars->slots[i];
+        if (slot->name_len == 0) continue;
+        memcpy(arena + len, vars->arena + slot->name_off, slot->name_len + 1);
+        slot->name_off = len;
+        len += slot->name_len + 1;
+        memcpy(arena + len, vars->arena + slot->value_off, slot->value_len + 1);
+        slot->value_off = len;
+        len += slot->value_cap;
+    }
+    free(vars->arena);
+    vars->arena = arena;
+    vars->arena_len = len;
+    vars->arena_cap = cap;
+    vars->arena_dead = 0;
+    return 0;
 }
 
 
-void free_vars(Var_Node *front){
-    Var_Node *next;
-    while (front!=NULL){
-        next = front->next;
-        free(front->name);
-        free(front->data);
-        free(front);
-        front = next;
+/* Makes room for n more arena bytes, compacting instead of growing when most
+ * of the arena is dead. Arena offsets stay valid; pointers into it do not.
+ * Return: 0 on success, -1 if memory ran out
+ */
+static int arena_reserve(VarTable *vars, size_t n) {
+    if (vars->arena_len + n <= vars->arena_cap) {
+        return 0;
+    }
+    if (vars->arena_dead > vars->arena_len / 2) {
+        return arena_compact(vars, n);
+    }
+
+    size_t cap = vars->arena_cap ? vars->arena_cap : VARS_MIN_ARENA;
+    while (cap < vars->arena_len + n) {
+        cap *= 2;
+    }
+    char *arena = realloc(vars->arena, cap);
+    if (arena == NULL) {
+        return -1;
     }
+    vars->arena = arena;
+    vars->arena_cap = cap;
+    return 0;
 }
 
 
-char *expand_vars(char *input_buf, Var_Node *vars){
-    if (!input_buf){
-        return NULL;
-    }
-    
-    char ret_buf[MAX_STR_LEN+1];
-    ret_buf[128] = '\0';
-    size_t remaining = MAX_STR_LEN;
-
-    char *curr = input_buf;
-    while (*curr && remaining > 0){
-        if (*curr == '$'){
-            char *end = curr + 1;
-
-            // check for treating $ as a character
-            if((*end == ' ') || (*end == '\n') || (*end == '\0')){ 
-                strcat(ret_buf, "$");
-                curr++;
-                continue;
-            }
-
-            // find end of var name to expand
-            while((*end != '\n') && (*end != ' ') && (*end != '$') && (*end != '\0')){
-                end++;
-            }
-
-            int var_len = end - curr - 1;
-            char var_name[var_len + 1];
-            strncpy(var_name, curr + 1, var_len);
-            var_name[var_len] = '\0';
-            
-            char *expanded = find_var(var_name, vars);
-            
-            // check for max length expansion
-            if (remaining < strlen(expanded)){
-                strncat(ret_buf, expanded, remaining);
-                break;
-            } else {
-                strcat(ret_buf, expanded);
-                remaining -= strlen(expanded);
-            }
-
-            curr = end;
-
-        } else {
-            strncat(ret_buf, curr, 1);
-            curr++;
-            remaining--;
+/* Prereq: room for cap bytes was reserved, cap > len
+ * Return: offset of the copied string
+ */
+static uint32_t arena_put(VarTable *vars, const char *str, size_t len, size_t cap) {
+    uint32_t off = vars->arena_len;
+    memcpy(vars->arena + off, str, len);
+    vars->arena[off + len] = '\0';
+    vars->arena_len += cap;
+    return off;
+}
+
+
+// ===== Variables =====
+
+int set_var(VarTable *vars, const char *name, size_t name_len, const char *value, size_t value_len) {
+    if (name_len == 0) {
+        return 0;   // "=x" binds nothing, as before
+    }
+    if (vars->slot_cap == 0 && vars_grow(vars) < 0) {
+        return -1;
+    }
+
+    size_t value_cap = (value_len + VARS_VALUE_ALIGN) & ~(size_t)(VARS_VALUE_ALIGN - 1);
+    uint32_t hash = cmd_hash(0, name, name_len);
+    VarSlot *slot = var_slot(vars, name, name_len, hash);
+
+    if (slot->name_len != 0) {
+        if (value_len < slot->value_cap) {
+            memcpy(vars->arena + slot->value_off, value, value_len);
+            vars->arena[slot->value_off + value_len] = '\0';
+            slot->value_len = value_len;
+            return 0;
         }
+        if (arena_reserve(vars, value_cap) < 0) {
+            return -1;
+        }
+        vars->arena_dead += slot->value_cap;
+        slot->value_off = arena_put(vars, value, value_len, value_cap);
+        slot->value_len = value_len;
+        slot->value_cap = value_cap;
+        return 0;
     }
-    char *ptr = strdup(ret_buf);
-    return ptr;
+
+    // only a new binding can push the table past half full
+    if ((vars->count + 1) * 2 > vars->slot_cap) {
+        if (vars_grow(vars) < 0) {
+            return -1;
+        }
+        slot = var_slot(vars, name, name_len, hash);
+    }
+    if (arena_reserve(vars, name_len + 1 + value_cap) < 0) {
+        return -1;
+    }
+    slot->hash = hash;
+    slot->name_off = arena_put(vars, name, name_len, name_len + 1);
+    slot->name_len = name_len;
+    slot->value_off = arena_put(vars, value, value_len, value_cap);
+    slot->value_len = value_len;
+    slot->value_cap = value_cap;
+    vars->count++;
+    return 0;
 }
 
 
-char *find_var(char *var_name, Var_Node *vars){
-    Var_Node *curr = vars;
-    while(curr != NULL){
-        if (strcmp(curr->name, var_name) == 0){
-            return curr->data;
-        }
-        curr = curr->next;
+int assign_var(VarTable *vars, char *str, size_t token_count){
+    if(token_count != 1){
+        return 0;
+    }
+
+    char *curr = strchr(str, '=');
+    if (!curr){
+        return 0;
+    }
+    if (set_var(vars, str, curr - str, curr + 1, strlen(curr + 1)) < 0){
+        return -1;
     }
-    return "";
+    return 1;
+}
+
+
+void free_vars(VarTable *vars){
+    free(vars->slots);
+    free(vars->arena);
+    memset(vars, 0, sizeof(*vars));
 }
 
+
+char *find_var(const char *var_name, size_t len, VarTable *vars){
+    if (vars->count == 0){
+        return "";
+    }
+
+    VarSlot *slot = var_slot(vars, var_name, len, cmd_hash(0, var_name, len));
+    if (slot->name_len == 0){
+        return "";
+    }
+    return vars->arena + slot->value_off;
+}
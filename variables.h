@@ -3,20 +3,61 @@
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 #define MAX_STR_LEN 128
 #define DELIMITERS " \t\n"     // Assumption: all input tokens are whitespace delimited
 
-typedef struct node{
-    char *name;
-    char *data;
-    struct node *next;
-} Var_Node;
+#define VARS_MIN_SLOTS 16       // power of 2
+#define VARS_MIN_ARENA 1024
+#define VARS_VALUE_ALIGN 16     // value room is rounded up so small growth updates in place
 
-Var_Node *make_var_node(char *str, size_t token_count);
-void free_vars(Var_Node *front);
-char *expand_vars(char *input_buf, Var_Node *vars);
-char *find_var(char *var_name, Var_Node *vars);
+/* One binding. name and value are NUL terminated strings in the arena;
+ * value_cap is the room reserved there for in-place updates.
+ */
+typedef struct {
+    uint32_t hash;
+    uint32_t name_off;
+    uint32_t name_len;          // 0 marks an empty slot
+    uint32_t value_off;
+    uint32_t value_len;
+    uint32_t value_cap;
+} VarSlot;
+
+/* Shell variables: an open-addressing hash table (linear probing, at most half
+ * full) over a flat arena holding every name and value. Reassignment reuses
+ * the binding; replaced values become dead arena bytes, reclaimed by
+ * compaction once they outweigh the live ones. Zero-initialised is empty.
+ */
+typedef struct {
+    VarSlot *slots;
+    size_t slot_cap;
+    size_t count;
+    char *arena;
+    size_t arena_len;
+    size_t arena_cap;
+    size_t arena_dead;
+} VarTable;
+
+
+/* Stores str if it is a NAME=VALUE assignment and the only token.
+ * Return: 1 if str was an assignment, 0 if not, -1 if memory ran out
+ */
+int assign_var(VarTable *vars, char *str, size_t token_count);
+
+
+/* Binds name to value, replacing any earlier binding.
+ * Return: 0 on success, -1 if memory ran out
+ */
+int set_var(VarTable *vars, const char *name, size_t name_len, const char *value, size_t value_len);
+
+void free_vars(VarTable *vars);
+
+
+/* Return: value of the len byte name var_name, or "" if it is unset. Valid
+ * until the next assignment.
+ */
+char *find_var(const char *var_name, size_t len, VarTable *vars);
 
 #endif
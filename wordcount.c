@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "wordcount.h"
+
+
+/* Carried from one buffer to the next so words split across reads, or across
+ * thread chunks, are counted once
+ */
+typedef struct {
+    WcCounts counts;
+    int prev_space;         // last byte seen was whitespace (or nothing seen yet)
+} WcState;
+
+
+// ===== Kernels =====
+
+static int is_space(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+
+/* Classifies WC_BLOCK bytes: bit i of *space / *newline is set when byte i is
+ * whitespace / '\n'
+ */
+typedef void (*wc_kernel)(const unsigned char *block, uint64_t *space, uint64_t *newline);
+
+#if !defined(__x86_64__)
+static void classify_scalar(const unsigned char *block, uint64_t *space, uint64_t *newline) {
+    uint64_t sp = 0, nl = 0;
+    for (int i = 0; i < WC_BLOCK; i++) {
+        sp |= (uint64_t)is_space(block[i]) << i;
+        nl |= (uint64_t)(block[i] == '\n') << i;
+    }
+    *space = sp;
+    *newline = nl;
+}
+#else
+static void classify_sse2(const unsigned char *block, uint64_t *space, uint64_t *newline) {
+    const __m128i blank = _mm_set1_epi8(' '), lf = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t'), ctrl_span = _mm_set1_epi8('\r' - '\t');
+    uint64_t sp = 0, nl = 0;
+    for (int i = 0; i < WC_BLOCK; i += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(block + i));
+        __m128i off = _mm_sub_epi8(c, tab);
+        __m128i ctrl = _mm_cmpeq_epi8(_mm_min_epu8(off, ctrl_span), off);     // \t..\r
+        __m128i s = _mm_or_si128(ctrl, _mm_cmpeq_epi8(c, blank));
+        sp |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << i;
+        nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(c, lf)) << i;
+    }
+    *space = sp;
+    *newline = nl;
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const unsigned char *block, uint64_t *space, uint64_t *newline) {
+    const __m256i blank = _mm256_set1_epi8(' '), lf = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t'), ctrl_span = _mm256_set1_epi8('\r' - '\t');
+    uint64_t sp = 0, nl = 0;
+    for (int i = 0; i < WC_BLOCK; i += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(block + i));
+        __m256i off = _mm256_sub_epi8(c, tab);
+        __m256i ctrl = _mm256_cmpeq_epi8(_mm256_min_epu8(off, ctrl_span), off);
+        __m256i s = _mm256_or_si256(ctrl, _mm256_cmpeq_epi8(c, blank));
+        sp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << i;
+        nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(c, lf)) << i;
+    }
+    *space = sp;
+    *newline = nl;
+}
+#endif
+
+
+/* Return: the widest kernel this CPU runs
+ */
+static wc_kernel wc_pick_kernel() {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return classify_avx2;
+    }
+    return classify_sse2;
+#else
+    return classify_scalar;
+#endif
+}
+
+
+/* Adds buf to state. A word starts at every non-space byte whose predecessor
+ * is whitespace, so the counts are popcounts over the block masks.
+ */
+static void wc_feed(WcState *state, wc_kernel classify, const unsigned char *buf, size_t len) {
+    uint64_t words = 0, newlines = 0;
+    uint64_t carry = state->prev_space;
+    size_t i = 0;
+    for (; i + WC_BLOCK <= len; i += WC_BLOCK) {
+        uint64_t space, newline;
+        classify(buf + i, &space, &newline);
+        uint64_t starts = ~space & ((space << 1) | carry);
+        words += __builtin_popcountll(starts);
+        newlines += __builtin_popcountll(newline);
+        carry = space >> 63;
+    }
+    int prev_space = carry;
+    for (; i < len; i++) {
+        int space = is_space(buf[i]);
+        words += prev_space && !space;
+        newlines += buf[i] == '\n';
+        prev_space = space;
+    }
+
+    state->counts.words += words;
+    state->counts.newlines += newlines;
+    state->counts.bytes += len;
+    state->prev_space = len > 0 ? prev_space : state->prev_space;
+}
+
+
+// ===== Threaded counting =====
+
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    wc_kernel classify;
+    WcState state;
+} WcChunk;
+
+
+static void *wc_chunk_run(void *arg) {
+    WcChunk *chunk = arg;
+    wc_feed(&chunk->state, chunk->classify, chunk->data, chunk->len);
+    return NULL;
+}
+
+
+/* Counts data split into threads chunks, each on its own thread. Every chunk
+ * is counted as if preceded by whitespace; a word straddling two chunks is
+ * then counted twice, which the stitch below takes back.
+ * Prereq: 1 <= threads <= WC_MAX_THREADS, len >= threads * WC_BLOCK
+ */
+static void wc_count_chunks(const unsigned char *data, size_t len, wc_kernel classify, size_t threads, WcCounts *counts) {
+    WcChunk chunks[WC_MAX_THREADS];
+    pthread_t tids[WC_MAX_THREADS];
+    int started[WC_MAX_THREADS];
+    size_t per = (len / threads) & ~(size_t)(WC_BLOCK - 1);
+    for (size_t t = 0; t < threads; t++) {
+        chunks[t].data = data + t * per;
+        chunks[t].len = t + 1 == threads ? len - t * per : per;
+        chunks[t].classify = classify;
+        memset(&chunks[t].state, 0, sizeof(WcState));
+        chunks[t].state.prev_space = 1;
+        // the first chunk runs here; a failed spawn also runs inline
+        started[t] = t > 0 && pthread_create(&tids[t], NULL, wc_chunk_run, &chunks[t]) == 0;
+    }
+    wc_chunk_run(&chunks[0]);
+
+    memset(counts, 0, sizeof(WcCounts));
+    for (size_t t = 0; t < threads; t++) {
+        if (t > 0) {
+            if (started[t]) {
+                pthread_join(tids[t], NULL);
+            } else {
+                wc_chunk_run(&chunks[t]);
+            }
+            if (!is_space(data[t * per - 1]) && !is_space(data[t * per])) {
+                counts->words--;
+            }
+        }
+        counts->words += chunks[t].state.counts.words;
+        counts->newlines += chunks[t].state.counts.newlines;
+        counts->bytes += chunks[t].state.counts.bytes;
+    }
+}
+
+
+/* Counts a mapped file on one thread per CPU, up to WC_MAX_THREADS
+ */
+static void wc_count_parallel(const unsigned char *data, size_t len, wc_kernel classify, WcCounts *counts) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 1 ? (size_t)cpus : 1;
+    if (threads > WC_MAX_THREADS) threads = WC_MAX_THREADS;
+    if (threads > len / (WC_PARALLEL_MIN / 4)) threads = len / (WC_PARALLEL_MIN / 4);
+    if (threads < 1) threads = 1;
+    wc_count_chunks(data, len, classify, threads, counts);
+}
+
+
+// ===== Entry point =====
+
+int wc_count_fd(int fd, WcCounts *counts) {
+    wc_kernel classify = wc_pick_kernel();
+    struct stat st;
+    off_t pos = lseek(fd, 0, SEEK_CUR);
+    if (pos >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size - pos >= WC_PARALLEL_MIN) {
+        // count from the current offset; the mapping has to start on a page
+        off_t base = pos - pos % sysconf(_SC_PAGESIZE);
+        size_t skip = pos - base;
+        size_t len = st.st_size - base;
+        void *data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, base);
+        if (data != MAP_FAILED) {
+            madvise(data, len, MADV_SEQUENTIAL);
+            wc_count_parallel((const unsigned char *)data + skip, len - skip, classify, counts);
+            munmap(data, len);
+            lseek(fd, st.st_size, SEEK_SET);    // consumed, as reading it would be
+            return 0;
+        }
+    }
+
+    // pipes, small files, or mmap refused: stream through one buffer
+    unsigned char *buf = malloc(WC_READ_SIZE);
+    if (buf == NULL) {
+        return -1;
+    }
+    WcState state = {.prev_space = 1};
+    int result = 0;
+    while (1) {
+        ssize_t n = read(fd, buf, WC_READ_SIZE);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        wc_feed(&state, classify, buf, n);
+    }
+    free(buf);
+    *counts = state.counts;
+    return result;
+}
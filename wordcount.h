@@ -0,0 +1,30 @@
+#ifndef __WORDCOUNT_H__
+#define __WORDCOUNT_H__
+
+#include <sys/types.h>
+#include <stdint.h>
+
+
+#define WC_BLOCK 64                         // bytes classified per kernel step
+#define WC_READ_SIZE (1 << 20)              // read size for pipes and small files
+#define WC_PARALLEL_MIN (64 << 20)          // files at least this big are split across threads
+#define WC_MAX_THREADS 16
+
+/* Totals for one input. A word is a maximal run of bytes that are not
+ * whitespace (space, \t, \n, \v, \f, \r).
+ */
+typedef struct {
+    uint64_t words;
+    uint64_t bytes;
+    uint64_t newlines;
+} WcCounts;
+
+
+/* Counts everything readable from fd, from its current offset on, and leaves
+ * it at the end. Regular files are mapped and, when large, counted on
+ * several threads; anything else is read in blocks.
+ * Return: 0 on success, -1 on a read error (errno is set)
+ */
+int wc_count_fd(int fd, WcCounts *counts);
+
+#endif